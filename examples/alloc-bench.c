@@ -0,0 +1,253 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+/*
+ * Allocator benchmark: a client context receives and a server context sends batches of messages
+ * with wslay_malloc_allocator, with a size class free list allocator and with per-connection arenas,
+ * counting the calls which reach malloc.
+ *
+ * To compile:
+ * $ gcc -Wall -O2 -g -o alloc-bench alloc-bench.c -I../src -lwslay -ltalloc2 -lz
+ *
+ * To run:
+ * $ ./alloc-bench [round count]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <talloc2/tree.h>
+
+#include <wslay/event.h>
+#include <wslay/context.h>
+
+#define BATCH 64
+#define MAX_PAYLOAD_LENGTH 2000
+// size classes from 16 bytes to 64 KiB
+#define CLASS_COUNT 13
+
+struct feed {
+    uint8_t data[BATCH * ( MAX_PAYLOAD_LENGTH + 4 )];
+    size_t length;
+    size_t offset;
+};
+
+struct counting_malloc {
+    size_t call_count;
+};
+
+struct free_list {
+    void * heads[CLASS_COUNT];
+    size_t call_count;
+};
+
+static size_t payload_length ( unsigned int i )
+{
+    return 16 + i * 37 % ( MAX_PAYLOAD_LENGTH - 16 );
+}
+
+// Unmasked frames sent by server to client.
+static void feed_init ( struct feed * feed, const uint8_t * payload )
+{
+    unsigned int i;
+    feed->length = 0;
+    for ( i = 0; i < BATCH; ++i ) {
+        size_t length = payload_length ( i );
+        uint8_t * p = feed->data + feed->length;
+        * p ++ = 0x82;
+        if ( length < 126 ) {
+            * p ++ = length;
+        } else {
+            * p ++ = 126;
+            * p ++ = length >> 8;
+            * p ++ = length & 0xff;
+        }
+        memcpy ( p, payload, length );
+        feed->length = p + length - feed->data;
+    }
+}
+
+static ssize_t feed_recv_callback ( wslay_event_context * ctx, uint8_t * buf, size_t len, int flags, void * user_data )
+{
+    struct feed * feed = user_data;
+    size_t length = feed->length - feed->offset;
+    if ( length > len ) {
+        length = len;
+    }
+    memcpy ( buf, feed->data + feed->offset, length );
+    feed->offset += length;
+    return length;
+}
+
+static ssize_t null_send_callback ( wslay_event_context * ctx, const uint8_t * data, size_t len, int flags, void * user_data, bool user_data_sending )
+{
+    return len;
+}
+
+static void * counting_alloc ( void * user_data, size_t size )
+{
+    ( ( struct counting_malloc * ) user_data )->call_count ++;
+    return malloc ( size );
+}
+
+static void * counting_realloc ( void * user_data, void * ptr, size_t old_size, size_t size )
+{
+    ( ( struct counting_malloc * ) user_data )->call_count ++;
+    return realloc ( ptr, size );
+}
+
+static void counting_free ( void * user_data, void * ptr, size_t size )
+{
+    ( ( struct counting_malloc * ) user_data )->call_count ++;
+    free ( ptr );
+}
+
+static unsigned int size_class ( size_t size )
+{
+    unsigned int class = 0;
+    while ( ( ( size_t ) 16 << class ) < size ) {
+        class ++;
+    }
+    return class;
+}
+
+static void * free_list_alloc ( void * user_data, size_t size )
+{
+    struct free_list * list = user_data;
+    unsigned int class = size_class ( size );
+    if ( class >= CLASS_COUNT ) {
+        list->call_count ++;
+        return malloc ( size );
+    }
+    void * block = list->heads[class];
+    if ( block != NULL ) {
+        list->heads[class] = * ( void ** ) block;
+        return block;
+    }
+    list->call_count ++;
+    return malloc ( ( size_t ) 16 << class );
+}
+
+static void free_list_free ( void * user_data, void * ptr, size_t size )
+{
+    struct free_list * list = user_data;
+    unsigned int class = size_class ( size );
+    if ( class >= CLASS_COUNT ) {
+        list->call_count ++;
+        free ( ptr );
+        return;
+    }
+    * ( void ** ) ptr = list->heads[class];
+    list->heads[class] = ptr;
+}
+
+static void * free_list_realloc ( void * user_data, void * ptr, size_t old_size, size_t size )
+{
+    if ( size_class ( size ) == size_class ( old_size ) && size_class ( size ) < CLASS_COUNT ) {
+        return ptr;
+    }
+    void * data = free_list_alloc ( user_data, size );
+    if ( data == NULL ) {
+        return NULL;
+    }
+    memcpy ( data, ptr, old_size < size ? old_size : size );
+    free_list_free ( user_data, ptr, old_size );
+    return data;
+}
+
+static void run ( const char * name, const wslay_allocator * allocator, const size_t * call_count, bool arena, unsigned int rounds )
+{
+    static struct feed feed;
+    static uint8_t payload[MAX_PAYLOAD_LENGTH];
+    struct wslay_event_callbacks callbacks;
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    memset ( payload, 'x', sizeof ( payload ) );
+    feed_init ( &feed, payload );
+    callbacks.recv_callback = feed_recv_callback;
+    callbacks.send_callback = null_send_callback;
+
+    wslay_event_context * client = wslay_client_new ( NULL, &callbacks, &feed );
+    wslay_event_context * server = wslay_server_new ( NULL, &callbacks, &feed );
+    if ( client == NULL || server == NULL ||
+         wslay_event_config_set_allocator ( client, allocator ) != 0 || wslay_event_config_set_allocator ( server, allocator ) != 0 ||
+         ( arena && ( wslay_event_config_set_arena ( client, 0 ) != 0 || wslay_event_config_set_arena ( server, 0 ) != 0 ) ) ) {
+        fprintf ( stderr, "%s: context setup failed\n", name );
+        exit ( EXIT_FAILURE );
+    }
+    size_t start_call_count = * call_count;
+    struct timespec start, end;
+    unsigned int round, i;
+    clock_gettime ( CLOCK_MONOTONIC, &start );
+    for ( round = 0; round < rounds; ++round ) {
+        feed.offset = 0;
+        if ( wslay_event_recv ( client ) != 0 ) {
+            fprintf ( stderr, "%s: receiving failed\n", name );
+            exit ( EXIT_FAILURE );
+        }
+        for ( i = 0; i < BATCH; ++i ) {
+            wslay_event_msg msg = { WSLAY_BINARY_FRAME, payload, payload_length ( i ) };
+            if ( wslay_event_queue_msg ( server, &msg ) != 0 ) {
+                fprintf ( stderr, "%s: queueing failed\n", name );
+                exit ( EXIT_FAILURE );
+            }
+        }
+        if ( wslay_event_send ( server ) != 0 ) {
+            fprintf ( stderr, "%s: sending failed\n", name );
+            exit ( EXIT_FAILURE );
+        }
+    }
+    clock_gettime ( CLOCK_MONOTONIC, &end );
+    double ns = ( end.tv_sec - start.tv_sec ) * 1e9 + ( end.tv_nsec - start.tv_nsec );
+    double msg_count = ( double ) rounds * BATCH * 2;
+    printf ( "%-12s %8.1f ns/msg %8.3f malloc calls/msg\n", name, ns / msg_count, ( * call_count - start_call_count ) / msg_count );
+
+    talloc_free ( client );
+    talloc_free ( server );
+}
+
+int main ( int argc, char ** argv )
+{
+    unsigned int rounds = argc > 1 ? strtoul ( argv[1], NULL, 10 ) : 10000;
+    struct counting_malloc counter = { 0 };
+    struct free_list list;
+    memset ( &list, 0, sizeof ( list ) );
+    const wslay_allocator counting = { counting_alloc, counting_realloc, counting_free, &counter };
+    const wslay_allocator free_list = { free_list_alloc, free_list_realloc, free_list_free, &list };
+
+    printf ( "%u rounds of %u received and %u sent messages\n", rounds, BATCH, BATCH );
+    run ( "malloc", &counting, &counter.call_count, false, rounds );
+    run ( "free list", &free_list, &list.call_count, false, rounds );
+    run ( "arena", &counting, &counter.call_count, true, rounds );
+
+    unsigned int class;
+    for ( class = 0; class < CLASS_COUNT; ++class ) {
+        while ( list.heads[class] != NULL ) {
+            void * block = list.heads[class];
+            list.heads[class] = * ( void ** ) block;
+            free ( block );
+        }
+    }
+    return EXIT_SUCCESS;
+}
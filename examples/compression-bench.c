@@ -0,0 +1,148 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+/*
+ * Compression benchmark of small JSON messages:
+ * permessage-deflate with and without context takeover, x-wslay-zstd with and without shared dictionary.
+ *
+ * Dependency: zlib, zstd, wslay built with -DWSLAY_ZSTD=true
+ *
+ * To compile:
+ * $ gcc -Wall -O2 -g -DWSLAY_ZSTD -o compression-bench compression-bench.c -I../src -lwslay -ltalloc2 -lzstd -lz
+ *
+ * To run:
+ * $ ./compression-bench [message count]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <zdict.h>
+#include <talloc2/tree.h>
+
+#include <wslay/deflate.h>
+#include <wslay/zstd_ext.h>
+
+#define TRAIN_COUNT 1000
+
+typedef int ( *compress_function ) ( void * data, const uint8_t * msg, size_t length, void * parent, uint8_t ** result, size_t * result_length );
+
+static size_t json_message ( char * buf, size_t length, unsigned int i )
+{
+    static const char * types[] = { "insert", "update", "delete", "ping" };
+    return snprintf ( buf, length,
+                      "{\"seq\":%u,\"type\":\"%s\",\"symbol\":\"SYM%03u\",\"bid\":%u.%02u,\"ask\":%u.%02u,\"size\":%u,\"ts\":%u}",
+                      i, types[i % 4], i * 7 % 200, 100 + i * 13 % 50, i % 100, 101 + i * 13 % 50, i * 7 % 100, ( i * 3 ) % 100, 1700000000u + i );
+}
+
+static int deflate_compress ( void * data, const uint8_t * msg, size_t length, void * parent, uint8_t ** result, size_t * result_length )
+{
+    return wslay_deflate_message ( data, parent, msg, length, result, result_length );
+}
+
+static int zstd_compress ( void * data, const uint8_t * msg, size_t length, void * parent, uint8_t ** result, size_t * result_length )
+{
+    return wslay_zstd_extension.encode ( data, WSLAY_TEXT_FRAME, msg, length, parent, result, result_length );
+}
+
+static void run ( const char * name, compress_function compress, void * data, unsigned int count )
+{
+    char msg[256];
+    size_t input_length = 0, output_length = 0;
+    struct timespec start, end;
+    unsigned int i;
+    clock_gettime ( CLOCK_MONOTONIC, &start );
+    for ( i = 0; i < count; ++i ) {
+        uint8_t * result;
+        size_t result_length;
+        size_t length = json_message ( msg, sizeof ( msg ), TRAIN_COUNT + i );
+        int r = compress ( data, ( const uint8_t * ) msg, length, NULL, &result, &result_length );
+        if ( r < 0 ) {
+            fprintf ( stderr, "%s: compression failed\n", name );
+            exit ( EXIT_FAILURE );
+        }
+        input_length += length;
+        if ( r == 0 ) {
+            output_length += result_length;
+            talloc_free ( result );
+        } else {
+            // sent uncompressed
+            output_length += length;
+        }
+    }
+    clock_gettime ( CLOCK_MONOTONIC, &end );
+    double ns = ( end.tv_sec - start.tv_sec ) * 1e9 + ( end.tv_nsec - start.tv_nsec );
+    printf ( "%-28s %8.1f bytes/msg %6.3f ratio %8.0f ns/msg\n", name,
+             ( double ) output_length / count, ( double ) output_length / input_length, ns / count );
+}
+
+int main ( int argc, char ** argv )
+{
+    unsigned int count = argc > 1 ? strtoul ( argv[1], NULL, 10 ) : 100000;
+    static char samples[TRAIN_COUNT * 256];
+    size_t sizes[TRAIN_COUNT];
+    uint8_t dictionary[4096];
+    size_t offset = 0;
+    unsigned int i;
+    for ( i = 0; i < TRAIN_COUNT; ++i ) {
+        sizes[i] = json_message ( samples + offset, sizeof ( samples ) - offset, i );
+        offset += sizes[i];
+    }
+    size_t dictionary_length = ZDICT_trainFromBuffer ( dictionary, sizeof ( dictionary ), samples, sizes, TRAIN_COUNT );
+    if ( ZDICT_isError ( dictionary_length ) ) {
+        fprintf ( stderr, "dictionary training failed: %s\n", ZDICT_getErrorName ( dictionary_length ) );
+        return EXIT_FAILURE;
+    }
+
+    struct wslay_deflate_params params;
+    wslay_deflate_params_init ( &params );
+    wslay_deflate_context * takeover = wslay_deflate_context_new ( NULL, &params, true, NULL );
+    params.server_no_context_takeover = true;
+    wslay_deflate_context * no_takeover = wslay_deflate_context_new ( NULL, &params, true, NULL );
+    wslay_zstd_shared * plain_shared = wslay_zstd_shared_new ( NULL, NULL, 0, 3 );
+    wslay_zstd_shared * shared = wslay_zstd_shared_new ( NULL, dictionary, dictionary_length, 3 );
+    if ( takeover == NULL || no_takeover == NULL || plain_shared == NULL || shared == NULL ) {
+        fprintf ( stderr, "out of memory\n" );
+        return EXIT_FAILURE;
+    }
+    wslay_zstd_context * plain = wslay_zstd_context_new ( plain_shared, plain_shared, false );
+    wslay_zstd_context * with_dictionary = wslay_zstd_context_new ( shared, shared, true );
+    if ( plain == NULL || with_dictionary == NULL ) {
+        fprintf ( stderr, "out of memory\n" );
+        return EXIT_FAILURE;
+    }
+
+    printf ( "%u messages, %zu bytes dictionary\n", count, dictionary_length );
+    run ( "deflate context takeover", deflate_compress, takeover, count );
+    run ( "deflate no context takeover", deflate_compress, no_takeover, count );
+    run ( "zstd", zstd_compress, plain, count );
+    run ( "zstd dictionary", zstd_compress, with_dictionary, count );
+
+    talloc_free ( takeover );
+    talloc_free ( no_takeover );
+    talloc_free ( plain_shared );
+    talloc_free ( shared );
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,91 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+/*
+ * Context sweep benchmark: checks wslay_event_want_read() and wslay_event_want_write() of a million idle contexts,
+ * like an event loop deciding which connections to poll, and prints the cache lines of the context it touches.
+ *
+ * To compile:
+ * $ gcc -Wall -O2 -g -o context-sweep-bench context-sweep-bench.c -I../src -lwslay -ltalloc2 -lz
+ *
+ * To run:
+ * $ ./context-sweep-bench [context count]
+ */
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <talloc2/tree.h>
+
+#include <wslay/context.h>
+
+#define ROUNDS 20
+#define CACHE_LINE_LENGTH 64
+
+#define cache_line(field) ( offsetof ( wslay_event_context, field ) / CACHE_LINE_LENGTH )
+
+int main ( int argc, char ** argv )
+{
+    size_t count = argc > 1 ? strtoul ( argv[1], NULL, 10 ) : 1000000;
+    wslay_event_context ** contexts = malloc ( count * sizeof ( wslay_event_context * ) );
+    if ( contexts == NULL ) {
+        fprintf ( stderr, "out of memory\n" );
+        return EXIT_FAILURE;
+    }
+    struct wslay_event_callbacks callbacks;
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    wslay_event_context_slab * slab = wslay_event_context_slab_new ( NULL, count, true );
+    if ( slab == NULL ) {
+        fprintf ( stderr, "out of memory\n" );
+        return EXIT_FAILURE;
+    }
+    size_t i;
+    for ( i = 0; i < count; ++i ) {
+        contexts[i] = wslay_event_context_slab_get ( slab, &callbacks, NULL );
+    }
+
+    printf ( "%zu contexts of %zu bytes, %d rounds\n", count, sizeof ( wslay_event_context ), ROUNDS );
+    printf ( "cache lines: read_enabled %zu, write_enabled %zu, send_queue %zu, send_ctrl_queue %zu, omsg %zu\n",
+             cache_line ( read_enabled ), cache_line ( write_enabled ), cache_line ( send_queue ), cache_line ( send_ctrl_queue ),
+             cache_line ( omsg ) );
+
+    struct timespec start, end;
+    size_t ready = 0;
+    unsigned int round;
+    clock_gettime ( CLOCK_MONOTONIC, &start );
+    for ( round = 0; round < ROUNDS; ++round ) {
+        for ( i = 0; i < count; ++i ) {
+            ready += wslay_event_want_read ( contexts[i] ) + wslay_event_want_write ( contexts[i] );
+        }
+    }
+    clock_gettime ( CLOCK_MONOTONIC, &end );
+    double ns = ( end.tv_sec - start.tv_sec ) * 1e9 + ( end.tv_nsec - start.tv_nsec );
+    printf ( "%8.2f ns/context, %zu ready\n", ns / ( ( double ) ROUNDS * count ), ready );
+
+    talloc_free ( slab );
+    free ( contexts );
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,151 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+/*
+ * Hugepage benchmark: a keepalive sweep of a million server contexts of wslay_event_context_slab in random order
+ * queues a ping to each context, then sends them, with wslay_malloc_allocator and with wslay_hugepage_pool
+ * set by wslay_event_context_slab_set_allocator().
+ * The pool holds the queued messages, queue cells and buffers of the contexts.
+ * The contexts themselves are talloc objects allocated by malloc() in both runs,
+ * so the difference shows only the memory which follows the traffic of connections.
+ * dTLB load misses are counted by perf_event_open() when the kernel allows it.
+ *
+ * To compile:
+ * $ gcc -Wall -O2 -g -o hugepage-bench hugepage-bench.c -I../src -lwslay -ltalloc2 -lz
+ *
+ * To run:
+ * $ ./hugepage-bench [connection count]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include <talloc2/tree.h>
+
+#include <wslay/context.h>
+#include <wslay/hugepage.h>
+
+#define ROUNDS 10
+
+static int tlb_counter_open ( void )
+{
+    struct perf_event_attr attr;
+    memset ( &attr, 0, sizeof ( attr ) );
+    attr.size   = sizeof ( attr );
+    attr.type   = PERF_TYPE_HW_CACHE;
+    attr.config = PERF_COUNT_HW_CACHE_DTLB | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 );
+    attr.disabled       = 1;
+    attr.exclude_kernel = 1;
+    return syscall ( SYS_perf_event_open, &attr, 0, -1, -1, 0 );
+}
+
+static ssize_t discard_send_callback ( wslay_event_context * ctx, const uint8_t * data, size_t len, int flags, void * user_data,
+                                      bool user_data_sending )
+{
+    return len;
+}
+
+static void run ( const char * name, const wslay_allocator * allocator, size_t count )
+{
+    wslay_event_context_slab * slab = wslay_event_context_slab_new ( NULL, count, true );
+    wslay_event_context ** contexts = malloc ( count * sizeof ( wslay_event_context * ) );
+    if ( slab == NULL || contexts == NULL || wslay_event_context_slab_set_allocator ( slab, allocator ) != 0 ) {
+        fprintf ( stderr, "out of memory\n" );
+        exit ( EXIT_FAILURE );
+    }
+    struct wslay_event_callbacks callbacks;
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    callbacks.send_callback = discard_send_callback;
+    size_t i;
+    for ( i = 0; i < count; ++i ) {
+        contexts[i] = wslay_event_context_slab_get ( slab, &callbacks, NULL );
+    }
+    // Connections are swept in the order of a hash table rather than the order of allocation.
+    srand ( 1 );
+    for ( i = count - 1; i > 0; --i ) {
+        size_t j = ( ( size_t ) rand() * RAND_MAX + rand() ) % ( i + 1 );
+        wslay_event_context * ctx = contexts[i];
+        contexts[i] = contexts[j];
+        contexts[j] = ctx;
+    }
+
+    int counter = tlb_counter_open();
+    if ( counter >= 0 ) {
+        ioctl ( counter, PERF_EVENT_IOC_RESET, 0 );
+        ioctl ( counter, PERF_EVENT_IOC_ENABLE, 0 );
+    }
+    wslay_event_msg ping = { WSLAY_PING, NULL, 0 };
+    struct timespec start, end;
+    unsigned int round;
+    clock_gettime ( CLOCK_MONOTONIC, &start );
+    for ( round = 0; round < ROUNDS; ++round ) {
+        // Keepalive timer queues pings to all connections, then the event loop writes them.
+        for ( i = 0; i < count; ++i ) {
+            if ( wslay_event_queue_msg ( contexts[i], &ping ) != 0 ) {
+                fprintf ( stderr, "out of memory\n" );
+                exit ( EXIT_FAILURE );
+            }
+        }
+        for ( i = 0; i < count; ++i ) {
+            wslay_event_send ( contexts[i] );
+        }
+    }
+    clock_gettime ( CLOCK_MONOTONIC, &end );
+    double ns = ( end.tv_sec - start.tv_sec ) * 1e9 + ( end.tv_nsec - start.tv_nsec );
+    printf ( "%-10s %8.2f ns/connection", name, ns / ( ( double ) ROUNDS * count ) );
+    long long misses;
+    if ( counter >= 0 && ioctl ( counter, PERF_EVENT_IOC_DISABLE, 0 ) == 0 && read ( counter, &misses, sizeof ( misses ) ) == sizeof ( misses ) ) {
+        printf ( " %8.3f dTLB misses/connection\n", ( double ) misses / ( ( double ) ROUNDS * count ) );
+    } else {
+        printf ( " dTLB misses are not available\n" );
+    }
+    if ( counter >= 0 ) {
+        close ( counter );
+    }
+
+    talloc_free ( slab );
+    free ( contexts );
+}
+
+int main ( int argc, char ** argv )
+{
+    size_t count = argc > 1 ? strtoul ( argv[1], NULL, 10 ) : 1000000;
+    wslay_hugepage_pool * pool = wslay_hugepage_pool_new ( NULL );
+    if ( pool == NULL ) {
+        fprintf ( stderr, "out of memory\n" );
+        return EXIT_FAILURE;
+    }
+    printf ( "%zu connections, %d rounds\n", count, ROUNDS );
+    run ( "malloc", &wslay_malloc_allocator, count );
+    run ( "hugepage", &pool->slabs.allocator, count );
+    printf ( "slabs: %zu hugetlb, %zu transparent, %zu small pages\n", pool->slab_counts[WSLAY_HUGEPAGE_HUGETLB],
+             pool->slab_counts[WSLAY_HUGEPAGE_TRANSPARENT], pool->slab_counts[WSLAY_HUGEPAGE_NONE] );
+    talloc_free ( pool );
+    return EXIT_SUCCESS;
+}
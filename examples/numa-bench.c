@@ -0,0 +1,139 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+/*
+ * NUMA benchmark: a thread running on the first node unmasks and copies frames held in buffers
+ * from the pool of its own node and from the pool of the last node.
+ * On a machine with a single node both runs use local memory.
+ *
+ * Dependency: libnuma, wslay built with -DWSLAY_NUMA=true
+ *
+ * To compile:
+ * $ gcc -Wall -O2 -g -o numa-bench numa-bench.c -I../src -lwslay -ltalloc2 -lnuma -lz
+ *
+ * To run:
+ * $ ./numa-bench [buffer MiB]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <numa.h>
+#include <talloc2/tree.h>
+
+#include <wslay/frame.h>
+#include <wslay/numa_pool.h>
+
+#define FRAME_LENGTH 4096
+#define ROUNDS 8
+
+typedef void ( *frame_function ) ( uint8_t * dst, const uint8_t * src, size_t length );
+
+static void mask_frame ( uint8_t * dst, const uint8_t * src, size_t length )
+{
+    static const uint8_t mask[4] = { 0x37, 0xfa, 0x21, 0x3d };
+    wslay_frame_apply_mask ( dst, src, length, mask, 0 );
+}
+
+static void copy_frame ( uint8_t * dst, const uint8_t * src, size_t length )
+{
+    memcpy ( dst, src, length );
+}
+
+static void run ( const char * name, wslay_numa_pool * pool, frame_function function, uint8_t ** frames, size_t frame_count, uint8_t * local )
+{
+    struct timespec start, end;
+    unsigned int round;
+    size_t i;
+    clock_gettime ( CLOCK_MONOTONIC, &start );
+    for ( round = 0; round < ROUNDS; ++round ) {
+        for ( i = 0; i < frame_count; ++i ) {
+            function ( local, frames[i], FRAME_LENGTH );
+        }
+    }
+    clock_gettime ( CLOCK_MONOTONIC, &end );
+    double s = ( end.tv_sec - start.tv_sec ) + ( end.tv_nsec - start.tv_nsec ) / 1e9;
+    printf ( "%-6s node %d %8.2f GB/s\n", name, pool->node, ( double ) ROUNDS * frame_count * FRAME_LENGTH / s / 1e9 );
+}
+
+static void bench ( wslay_numa_pool * pool, size_t frame_count, uint8_t * local )
+{
+    uint8_t ** frames = malloc ( frame_count * sizeof ( uint8_t * ) );
+    size_t i;
+    if ( frames == NULL ) {
+        fprintf ( stderr, "out of memory\n" );
+        exit ( EXIT_FAILURE );
+    }
+    for ( i = 0; i < frame_count; ++i ) {
+        frames[i] = wslay_alloc ( &pool->slabs.allocator, FRAME_LENGTH );
+        if ( frames[i] == NULL ) {
+            fprintf ( stderr, "out of memory\n" );
+            exit ( EXIT_FAILURE );
+        }
+        memset ( frames[i], i, FRAME_LENGTH );
+    }
+    run ( "mask", pool, mask_frame, frames, frame_count, local );
+    run ( "copy", pool, copy_frame, frames, frame_count, local );
+    for ( i = 0; i < frame_count; ++i ) {
+        wslay_free ( &pool->slabs.allocator, frames[i], FRAME_LENGTH );
+    }
+    free ( frames );
+}
+
+int main ( int argc, char ** argv )
+{
+    size_t megabytes = argc > 1 ? strtoul ( argv[1], NULL, 10 ) : 256;
+    size_t frame_count = megabytes * 1024 * 1024 / FRAME_LENGTH;
+    wslay_numa_pools * pools = wslay_numa_pools_new ( NULL );
+    if ( pools == NULL ) {
+        fprintf ( stderr, "NUMA is not available\n" );
+        return EXIT_FAILURE;
+    }
+    wslay_numa_pool * local_pool  = wslay_numa_pools_get ( pools, 0 );
+    wslay_numa_pool * remote_pool = wslay_numa_pools_get ( pools, pools->node_count - 1 );
+    if ( numa_run_on_node ( local_pool->node ) != 0 ) {
+        fprintf ( stderr, "can not run on node %d\n", local_pool->node );
+        return EXIT_FAILURE;
+    }
+    // destination of each frame, small enough to stay in cache
+    uint8_t * local = wslay_alloc ( &local_pool->slabs.allocator, FRAME_LENGTH );
+    if ( local == NULL ) {
+        fprintf ( stderr, "out of memory\n" );
+        return EXIT_FAILURE;
+    }
+
+    printf ( "%zu MiB of %u byte frames, %u rounds, thread on node %d\n", megabytes, FRAME_LENGTH, ROUNDS, local_pool->node );
+    if ( local_pool == remote_pool ) {
+        printf ( "single NUMA node, remote run uses local memory\n" );
+    }
+    printf ( "local:\n" );
+    bench ( local_pool, frame_count, local );
+    printf ( "remote:\n" );
+    bench ( remote_pool, frame_count, local );
+
+    wslay_free ( &local_pool->slabs.allocator, local, FRAME_LENGTH );
+    talloc_free ( pools );
+    return EXIT_SUCCESS;
+}
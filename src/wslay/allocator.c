@@ -0,0 +1,71 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <stdlib.h>
+
+#include "allocator.h"
+
+static void * wslay_malloc ( void * user_data, size_t size )
+{
+    ( void ) user_data;
+    return malloc ( size );
+}
+
+static void * wslay_malloc_realloc ( void * user_data, void * ptr, size_t old_size, size_t size )
+{
+    ( void ) user_data;
+    ( void ) old_size;
+    return realloc ( ptr, size );
+}
+
+static void wslay_malloc_free ( void * user_data, void * ptr, size_t size )
+{
+    ( void ) user_data;
+    ( void ) size;
+    free ( ptr );
+}
+
+const wslay_allocator wslay_malloc_allocator = { wslay_malloc, wslay_malloc_realloc, wslay_malloc_free, NULL };
+
+static const wslay_allocator * wslay_default_allocator = &wslay_malloc_allocator;
+
+void wslay_set_default_allocator ( const wslay_allocator * allocator )
+{
+    wslay_default_allocator = allocator != NULL ? allocator : &wslay_malloc_allocator;
+}
+
+const wslay_allocator * wslay_get_default_allocator ( void )
+{
+    return wslay_default_allocator;
+}
+
+extern inline
+void * wslay_alloc ( const wslay_allocator * allocator, size_t size );
+
+extern inline
+void * wslay_realloc ( const wslay_allocator * allocator, void * ptr, size_t old_size, size_t size );
+
+extern inline
+void wslay_free ( const wslay_allocator * allocator, void * ptr, size_t size );
@@ -0,0 +1,77 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef WSLAY_ALLOCATOR_H
+#define WSLAY_ALLOCATOR_H
+
+#include <stddef.h>
+
+/*
+ * Allocator of the memory which follows the traffic of a connection:
+ * receive and send buffers, copies of queued messages and queue cells.
+ * Objects which form the ownership tree (contexts, messages, extensions) are still allocated by talloc.
+ *
+ * Each function gets user_data of the allocator, and the size of the block for free and realloc,
+ * so arena or pool allocators do not have to store it.
+ */
+typedef struct wslay_allocator_t {
+    // Returns size bytes of memory, or NULL if out of memory.
+    void * ( * alloc ) ( void * user_data, size_t size );
+    // Resizes ptr of old_size bytes to size bytes. Returns NULL if out of memory, ptr is left untouched then.
+    void * ( * realloc ) ( void * user_data, void * ptr, size_t old_size, size_t size );
+    // Frees ptr of size bytes.
+    void ( * free ) ( void * user_data, void * ptr, size_t size );
+    void * user_data;
+} wslay_allocator;
+
+// Allocator based on malloc(), realloc() and free().
+extern const wslay_allocator wslay_malloc_allocator;
+
+/*
+ * Sets allocator used by contexts and queues created afterwards, NULL restores wslay_malloc_allocator.
+ * It should be set before any context is created, allocator must stay valid while they are used.
+ */
+void wslay_set_default_allocator ( const wslay_allocator * allocator );
+
+const wslay_allocator * wslay_get_default_allocator ( void );
+
+inline
+void * wslay_alloc ( const wslay_allocator * allocator, size_t size )
+{
+    return allocator->alloc ( allocator->user_data, size );
+}
+
+inline
+void * wslay_realloc ( const wslay_allocator * allocator, void * ptr, size_t old_size, size_t size )
+{
+    return allocator->realloc ( allocator->user_data, ptr, old_size, size );
+}
+
+inline
+void wslay_free ( const wslay_allocator * allocator, void * ptr, size_t size )
+{
+    allocator->free ( allocator->user_data, ptr, size );
+}
+
+#endif
@@ -0,0 +1,189 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <stdbool.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define WSLAY_ARENA_ALIGNMENT 16
+#define wslay_arena_align(length) (((length) + WSLAY_ARENA_ALIGNMENT - 1) & ~((size_t) WSLAY_ARENA_ALIGNMENT - 1))
+#define WSLAY_ARENA_HEADER_LENGTH wslay_arena_align ( sizeof ( wslay_arena_block ) )
+
+static inline
+uint8_t * wslay_arena_block_data ( wslay_arena_block * block )
+{
+    return ( uint8_t * ) block + WSLAY_ARENA_HEADER_LENGTH;
+}
+
+static inline
+bool wslay_arena_is_large ( wslay_arena * arena, size_t size )
+{
+    return size > arena->block_length / 4;
+}
+
+static wslay_arena_block * wslay_arena_block_new ( wslay_arena * arena )
+{
+    wslay_arena_block * block = arena->spare;
+    if ( block != NULL ) {
+        arena->spare = block->next;
+        arena->spare_count --;
+    } else {
+        block = wslay_alloc ( arena->parent, WSLAY_ARENA_HEADER_LENGTH + arena->block_length );
+        if ( block == NULL ) {
+            return NULL;
+        }
+        arena->parent_alloc_count ++;
+        block->length = arena->block_length;
+    }
+    block->next       = NULL;
+    block->offset     = 0;
+    block->live_count = 0;
+    return block;
+}
+
+static void wslay_arena_block_release ( wslay_arena * arena, wslay_arena_block * block )
+{
+    if ( arena->spare_count < WSLAY_ARENA_MAX_SPARE_COUNT ) {
+        block->next  = arena->spare;
+        arena->spare = block;
+        arena->spare_count ++;
+    } else {
+        wslay_free ( arena->parent, block, WSLAY_ARENA_HEADER_LENGTH + block->length );
+    }
+}
+
+static void * wslay_arena_alloc ( void * user_data, size_t size )
+{
+    wslay_arena * arena = user_data;
+    if ( wslay_arena_is_large ( arena, size ) ) {
+        arena->parent_alloc_count ++;
+        return wslay_alloc ( arena->parent, size );
+    }
+    size = wslay_arena_align ( size );
+    wslay_arena_block * block = arena->tail;
+    if ( block == NULL || block->offset + size > block->length ) {
+        block = wslay_arena_block_new ( arena );
+        if ( block == NULL ) {
+            return NULL;
+        }
+        if ( arena->tail != NULL ) {
+            arena->tail->next = block;
+        } else {
+            arena->head = block;
+        }
+        arena->tail = block;
+    }
+    uint8_t * data = wslay_arena_block_data ( block ) + block->offset;
+    block->offset += size;
+    block->live_count ++;
+    return data;
+}
+
+static void wslay_arena_dealloc ( void * user_data, void * ptr, size_t size )
+{
+    wslay_arena * arena = user_data;
+    if ( wslay_arena_is_large ( arena, size ) ) {
+        wslay_free ( arena->parent, ptr, size );
+        return;
+    }
+    // Messages are freed mostly in FIFO order, so the block is usually the head one.
+    wslay_arena_block * prev  = NULL;
+    wslay_arena_block * block = arena->head;
+    while ( ( uint8_t * ) ptr < wslay_arena_block_data ( block ) || ( uint8_t * ) ptr >= wslay_arena_block_data ( block ) + block->length ) {
+        prev  = block;
+        block = block->next;
+    }
+    if ( -- block->live_count != 0 ) {
+        return;
+    }
+    if ( block == arena->tail ) {
+        block->offset = 0;
+        return;
+    }
+    if ( prev == NULL ) {
+        arena->head = block->next;
+    } else {
+        prev->next = block->next;
+    }
+    wslay_arena_block_release ( arena, block );
+}
+
+static void * wslay_arena_realloc ( void * user_data, void * ptr, size_t old_size, size_t size )
+{
+    wslay_arena * arena = user_data;
+    if ( wslay_arena_is_large ( arena, old_size ) && wslay_arena_is_large ( arena, size ) ) {
+        return wslay_realloc ( arena->parent, ptr, old_size, size );
+    }
+    // The last allocation of the newest block is resized in place.
+    wslay_arena_block * block = arena->tail;
+    if ( !wslay_arena_is_large ( arena, old_size ) && !wslay_arena_is_large ( arena, size ) &&
+         ( uint8_t * ) ptr + wslay_arena_align ( old_size ) == wslay_arena_block_data ( block ) + block->offset &&
+         block->offset - wslay_arena_align ( old_size ) + wslay_arena_align ( size ) <= block->length ) {
+        block->offset = block->offset - wslay_arena_align ( old_size ) + wslay_arena_align ( size );
+        return ptr;
+    }
+    void * data = wslay_arena_alloc ( arena, size );
+    if ( data == NULL ) {
+        return NULL;
+    }
+    memcpy ( data, ptr, old_size < size ? old_size : size );
+    wslay_arena_dealloc ( arena, ptr, old_size );
+    return data;
+}
+
+wslay_arena * wslay_arena_new ( const wslay_allocator * parent, size_t block_length )
+{
+    wslay_arena * arena = wslay_alloc ( parent, sizeof ( wslay_arena ) );
+    if ( arena == NULL ) {
+        return NULL;
+    }
+    arena->allocator.alloc     = wslay_arena_alloc;
+    arena->allocator.realloc   = wslay_arena_realloc;
+    arena->allocator.free      = wslay_arena_dealloc;
+    arena->allocator.user_data = arena;
+    arena->parent       = parent;
+    arena->block_length = block_length != 0 ? wslay_arena_align ( block_length ) : WSLAY_ARENA_BLOCK_LENGTH;
+    arena->head  = arena->tail = NULL;
+    arena->spare = NULL;
+    arena->spare_count = 0;
+    arena->parent_alloc_count = 0;
+    return arena;
+}
+
+static void wslay_arena_free_chain ( wslay_arena * arena, wslay_arena_block * block )
+{
+    while ( block != NULL ) {
+        wslay_arena_block * next = block->next;
+        wslay_free ( arena->parent, block, WSLAY_ARENA_HEADER_LENGTH + block->length );
+        block = next;
+    }
+}
+
+void wslay_arena_free ( wslay_arena * arena )
+{
+    wslay_arena_free_chain ( arena, arena->head );
+    wslay_arena_free_chain ( arena, arena->spare );
+    wslay_free ( arena->parent, arena, sizeof ( wslay_arena ) );
+}
@@ -0,0 +1,77 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef WSLAY_ARENA_H
+#define WSLAY_ARENA_H
+
+#include <stdint.h>
+
+#include "allocator.h"
+
+#define WSLAY_ARENA_BLOCK_LENGTH 65536
+// the maximum number of released blocks kept for reuse
+#define WSLAY_ARENA_MAX_SPARE_COUNT 4
+
+typedef struct wslay_arena_block_t {
+    // the next newer block, or the next spare one
+    struct wslay_arena_block_t * next;
+    // the number of bytes available for allocations
+    size_t length;
+    // the number of bytes allocated from the start
+    size_t offset;
+    // the number of allocations not freed yet
+    size_t live_count;
+} wslay_arena_block;
+
+/*
+ * Bump allocator for memory released mostly in the order it was allocated, like messages of a connection.
+ * Allocations are carved from the newest block of a chain, a block is released when all its allocations are freed.
+ * Up to WSLAY_ARENA_MAX_SPARE_COUNT released blocks are kept as spare, so steady traffic does not allocate blocks
+ * from the parent allocator.
+ * Allocations larger than a quarter of the block are passed to the parent allocator.
+ */
+typedef struct wslay_arena_t {
+    // vtable of the arena, its user_data is the arena
+    wslay_allocator allocator;
+    // allocator of blocks and large allocations
+    const wslay_allocator * parent;
+    size_t block_length;
+    // the oldest block
+    wslay_arena_block * head;
+    // the newest block, allocations are carved from it
+    wslay_arena_block * tail;
+    // released blocks kept for reuse
+    wslay_arena_block * spare;
+    size_t spare_count;
+    // the number of blocks and large allocations requested from the parent allocator
+    size_t parent_alloc_count;
+} wslay_arena;
+
+// Creates arena with blocks of block_length bytes, 0 for WSLAY_ARENA_BLOCK_LENGTH. Returns NULL if out of memory.
+wslay_arena * wslay_arena_new ( const wslay_allocator * parent, size_t block_length );
+
+// Frees arena with its blocks, allocations which are not freed yet become invalid.
+void wslay_arena_free ( wslay_arena * arena );
+
+#endif
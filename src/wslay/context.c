@@ -24,11 +24,15 @@
  */
 
 #include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "context.h"
 #include "frame.h"
 
 #include <talloc2/tree.h>
+#include <talloc2/ext/destructor.h>
 
 extern inline
 ssize_t wslay_event_frame_recv_callback ( uint8_t * buf, size_t len, int flags, void * _user_data );
@@ -39,59 +43,229 @@ ssize_t wslay_event_frame_send_callback ( const uint8_t * data, size_t len, int
 extern inline
 int wslay_event_frame_genmask_callback ( uint8_t * buf, size_t len, void * _user_data );
 
-wslay_event_context * wslay_event_context_new ( void * ctx, const struct wslay_event_callbacks * callbacks, void * user_data )
+// Fields checked by wslay_event_want_read() and wslay_event_want_write() of each context should share one cache line.
+_Static_assert ( offsetof ( wslay_event_context, send_ctrl_queue ) + sizeof ( wslay_queue ) <= 64,
+                 "hot header of wslay_event_context exceeds 64 bytes" );
+
+static void wslay_event_queue_clear ( wslay_event_context * ctx, wslay_queue * queue )
 {
-    wslay_event_context * context = talloc_zero ( ctx, sizeof ( wslay_event_context ) );
-    if ( context == NULL ) {
-        return NULL;
+    while ( !wslay_queue_is_empty ( queue ) ) {
+        wslay_event_omsg_free ( ctx, wslay_queue_top ( queue ) );
+        wslay_queue_pop ( queue );
     }
-    struct wslay_frame_callbacks frame_callbacks = { wslay_event_frame_send_callback, wslay_event_frame_recv_callback, wslay_event_frame_genmask_callback };
+}
+
+static uint8_t wslay_event_context_free ( void * data )
+{
+    wslay_event_context * ctx = data;
+    wslay_event_queue_clear ( ctx, &ctx->send_queue );
+    wslay_event_queue_clear ( ctx, &ctx->send_ctrl_queue );
+    if ( ctx->omsg != NULL ) {
+        wslay_event_omsg_free ( ctx, ctx->omsg );
+    }
+    if ( ctx->peek_buf != NULL ) {
+        wslay_free ( ctx->allocator, ctx->peek_buf, ctx->peek_length );
+    }
+    if ( ctx->obuf != NULL ) {
+        wslay_free ( ctx->allocator, ctx->obuf, ctx->obuf_length );
+    }
+    if ( ctx->arena == NULL ) {
+        // Chunks and frame context are children of ctx, only the cells of embedded queues are freed here.
+        wslay_queue_free ( &ctx->imsgs[0].chunks );
+        wslay_queue_free ( &ctx->imsgs[1].chunks );
+        return 0;
+    }
+    // Everything allocated from the arena is freed before it.
+    uint8_t i;
+    for ( i = 0; i < 2; i ++ ) {
+        struct wslay_event_imsg * imsg = &ctx->imsgs[i];
+        while ( !wslay_queue_is_empty ( &imsg->chunks ) ) {
+            talloc_free ( wslay_queue_top ( &imsg->chunks ) );
+            wslay_queue_pop ( &imsg->chunks );
+        }
+        if ( imsg->spare != NULL ) {
+            talloc_free ( imsg->spare );
+        }
+    }
+    talloc_free ( ctx->frame_ctx );
+    wslay_arena_free ( ctx->arena );
+    return 0;
+}
+
+// Initializes zeroed context, frame_ctx and allocator are set by the caller.
+static void wslay_event_context_init ( wslay_event_context * context, const struct wslay_event_callbacks * callbacks, void * user_data )
+{
     context->callbacks = * callbacks;
     context->user_data = user_data;
 
     context->frame_user_data.ctx       = context;
     context->frame_user_data.user_data = user_data;
 
-    wslay_frame_context * frame_ctx = wslay_frame_context_new ( context, &frame_callbacks, &context->frame_user_data );
-    if ( frame_ctx == NULL ) {
-        talloc_free ( context );
-        return NULL;
-    }
-    context->frame_ctx = frame_ctx;
-    
     context->read_enabled = context->write_enabled = 1;
-    context->send_queue   = wslay_queue_new ( context );
-    if ( context->send_queue == NULL ) {
-        talloc_free ( context );
-        return NULL;
-    }
-    context->send_ctrl_queue = wslay_queue_new ( context );
-    if ( context->send_ctrl_queue == NULL ) {
-        talloc_free ( context );
-        return NULL;
-    }
+    // Queues are embedded, their cells and obuf are allocated on first use.
+    wslay_queue_init ( &context->send_queue, context->allocator );
+    wslay_queue_init ( &context->send_ctrl_queue, context->allocator );
     context->queued_msg_count  = 0;
     context->queued_msg_length = 0;
 
     uint8_t i;
     for ( i = 0; i < 2; ++i ) {
+        wslay_queue_init ( &context->imsgs[i].chunks, context->allocator );
         wslay_event_imsg_reset ( & context->imsgs[i] );
-        context->imsgs[i].chunks = wslay_queue_new ( context );
-        if ( context->imsgs[i].chunks == NULL ) {
-            talloc_free ( context );
-            return NULL;
-        }
     }
 
+    context->obuf_length = WSLAY_EVENT_OBUF_LENGTH;
+
     context->imsg     = & context->imsgs[0];
-    context->obufmark = context->obuflimit = context->obuf;
     context->status_code_sent = WSLAY_CODE_ABNORMAL_CLOSURE;
     context->status_code_recv = WSLAY_CODE_ABNORMAL_CLOSURE;
     context->max_recv_msg_length = UINT64_MAX;
+    context->recv_prealloc_length = WSLAY_EVENT_RECV_PREALLOC_LENGTH;
+    context->recv_buffer_high_water = WSLAY_EVENT_RECV_HIGH_WATER;
+    context->text_validation_interval = 1;
+}
+
+wslay_event_context * wslay_event_context_new ( void * ctx, const struct wslay_event_callbacks * callbacks, void * user_data )
+{
+    wslay_event_context * context = talloc_zero ( ctx, sizeof ( wslay_event_context ) );
+    if ( context == NULL ) {
+        return NULL;
+    }
+    if ( talloc_set_destructor ( context, wslay_event_context_free ) != 0 ) {
+        talloc_free ( context );
+        return NULL;
+    }
+    context->allocator = wslay_get_default_allocator();
+    wslay_event_context_init ( context, callbacks, user_data );
+
+    struct wslay_frame_callbacks frame_callbacks = { wslay_event_frame_send_callback, wslay_event_frame_recv_callback, wslay_event_frame_genmask_callback };
+    wslay_frame_context * frame_ctx = wslay_frame_context_new ( context, &frame_callbacks, &context->frame_user_data );
+    if ( frame_ctx == NULL ) {
+        talloc_free ( context );
+        return NULL;
+    }
+    // Payload is unmasked by the event layer while it is validated and copied.
+    frame_ctx->ikeepmask = true;
+    context->frame_ctx   = frame_ctx;
 
     return context;
 }
 
+void wslay_event_context_reset ( wslay_event_context * ctx, const struct wslay_event_callbacks * callbacks, void * user_data )
+{
+    wslay_event_queue_clear ( ctx, &ctx->send_queue );
+    wslay_event_queue_clear ( ctx, &ctx->send_ctrl_queue );
+    if ( ctx->omsg != NULL ) {
+        wslay_event_omsg_free ( ctx, ctx->omsg );
+    }
+    uint8_t i;
+    for ( i = 0; i < ctx->extension_count; i ++ ) {
+        if ( ctx->extensions[i].data != NULL ) {
+            talloc_free ( ctx->extensions[i].data );
+        }
+    }
+    if ( ctx->peek_buf != NULL ) {
+        wslay_free ( ctx->allocator, ctx->peek_buf, ctx->peek_length );
+    }
+    if ( ctx->obuf != NULL ) {
+        wslay_free ( ctx->allocator, ctx->obuf, ctx->obuf_length );
+    }
+    // Spare receive buffers stay warm for the next connection.
+    struct wslay_event_byte_chunk * spares[2];
+    for ( i = 0; i < 2; i ++ ) {
+        wslay_event_imsg_reset ( &ctx->imsgs[i] );
+        spares[i] = ctx->imsgs[i].spare;
+    }
+    wslay_frame_context * frame_ctx = ctx->frame_ctx;
+    bool server = ctx->server;
+    const wslay_allocator * allocator = ctx->allocator;
+    wslay_arena * arena = ctx->arena;
+
+    memset ( ctx, 0, sizeof ( wslay_event_context ) );
+    ctx->allocator = allocator;
+    ctx->arena     = arena;
+    wslay_event_context_init ( ctx, callbacks, user_data );
+    for ( i = 0; i < 2; i ++ ) {
+        ctx->imsgs[i].spare = spares[i];
+    }
+    ctx->server    = server;
+    ctx->frame_ctx = frame_ctx;
+    wslay_frame_context_reset ( frame_ctx );
+}
+
+static uint8_t wslay_event_context_slab_free ( void * data )
+{
+    wslay_event_context_slab * slab = data;
+    // Contexts handed out are children of the slab too, they are freed with it.
+    free ( slab->contexts );
+    return 0;
+}
+
+wslay_event_context_slab * wslay_event_context_slab_new ( void * ctx, size_t count, bool server )
+{
+    wslay_event_context_slab * slab = talloc_zero ( ctx, sizeof ( wslay_event_context_slab ) );
+    if ( slab == NULL ) {
+        return NULL;
+    }
+    if ( talloc_set_destructor ( slab, wslay_event_context_slab_free ) != 0 ) {
+        talloc_free ( slab );
+        return NULL;
+    }
+    slab->contexts = malloc ( count * sizeof ( wslay_event_context * ) );
+    if ( slab->contexts == NULL && count != 0 ) {
+        talloc_free ( slab );
+        return NULL;
+    }
+    slab->capacity = count;
+    struct wslay_event_callbacks callbacks;
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    for ( ; slab->length < count; slab->length ++ ) {
+        wslay_event_context * context = wslay_event_context_new ( slab, &callbacks, NULL );
+        if ( context == NULL ) {
+            talloc_free ( slab );
+            return NULL;
+        }
+        context->server = server;
+        slab->contexts[slab->length] = context;
+    }
+    return slab;
+}
+
+wslay_event_context * wslay_event_context_slab_get ( wslay_event_context_slab * slab, const struct wslay_event_callbacks * callbacks, void * user_data )
+{
+    if ( slab->length == 0 ) {
+        return NULL;
+    }
+    wslay_event_context * context = slab->contexts[-- slab->length];
+    wslay_event_context_reset ( context, callbacks, user_data );
+    return context;
+}
+
+int wslay_event_context_slab_put ( wslay_event_context_slab * slab, wslay_event_context * ctx )
+{
+    if ( slab->length == slab->capacity ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    // Queued messages and extension state of the closed connection are released now, not on the next get.
+    struct wslay_event_callbacks callbacks;
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    wslay_event_context_reset ( ctx, &callbacks, NULL );
+    slab->contexts[slab->length ++] = ctx;
+    return 0;
+}
+
+int wslay_event_context_slab_set_allocator ( wslay_event_context_slab * slab, const wslay_allocator * allocator )
+{
+    size_t i;
+    for ( i = 0; i < slab->length; i ++ ) {
+        int r = wslay_event_config_set_allocator ( slab->contexts[i], allocator );
+        if ( r != 0 ) {
+            return r;
+        }
+    }
+    return 0;
+}
+
 extern inline
 wslay_event_context * wslay_server_new ( void * ctx, const struct wslay_event_callbacks * callbacks, void * user_data );
 
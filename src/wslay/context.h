@@ -29,6 +29,45 @@
 
 wslay_event_context * wslay_event_context_new ( void * ctx, const struct wslay_event_callbacks * callbacks, void * user_data );
 
+/*
+ * Returns ctx to the state after wslay_event_context_new() with given callbacks and user_data,
+ * so it can be reused for a new connection. Queued messages, received data, extensions and
+ * configuration are dropped, while the context, its frame context and spare receive buffers are kept.
+ * Whether ctx is server or client is kept as well.
+ */
+void wslay_event_context_reset ( wslay_event_context * ctx, const struct wslay_event_callbacks * callbacks, void * user_data );
+
+/*
+ * Free-list of warm contexts created in bulk, so high connection churn does not construct and free them.
+ * The contexts are children of the slab and are freed together with it.
+ */
+typedef struct wslay_event_context_slab_t {
+    // free contexts, the last length ones are handed out first
+    wslay_event_context ** contexts;
+    size_t length;
+    size_t capacity;
+} wslay_event_context_slab;
+
+// Creates slab with count server or client contexts. Returns NULL if out of memory.
+wslay_event_context_slab * wslay_event_context_slab_new ( void * ctx, size_t count, bool server );
+
+// Takes free context from slab and resets it with callbacks and user_data. Returns NULL if slab is empty.
+wslay_event_context * wslay_event_context_slab_get ( wslay_event_context_slab * slab, const struct wslay_event_callbacks * callbacks, void * user_data );
+
+/*
+ * Resets ctx taken from slab and returns it to the free-list.
+ * Returns 0 if it succeeds, or WSLAY_ERR_INVALID_ARGUMENT if the free-list is full.
+ */
+int wslay_event_context_slab_put ( wslay_event_context_slab * slab, wslay_event_context * ctx );
+
+/*
+ * Makes free contexts of slab allocate their buffers, queued messages and queue cells by allocator,
+ * like wslay_hugepage_pool, so the connection state of the whole slab is packed together. It is kept by get and put.
+ * Returns 0 if it succeeds, or WSLAY_ERR_INVALID_ARGUMENT if a context already holds memory of its allocator,
+ * so it should be called right after slab is created.
+ */
+int wslay_event_context_slab_set_allocator ( wslay_event_context_slab * slab, const wslay_allocator * allocator );
+
 inline
 wslay_event_context * wslay_server_new ( void * ctx, const struct wslay_event_callbacks * callbacks, void * user_data ) {
     wslay_event_context * context = wslay_event_context_new ( ctx, callbacks, user_data );
@@ -0,0 +1,684 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+
+#include "deflate.h"
+
+#include <talloc2/tree.h>
+#include <talloc2/ext/destructor.h>
+
+#define wslay_min(A, B) (((A) < (B)) ? (A) : (B))
+
+// Trailer removed from each compressed message (RFC 7692 7.2.1).
+static const uint8_t wslay_deflate_trailer[] = { 0x00, 0x00, 0xff, 0xff };
+
+void wslay_deflate_params_init ( struct wslay_deflate_params * params )
+{
+    params->server_no_context_takeover = false;
+    params->client_no_context_takeover = false;
+    params->server_max_window_bits     = 15;
+    params->client_max_window_bits     = 15;
+}
+
+static inline
+void wslay_deflate_trim ( const char ** begin, const char ** end )
+{
+    while ( *begin < *end && ( **begin == ' ' || **begin == '\t' ) ) {
+        ( *begin ) ++;
+    }
+    while ( *begin < *end && ( * ( *end - 1 ) == ' ' || * ( *end - 1 ) == '\t' ) ) {
+        ( *end ) --;
+    }
+}
+
+static inline
+bool wslay_deflate_equals ( const char * begin, const char * end, const char * str )
+{
+    size_t length = strlen ( str );
+    return ( size_t ) ( end - begin ) == length && memcmp ( begin, str, length ) == 0;
+}
+
+static int wslay_deflate_parse_window_bits ( const char * begin, const char * end, uint8_t * bits )
+{
+    if ( end - begin >= 2 && *begin == '"' && * ( end - 1 ) == '"' ) {
+        begin ++;
+        end --;
+    }
+    if ( begin == end || end - begin > 2 ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    uint8_t value = 0;
+    for ( ; begin < end; begin ++ ) {
+        if ( *begin < '0' || *begin > '9' ) {
+            return WSLAY_ERR_INVALID_ARGUMENT;
+        }
+        value = value * 10 + ( *begin - '0' );
+    }
+    if ( value < 8 || value > 15 ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    *bits = value;
+    return 0;
+}
+
+enum wslay_deflate_param_flags {
+    WSLAY_DEFLATE_SERVER_NO_CONTEXT_TAKEOVER = 1,
+    WSLAY_DEFLATE_CLIENT_NO_CONTEXT_TAKEOVER = 1 << 1,
+    WSLAY_DEFLATE_SERVER_MAX_WINDOW_BITS     = 1 << 2,
+    WSLAY_DEFLATE_CLIENT_MAX_WINDOW_BITS     = 1 << 3
+};
+
+static int wslay_deflate_parse_element ( const char * begin, const char * end, struct wslay_deflate_params * params )
+{
+    const char * param_end = memchr ( begin, ';', end - begin );
+    if ( param_end == NULL ) {
+        param_end = end;
+    }
+    const char * token_begin = begin;
+    const char * token_end   = param_end;
+    wslay_deflate_trim ( &token_begin, &token_end );
+    if ( !wslay_deflate_equals ( token_begin, token_end, WSLAY_DEFLATE_TOKEN ) ) {
+        return 1;
+    }
+
+    wslay_deflate_params_init ( params );
+    uint8_t seen = 0;
+    while ( param_end != end ) {
+        begin     = param_end + 1;
+        param_end = memchr ( begin, ';', end - begin );
+        if ( param_end == NULL ) {
+            param_end = end;
+        }
+        const char * name_begin  = begin;
+        const char * name_end    = memchr ( begin, '=', param_end - begin );
+        const char * value_begin = NULL;
+        const char * value_end   = param_end;
+        if ( name_end == NULL ) {
+            name_end = param_end;
+        } else {
+            value_begin = name_end + 1;
+            wslay_deflate_trim ( &value_begin, &value_end );
+        }
+        wslay_deflate_trim ( &name_begin, &name_end );
+
+        uint8_t flag;
+        if ( wslay_deflate_equals ( name_begin, name_end, "server_no_context_takeover" ) ) {
+            flag = WSLAY_DEFLATE_SERVER_NO_CONTEXT_TAKEOVER;
+            params->server_no_context_takeover = true;
+        } else if ( wslay_deflate_equals ( name_begin, name_end, "client_no_context_takeover" ) ) {
+            flag = WSLAY_DEFLATE_CLIENT_NO_CONTEXT_TAKEOVER;
+            params->client_no_context_takeover = true;
+        } else if ( wslay_deflate_equals ( name_begin, name_end, "server_max_window_bits" ) ) {
+            flag = WSLAY_DEFLATE_SERVER_MAX_WINDOW_BITS;
+            if ( value_begin == NULL || wslay_deflate_parse_window_bits ( value_begin, value_end, &params->server_max_window_bits ) != 0 ) {
+                return WSLAY_ERR_INVALID_ARGUMENT;
+            }
+        } else if ( wslay_deflate_equals ( name_begin, name_end, "client_max_window_bits" ) ) {
+            flag = WSLAY_DEFLATE_CLIENT_MAX_WINDOW_BITS;
+            // The value is optional in client offer.
+            if ( value_begin != NULL && wslay_deflate_parse_window_bits ( value_begin, value_end, &params->client_max_window_bits ) != 0 ) {
+                return WSLAY_ERR_INVALID_ARGUMENT;
+            }
+        } else {
+            return WSLAY_ERR_INVALID_ARGUMENT;
+        }
+        if ( ( flag & ( WSLAY_DEFLATE_SERVER_NO_CONTEXT_TAKEOVER | WSLAY_DEFLATE_CLIENT_NO_CONTEXT_TAKEOVER ) ) && value_begin != NULL ) {
+            return WSLAY_ERR_INVALID_ARGUMENT;
+        }
+        if ( seen & flag ) {
+            return WSLAY_ERR_INVALID_ARGUMENT;
+        }
+        seen |= flag;
+    }
+    return 0;
+}
+
+int wslay_deflate_parse_params ( const char * value, size_t length, struct wslay_deflate_params * params )
+{
+    const char * end = value + length;
+    while ( value < end ) {
+        const char * element_end = memchr ( value, ',', end - value );
+        if ( element_end == NULL ) {
+            element_end = end;
+        }
+        int r = wslay_deflate_parse_element ( value, element_end, params );
+        if ( r != 1 ) {
+            return r;
+        }
+        value = element_end + 1;
+    }
+    return 1;
+}
+
+ssize_t wslay_deflate_format_params ( const struct wslay_deflate_params * params, char * buf, size_t length )
+{
+    int r = snprintf (
+        buf, length, "%s%s%s",
+        WSLAY_DEFLATE_TOKEN,
+        params->server_no_context_takeover ? "; server_no_context_takeover" : "",
+        params->client_no_context_takeover ? "; client_no_context_takeover" : ""
+    );
+    if ( r < 0 || ( size_t ) r >= length ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    size_t offset = r;
+    if ( params->server_max_window_bits != 15 ) {
+        r = snprintf ( buf + offset, length - offset, "; server_max_window_bits=%u", ( unsigned int ) params->server_max_window_bits );
+        if ( r < 0 || ( size_t ) r >= length - offset ) {
+            return WSLAY_ERR_INVALID_ARGUMENT;
+        }
+        offset += r;
+    }
+    if ( params->client_max_window_bits != 15 ) {
+        r = snprintf ( buf + offset, length - offset, "; client_max_window_bits=%u", ( unsigned int ) params->client_max_window_bits );
+        if ( r < 0 || ( size_t ) r >= length - offset ) {
+            return WSLAY_ERR_INVALID_ARGUMENT;
+        }
+        offset += r;
+    }
+    return offset;
+}
+
+static uint8_t wslay_deflate_stream_free ( void * data )
+{
+    wslay_deflate_stream * stream = data;
+    if ( stream->deflate ) {
+        deflateEnd ( &stream->stream );
+    } else {
+        inflateEnd ( &stream->stream );
+    }
+    if ( stream->pool != NULL ) {
+        stream->pool->memory_used -= stream->memory;
+    }
+    return 0;
+}
+
+// Estimations from zconf.h for default memLevel 8, inflate state itself takes about 7 KB.
+static inline
+size_t wslay_deflate_stream_memory ( bool deflate, uint8_t window_bits )
+{
+    if ( deflate ) {
+        return ( ( size_t ) 1 << ( window_bits + 2 ) ) + ( ( size_t ) 1 << ( 8 + 9 ) );
+    } else {
+        return ( ( size_t ) 1 << window_bits ) + 7 * 1024;
+    }
+}
+
+static wslay_deflate_stream * wslay_deflate_stream_new ( void * parent, wslay_deflate_pool * pool, bool deflate, uint8_t window_bits )
+{
+    wslay_deflate_stream * stream = talloc_zero ( parent, sizeof ( wslay_deflate_stream ) );
+    if ( stream == NULL ) {
+        return NULL;
+    }
+    // Negative window bits mean raw deflate without zlib header.
+    int r;
+    if ( deflate ) {
+        r = deflateInit2 ( &stream->stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -window_bits, 8, Z_DEFAULT_STRATEGY );
+    } else {
+        r = inflateInit2 ( &stream->stream, -window_bits );
+    }
+    if ( r != Z_OK ) {
+        talloc_free ( stream );
+        return NULL;
+    }
+    stream->deflate     = deflate;
+    stream->window_bits = window_bits;
+    if ( talloc_set_destructor ( stream, wslay_deflate_stream_free ) != 0 ) {
+        wslay_deflate_stream_free ( stream );
+        talloc_free ( stream );
+        return NULL;
+    }
+    if ( pool != NULL ) {
+        stream->pool   = pool;
+        stream->memory = wslay_deflate_stream_memory ( deflate, window_bits );
+        pool->memory_used += stream->memory;
+    }
+    return stream;
+}
+
+static inline
+wslay_deflate_stream ** wslay_deflate_pool_list ( wslay_deflate_pool * pool, bool deflate, uint8_t window_bits )
+{
+    if ( deflate ) {
+        return &pool->idle_deflate[window_bits - 8];
+    } else {
+        return &pool->idle_inflate[window_bits - 8];
+    }
+}
+
+// Frees one idle stream, deflate streams are preferred as they are larger.
+static bool wslay_deflate_pool_free_idle ( wslay_deflate_pool * pool )
+{
+    uint8_t i;
+    wslay_deflate_stream ** list = NULL;
+    for ( i = 0; i < WSLAY_DEFLATE_POOL_LISTS && list == NULL; ++i ) {
+        if ( pool->idle_deflate[i] != NULL ) {
+            list = &pool->idle_deflate[i];
+        }
+    }
+    for ( i = 0; i < WSLAY_DEFLATE_POOL_LISTS && list == NULL; ++i ) {
+        if ( pool->idle_inflate[i] != NULL ) {
+            list = &pool->idle_inflate[i];
+        }
+    }
+    if ( list == NULL ) {
+        return false;
+    }
+    wslay_deflate_stream * stream = *list;
+    *list = stream->next;
+    talloc_free ( stream );
+    return true;
+}
+
+static uint8_t wslay_deflate_pool_free ( void * data )
+{
+    wslay_deflate_pool * pool = data;
+    while ( wslay_deflate_pool_free_idle ( pool ) );
+    return 0;
+}
+
+wslay_deflate_pool * wslay_deflate_pool_new ( void * ctx, size_t memory_limit )
+{
+    wslay_deflate_pool * pool = talloc_zero ( ctx, sizeof ( wslay_deflate_pool ) );
+    if ( pool == NULL ) {
+        return NULL;
+    }
+    if ( talloc_set_destructor ( pool, wslay_deflate_pool_free ) != 0 ) {
+        talloc_free ( pool );
+        return NULL;
+    }
+    pool->memory_limit = memory_limit;
+    return pool;
+}
+
+size_t wslay_deflate_pool_get_memory_used ( const wslay_deflate_pool * pool )
+{
+    return pool->memory_used;
+}
+
+uint64_t wslay_deflate_pool_get_hit_count ( const wslay_deflate_pool * pool )
+{
+    return pool->hit_count;
+}
+
+uint64_t wslay_deflate_pool_get_miss_count ( const wslay_deflate_pool * pool )
+{
+    return pool->miss_count;
+}
+
+uint64_t wslay_deflate_pool_get_fallback_count ( const wslay_deflate_pool * pool )
+{
+    return pool->fallback_count;
+}
+
+// Stores the stream borrowed from the pool or allocated to *result.
+// Returns 0 if it succeeds, 1 if compression stream does not fit into the memory limit or WSLAY_ERR_NOMEM.
+static int wslay_deflate_acquire ( wslay_deflate_context * ctx, bool deflate, wslay_deflate_stream ** result )
+{
+    wslay_deflate_pool * pool = ctx->pool;
+    uint8_t window_bits = deflate ? ctx->deflate_window_bits : ctx->inflate_window_bits;
+    if ( pool == NULL ) {
+        * result = wslay_deflate_stream_new ( ctx, NULL, deflate, window_bits );
+        return * result == NULL ? WSLAY_ERR_NOMEM : 0;
+    }
+
+    wslay_deflate_stream ** list = wslay_deflate_pool_list ( pool, deflate, window_bits );
+    if ( *list != NULL ) {
+        * result = *list;
+        *list = ( * result )->next;
+        ( * result )->next = NULL;
+        pool->hit_count ++;
+        return 0;
+    }
+    pool->miss_count ++;
+    if ( pool->memory_limit != 0 ) {
+        size_t memory = wslay_deflate_stream_memory ( deflate, window_bits );
+        while ( pool->memory_used + memory > pool->memory_limit && wslay_deflate_pool_free_idle ( pool ) );
+        if ( deflate && pool->memory_used + memory > pool->memory_limit ) {
+            pool->fallback_count ++;
+            return 1;
+        }
+    }
+    * result = wslay_deflate_stream_new ( pool, pool, deflate, window_bits );
+    return * result == NULL ? WSLAY_ERR_NOMEM : 0;
+}
+
+// Resets the stream after the message, the stream is returned to the pool if there is one.
+static void wslay_deflate_release ( wslay_deflate_context * ctx, wslay_deflate_stream ** stream )
+{
+    wslay_deflate_stream * s = *stream;
+    if ( s->deflate ) {
+        deflateReset ( &s->stream );
+    } else {
+        inflateReset ( &s->stream );
+    }
+    if ( ctx->pool == NULL ) {
+        return;
+    }
+    wslay_deflate_stream ** list = wslay_deflate_pool_list ( ctx->pool, s->deflate, s->window_bits );
+    s->next = *list;
+    *list   = s;
+    *stream = NULL;
+}
+
+static uint8_t wslay_deflate_context_free ( void * data )
+{
+    wslay_deflate_context * ctx = data;
+    // Borrowed streams go back to the pool, owned streams are freed.
+    if ( ctx->deflate_stream != NULL && ctx->deflate_no_context_takeover ) {
+        wslay_deflate_release ( ctx, &ctx->deflate_stream );
+    }
+    if ( ctx->deflate_stream != NULL ) {
+        talloc_free ( ctx->deflate_stream );
+    }
+    if ( ctx->inflate_stream != NULL && ctx->inflate_no_context_takeover ) {
+        wslay_deflate_release ( ctx, &ctx->inflate_stream );
+    }
+    if ( ctx->inflate_stream != NULL ) {
+        talloc_free ( ctx->inflate_stream );
+    }
+    return 0;
+}
+
+int wslay_deflate_check_params ( const struct wslay_deflate_params * params, bool server )
+{
+    uint8_t deflate_bits, inflate_bits;
+    if ( server ) {
+        deflate_bits = params->server_max_window_bits;
+        inflate_bits = params->client_max_window_bits;
+    } else {
+        deflate_bits = params->client_max_window_bits;
+        inflate_bits = params->server_max_window_bits;
+    }
+    if ( deflate_bits < 9 || deflate_bits > 15 || inflate_bits < 8 || inflate_bits > 15 ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    return 0;
+}
+
+wslay_deflate_context * wslay_deflate_context_new ( void * ctx, const struct wslay_deflate_params * params, bool server, wslay_deflate_pool * pool )
+{
+    if ( wslay_deflate_check_params ( params, server ) != 0 ) {
+        return NULL;
+    }
+    wslay_deflate_context * deflate_ctx = talloc_zero ( ctx, sizeof ( wslay_deflate_context ) );
+    if ( deflate_ctx == NULL ) {
+        return NULL;
+    }
+    if ( talloc_set_destructor ( deflate_ctx, wslay_deflate_context_free ) != 0 ) {
+        talloc_free ( deflate_ctx );
+        return NULL;
+    }
+    if ( server ) {
+        deflate_ctx->deflate_window_bits         = params->server_max_window_bits;
+        deflate_ctx->inflate_window_bits         = params->client_max_window_bits;
+        deflate_ctx->deflate_no_context_takeover = params->server_no_context_takeover;
+        deflate_ctx->inflate_no_context_takeover = params->client_no_context_takeover;
+    } else {
+        deflate_ctx->deflate_window_bits         = params->client_max_window_bits;
+        deflate_ctx->inflate_window_bits         = params->server_max_window_bits;
+        deflate_ctx->deflate_no_context_takeover = params->client_no_context_takeover;
+        deflate_ctx->inflate_no_context_takeover = params->server_no_context_takeover;
+    }
+    deflate_ctx->pool = pool;
+    return deflate_ctx;
+}
+
+static uint8_t * wslay_deflate_stream_message ( z_stream * stream, void * parent, const uint8_t * data, size_t length, size_t * result_length )
+{
+    // Sync flush appends empty stored block to the bound.
+    size_t capacity = deflateBound ( stream, length ) + 16;
+    uint8_t * result = talloc ( parent, capacity );
+    if ( result == NULL ) {
+        return NULL;
+    }
+
+    size_t in_offset  = 0;
+    size_t out_offset = 0;
+    while ( true ) {
+        uInt in_length  = wslay_min ( length - in_offset, UINT_MAX );
+        uInt out_length = wslay_min ( capacity - out_offset, UINT_MAX );
+        bool last = in_offset + in_length == length;
+        stream->next_in   = ( Bytef * ) data + in_offset;
+        stream->avail_in  = in_length;
+        stream->next_out  = result + out_offset;
+        stream->avail_out = out_length;
+        int r = deflate ( stream, last ? Z_SYNC_FLUSH : Z_NO_FLUSH );
+        if ( r != Z_OK && r != Z_BUF_ERROR ) {
+            talloc_free ( result );
+            return NULL;
+        }
+        in_offset  += in_length - stream->avail_in;
+        out_offset += out_length - stream->avail_out;
+        if ( last && stream->avail_in == 0 && stream->avail_out != 0 ) {
+            break;
+        }
+        if ( out_offset == capacity ) {
+            talloc_free ( result );
+            return NULL;
+        }
+    }
+
+    if (
+        out_offset < sizeof ( wslay_deflate_trailer ) ||
+        memcmp ( result + out_offset - sizeof ( wslay_deflate_trailer ), wslay_deflate_trailer, sizeof ( wslay_deflate_trailer ) ) != 0
+    ) {
+        talloc_free ( result );
+        return NULL;
+    }
+    * result_length = out_offset - sizeof ( wslay_deflate_trailer );
+    return result;
+}
+
+int wslay_deflate_message ( wslay_deflate_context * ctx, void * parent, const uint8_t * data, size_t length, uint8_t ** result, size_t * result_length )
+{
+    if ( ctx->deflate_stream == NULL ) {
+        int r = wslay_deflate_acquire ( ctx, true, &ctx->deflate_stream );
+        if ( r != 0 ) {
+            return r;
+        }
+    }
+    * result = wslay_deflate_stream_message ( &ctx->deflate_stream->stream, parent, data, length, result_length );
+    if ( ctx->deflate_no_context_takeover ) {
+        wslay_deflate_release ( ctx, &ctx->deflate_stream );
+    }
+    return * result == NULL ? WSLAY_ERR_NOMEM : 0;
+}
+
+uint8_t * wslay_deflate_once ( void * parent, uint8_t window_bits, const uint8_t * data, size_t length, size_t * result_length )
+{
+    if ( window_bits < 9 || window_bits > 15 ) {
+        return NULL;
+    }
+    wslay_deflate_stream * stream = wslay_deflate_stream_new ( NULL, NULL, true, window_bits );
+    if ( stream == NULL ) {
+        return NULL;
+    }
+    uint8_t * result = wslay_deflate_stream_message ( &stream->stream, parent, data, length, result_length );
+    talloc_free ( stream );
+    return result;
+}
+
+int wslay_inflate_set_input ( wslay_deflate_context * ctx, const uint8_t * data, size_t length, bool fin )
+{
+    if ( ctx->inflate_stream == NULL && wslay_deflate_acquire ( ctx, false, &ctx->inflate_stream ) != 0 ) {
+        return WSLAY_ERR_NOMEM;
+    }
+    ctx->inflate_stream->stream.next_in  = ( Bytef * ) data;
+    ctx->inflate_stream->stream.avail_in = length;
+    ctx->inflate_trailer = fin;
+    return 0;
+}
+
+ssize_t wslay_inflate_read ( wslay_deflate_context * ctx, uint8_t * buf, size_t length )
+{
+    z_stream * stream = &ctx->inflate_stream->stream;
+    stream->next_out  = buf;
+    stream->avail_out = wslay_min ( length, UINT_MAX );
+    uInt out_length   = stream->avail_out;
+    while ( stream->avail_out != 0 ) {
+        if ( stream->avail_in == 0 && ctx->inflate_trailer ) {
+            stream->next_in  = ( Bytef * ) wslay_deflate_trailer;
+            stream->avail_in = sizeof ( wslay_deflate_trailer );
+            ctx->inflate_trailer = false;
+        }
+        uInt avail_out = stream->avail_out;
+        int r = inflate ( stream, Z_SYNC_FLUSH );
+        if ( r == Z_STREAM_END ) {
+            // Peer finished deflate stream with BFINAL block, the next block starts new stream.
+            inflateReset ( stream );
+        } else if ( r != Z_OK && r != Z_BUF_ERROR ) {
+            return WSLAY_ERR_PROTO;
+        }
+        if ( stream->avail_in == 0 && !ctx->inflate_trailer && stream->avail_out == avail_out ) {
+            break;
+        }
+    }
+    return out_length - stream->avail_out;
+}
+
+void wslay_inflate_end ( wslay_deflate_context * ctx )
+{
+    if ( ctx->inflate_no_context_takeover && ctx->inflate_stream != NULL ) {
+        wslay_deflate_release ( ctx, &ctx->inflate_stream );
+    }
+}
+
+static ssize_t wslay_deflate_extension_offer ( struct wslay_event_context_t * ctx, void * user_data, char * buf, size_t length )
+{
+    ( void ) ctx;
+    const struct wslay_deflate_options * options = user_data;
+    struct wslay_deflate_params params;
+    if ( options != NULL ) {
+        params = options->params;
+    } else {
+        wslay_deflate_params_init ( &params );
+    }
+    return wslay_deflate_format_params ( &params, buf, length );
+}
+
+static int wslay_deflate_extension_accept ( struct wslay_event_context_t * ctx, void * user_data, const char * element, size_t element_length,
+        char * response, size_t * response_length, void ** data )
+{
+    const struct wslay_deflate_options * options = user_data;
+    struct wslay_deflate_params params;
+    if ( wslay_deflate_parse_params ( element, element_length, &params ) != 0 ) {
+        return 1;
+    }
+    if ( options != NULL ) {
+        params.server_no_context_takeover |= options->params.server_no_context_takeover;
+        params.client_no_context_takeover |= options->params.client_no_context_takeover;
+        params.server_max_window_bits = wslay_min ( params.server_max_window_bits, options->params.server_max_window_bits );
+    }
+    if ( wslay_deflate_check_params ( &params, true ) != 0 ) {
+        return 1;
+    }
+    ssize_t length = wslay_deflate_format_params ( &params, response, *response_length );
+    if ( length < 0 ) {
+        return length;
+    }
+    * data = wslay_deflate_context_new ( ctx, &params, true, options != NULL ? options->pool : NULL );
+    if ( * data == NULL ) {
+        return WSLAY_ERR_NOMEM;
+    }
+    * response_length = length;
+    return 0;
+}
+
+static int wslay_deflate_extension_confirm ( struct wslay_event_context_t * ctx, void * user_data, const char * element, size_t element_length, void ** data )
+{
+    const struct wslay_deflate_options * options = user_data;
+    struct wslay_deflate_params offer, params;
+    if ( options != NULL ) {
+        offer = options->params;
+    } else {
+        wslay_deflate_params_init ( &offer );
+    }
+    if ( wslay_deflate_parse_params ( element, element_length, &params ) != 0 ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    // Response must keep server parameters of the offer (RFC 7692 7.1.1.1, 7.1.2.1),
+    // and can limit client window only if the offer has client_max_window_bits (7.1.2.2).
+    if (
+        ( offer.server_no_context_takeover && !params.server_no_context_takeover ) ||
+        params.server_max_window_bits > offer.server_max_window_bits ||
+        ( offer.client_max_window_bits == 15 && params.client_max_window_bits != 15 )
+    ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    params.client_no_context_takeover |= offer.client_no_context_takeover;
+    params.client_max_window_bits = wslay_min ( params.client_max_window_bits, offer.client_max_window_bits );
+    if ( wslay_deflate_check_params ( &params, false ) != 0 ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    * data = wslay_deflate_context_new ( ctx, &params, false, options != NULL ? options->pool : NULL );
+    return * data == NULL ? WSLAY_ERR_NOMEM : 0;
+}
+
+static int wslay_deflate_extension_encode ( void * data, uint8_t opcode, const uint8_t * msg, size_t length, void * parent, uint8_t ** result, size_t * result_length )
+{
+    ( void ) opcode;
+    wslay_deflate_context * ctx = data;
+    int r = wslay_deflate_message ( ctx, parent, msg, length, result, result_length );
+    if ( r != 0 ) {
+        return r;
+    }
+    if ( * result_length >= length && ctx->deflate_no_context_takeover ) {
+        // Compression does not help and peer does not depend on the history of our stream.
+        talloc_free ( * result );
+        return 1;
+    }
+    return 0;
+}
+
+static int wslay_deflate_extension_decode_input ( void * data, const uint8_t * input, size_t length, bool fin )
+{
+    return wslay_inflate_set_input ( data, input, length, fin );
+}
+
+static ssize_t wslay_deflate_extension_decode_read ( void * data, uint8_t * buf, size_t length )
+{
+    return wslay_inflate_read ( data, buf, length );
+}
+
+static void wslay_deflate_extension_decode_end ( void * data )
+{
+    wslay_inflate_end ( data );
+}
+
+const wslay_event_extension wslay_deflate_extension = {
+    WSLAY_DEFLATE_TOKEN,
+    WSLAY_DEFLATE_RSV,
+    wslay_deflate_extension_offer,
+    wslay_deflate_extension_accept,
+    wslay_deflate_extension_confirm,
+    wslay_deflate_extension_encode,
+    wslay_deflate_extension_decode_input,
+    wslay_deflate_extension_decode_read,
+    wslay_deflate_extension_decode_end
+};
@@ -0,0 +1,208 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef WSLAY_DEFLATE_H
+#define WSLAY_DEFLATE_H
+
+#include "wslay.h"
+#include "extension.h"
+
+#include <zlib.h>
+
+// Extension token of permessage-deflate (RFC 7692).
+#define WSLAY_DEFLATE_TOKEN "permessage-deflate"
+
+// RSV1 bit marks the first frame of compressed message.
+#define WSLAY_DEFLATE_RSV 4
+
+// Parameters of permessage-deflate extension negotiated in the opening handshake.
+struct wslay_deflate_params {
+    // server must reset its compression context after each message
+    bool server_no_context_takeover;
+    // client must reset its compression context after each message
+    bool client_no_context_takeover;
+    // LZ77 window bits [8, 15] used by server to compress messages
+    uint8_t server_max_window_bits;
+    // LZ77 window bits [8, 15] used by client to compress messages
+    uint8_t client_max_window_bits;
+};
+
+// zlib stream which can be owned by a connection or kept idle in wslay_deflate_pool.
+typedef struct wslay_deflate_stream_t {
+    z_stream stream;
+    // pool accounting memory of this stream or NULL
+    struct wslay_deflate_pool_t * pool;
+    // the next idle stream in the pool
+    struct wslay_deflate_stream_t * next;
+    // estimated memory used by zlib
+    size_t memory;
+    uint8_t window_bits;
+    bool deflate;
+} wslay_deflate_stream;
+
+// Idle streams of the pool are kept separately for each kind and window bits.
+#define WSLAY_DEFLATE_POOL_LISTS 8
+
+typedef struct wslay_deflate_pool_t {
+    // idle deflate streams, indexed by window bits - 8
+    wslay_deflate_stream * idle_deflate[WSLAY_DEFLATE_POOL_LISTS];
+    // idle inflate streams, indexed by window bits - 8
+    wslay_deflate_stream * idle_inflate[WSLAY_DEFLATE_POOL_LISTS];
+    // 0 means no limit
+    size_t memory_limit;
+    size_t memory_used;
+    uint64_t hit_count;
+    uint64_t miss_count;
+    uint64_t fallback_count;
+} wslay_deflate_pool;
+
+typedef struct wslay_deflate_context_t {
+    // streams are allocated on the first message, NULL if not allocated or returned to the pool
+    wslay_deflate_stream * deflate_stream;
+    wslay_deflate_stream * inflate_stream;
+    wslay_deflate_pool * pool;
+    uint8_t deflate_window_bits;
+    uint8_t inflate_window_bits;
+    // reset deflate_stream after each sent message
+    bool deflate_no_context_takeover;
+    // reset inflate_stream after each received message
+    bool inflate_no_context_takeover;
+    // the end of message trailer still has to be inflated
+    bool inflate_trailer;
+} wslay_deflate_context;
+
+// Options of permessage-deflate negotiation, given as user_data of wslay_event_config_add_extension().
+struct wslay_deflate_options {
+    // Client: parameters offered to server.
+    // Server: no_context_takeover flags and server window bits applied on top of client offer.
+    struct wslay_deflate_params params;
+    // pool for the streams of negotiated extension, it can be NULL
+    wslay_deflate_pool * pool;
+};
+
+// permessage-deflate as extension of event-based API, user_data of negotiation is struct wslay_deflate_options or NULL.
+extern const wslay_event_extension wslay_deflate_extension;
+
+/*
+ * Sets default parameters: context takeover is allowed and both window bits are 15.
+ */
+void wslay_deflate_params_init ( struct wslay_deflate_params * params );
+
+// Returns 0 if params can be used by the endpoint, or WSLAY_ERR_INVALID_ARGUMENT.
+// zlib does not support raw deflate with 8 window bits, so it is rejected for own compression.
+int wslay_deflate_check_params ( const struct wslay_deflate_params * params, bool server );
+
+/*
+ * Parses value of Sec-WebSocket-Extensions header field of length length.
+ * The first permessage-deflate element of the list is stored to params.
+ * Parameters without value (client_max_window_bits in client offer) are stored with the default value 15.
+ *
+ * wslay_deflate_parse_params() returns 0 if it succeeds, 1 if there is no permessage-deflate element,
+ * or WSLAY_ERR_INVALID_ARGUMENT if the element has unknown, duplicated or invalid parameters.
+ */
+int wslay_deflate_parse_params ( const char * value, size_t length, struct wslay_deflate_params * params );
+
+/*
+ * Writes permessage-deflate element with params to buf of length length.
+ * Only parameters differing from defaults are written.
+ * The server can use the parameters parsed from client offer as the response.
+ *
+ * wslay_deflate_format_params() returns the number of bytes written without terminating NUL,
+ * or WSLAY_ERR_INVALID_ARGUMENT if buf is too small.
+ */
+ssize_t wslay_deflate_format_params ( const struct wslay_deflate_params * params, char * buf, size_t length );
+
+/*
+ * Allocates pool of zlib streams shared by deflate contexts.
+ * Streams are borrowed from the pool for each message by the sides which negotiated no_context_takeover,
+ * the sides with context takeover allocate their streams through the pool and keep them.
+ * memory_limit is the limit of zlib memory of all streams allocated through the pool, 0 means no limit.
+ * Idle streams are freed when a new stream does not fit into the limit.
+ * When a compression stream still does not fit, the message is sent uncompressed.
+ * Decompression streams are allocated even above the limit, because compressed messages have to be received.
+ *
+ * The pool must be freed after all deflate contexts using it.
+ * wslay_deflate_pool_new() returns NULL if out of memory.
+ */
+wslay_deflate_pool * wslay_deflate_pool_new ( void * ctx, size_t memory_limit );
+
+// Returns estimated zlib memory of all streams allocated through the pool.
+size_t wslay_deflate_pool_get_memory_used ( const wslay_deflate_pool * pool );
+
+// Returns the number of streams reused from the idle streams of the pool.
+uint64_t wslay_deflate_pool_get_hit_count ( const wslay_deflate_pool * pool );
+
+// Returns the number of streams allocated because there was no idle stream.
+uint64_t wslay_deflate_pool_get_miss_count ( const wslay_deflate_pool * pool );
+
+// Returns the number of messages sent uncompressed because of the memory limit.
+uint64_t wslay_deflate_pool_get_fallback_count ( const wslay_deflate_pool * pool );
+
+/*
+ * Allocates compression and decompression context for the endpoint.
+ * If server is true, messages are compressed with server parameters and decompressed with client parameters,
+ * otherwise vice versa.
+ * zlib streams are allocated on the first message through pool, pool can be NULL.
+ *
+ * wslay_deflate_context_new() returns NULL if params are invalid or out of memory.
+ */
+wslay_deflate_context * wslay_deflate_context_new ( void * ctx, const struct wslay_deflate_params * params, bool server, wslay_deflate_pool * pool );
+
+/*
+ * Compresses the whole message of length length.
+ * The result is allocated as child of parent and stored to *result, its length is stored to *result_length.
+ *
+ * wslay_deflate_message() returns 0 if it succeeds, 1 if the compression stream does not fit into the memory limit of the pool,
+ * or WSLAY_ERR_NOMEM if out of memory or zlib fails.
+ */
+int wslay_deflate_message ( wslay_deflate_context * ctx, void * parent, const uint8_t * data, size_t length, uint8_t ** result, size_t * result_length );
+
+/*
+ * Compresses the whole message of length length by a temporary stream with window_bits [9, 15],
+ * so the result can be sent on any connection without context takeover and with the same or larger window.
+ * The result is allocated as child of parent, its length is stored to *result_length.
+ * Returns NULL if window_bits is invalid, out of memory or zlib fails.
+ */
+uint8_t * wslay_deflate_once ( void * parent, uint8_t window_bits, const uint8_t * data, size_t length, size_t * result_length );
+
+/*
+ * Sets the next part of compressed payload to be inflated.
+ * fin must be true if it is the last part of the message.
+ * The data must stay valid until wslay_inflate_read() returns 0.
+ *
+ * wslay_inflate_set_input() returns 0 if it succeeds, or WSLAY_ERR_NOMEM if the decompression stream can not be allocated.
+ */
+int wslay_inflate_set_input ( wslay_deflate_context * ctx, const uint8_t * data, size_t length, bool fin );
+
+/*
+ * Inflates the input into buf of length length.
+ * Returns the number of bytes stored, 0 if the input is consumed,
+ * or WSLAY_ERR_PROTO if the compressed data is invalid.
+ */
+ssize_t wslay_inflate_read ( wslay_deflate_context * ctx, uint8_t * buf, size_t length );
+
+// Finishes decompression of the message, returns the stream to the pool if context takeover is disabled.
+void wslay_inflate_end ( wslay_deflate_context * ctx );
+
+#endif
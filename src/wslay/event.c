@@ -26,6 +26,7 @@
 #include <string.h>
 #include <assert.h>
 #include <stdio.h>
+#include <time.h>
 #include <arpa/inet.h>
 
 #include "event.h"
@@ -33,6 +34,14 @@
 #include "frame.h"
 
 #include <talloc2/tree.h>
+#include <talloc2/ext/destructor.h>
+
+static uint64_t wslay_event_get_time ( void )
+{
+    struct timespec ts;
+    clock_gettime ( CLOCK_MONOTONIC, &ts );
+    return ( uint64_t ) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
 static inline
 void wslay_event_imsg_set ( struct wslay_event_imsg * m, uint8_t fin, uint8_t rsv, uint8_t opcode )
@@ -41,66 +50,180 @@ void wslay_event_imsg_set ( struct wslay_event_imsg * m, uint8_t fin, uint8_t rs
     m->rsv = rsv;
     m->opcode = opcode;
     m->msg_length = 0;
+    m->decoded_length = 0;
+    m->discard = false;
 }
 
 extern inline
 void wslay_event_imsg_reset ( struct wslay_event_imsg * m );
 
-static inline
-uint8_t wslay_event_imsg_append_chunk ( struct wslay_event_imsg * m, size_t len )
+static uint8_t wslay_event_chunk_free ( void * data )
 {
-    if ( len == 0 ) {
-        return 0;
+    struct wslay_event_byte_chunk * chunk = data;
+    if ( chunk->data != NULL ) {
+        wslay_free ( chunk->allocator, chunk->data, chunk->capacity );
+    }
+    return 0;
+}
+
+// Reallocates data of chunk to hold capacity bytes. Returns 0 if it succeeds, otherwise nonzero.
+static uint8_t wslay_event_chunk_resize ( struct wslay_event_byte_chunk * chunk, size_t capacity )
+{
+    uint8_t * data;
+    if ( chunk->data == NULL ) {
+        data = wslay_alloc ( chunk->allocator, capacity * sizeof ( uint8_t ) );
+    } else {
+        data = wslay_realloc ( chunk->allocator, chunk->data, chunk->capacity, capacity * sizeof ( uint8_t ) );
     }
-    struct wslay_event_byte_chunk * chunk = talloc ( m->chunks, sizeof ( struct wslay_event_byte_chunk ) );
-    if ( chunk == NULL ) {
+    if ( data == NULL ) {
         return 1;
     }
-    if ( len != 0 ) {
-        void * data = talloc ( chunk, len * sizeof ( uint8_t ) );
-        if ( data == NULL ) {
+    chunk->data     = data;
+    chunk->capacity = capacity;
+    return 0;
+}
+
+/*
+ * Pushes empty chunk with room for at least capacity bytes to m, new chunk is allocated as a child of ctx
+ * and its data by the allocator of ctx.
+ * The spare chunk kept from the previous message is reused if there is one.
+ * Returns 0 if it succeeds, otherwise nonzero.
+ */
+static uint8_t wslay_event_imsg_push_chunk ( wslay_event_context * ctx, struct wslay_event_imsg * m, size_t capacity )
+{
+    struct wslay_event_byte_chunk * chunk = m->spare;
+    if ( chunk != NULL ) {
+        m->spare = NULL;
+    } else {
+        chunk = talloc ( ctx, sizeof ( struct wslay_event_byte_chunk ) );
+        if ( chunk == NULL ) {
+            return 1;
+        }
+        chunk->data      = NULL;
+        chunk->capacity  = 0;
+        chunk->allocator = ctx->allocator;
+        if ( talloc_set_destructor ( chunk, wslay_event_chunk_free ) != 0 ) {
             talloc_free ( chunk );
-            return 2;
+            return 1;
         }
-        chunk->data        = data;
-        chunk->data_length = len;
-    } else {
-        chunk->data        = NULL;
-        chunk->data_length = 0;
     }
-
-    if ( wslay_queue_push ( m->chunks, chunk ) != 0 ) {
+    chunk->data_length = 0;
+    if ( capacity > chunk->capacity && wslay_event_chunk_resize ( chunk, capacity ) != 0 ) {
+        talloc_free ( chunk );
+        return 2;
+    }
+    if ( wslay_queue_push ( &m->chunks, chunk ) != 0 ) {
+        talloc_free ( chunk );
         return 2;
     }
-    m->msg_length += len;
     return 0;
 }
 
+/*
+ * Makes room for len more bytes in the last chunk of m, which expects at most remaining more bytes.
+ * The capacity is doubled, so the memory follows the bytes actually received rather than announced frame length.
+ * Returns 0 if it succeeds, otherwise nonzero.
+ */
+static uint8_t wslay_event_imsg_reserve ( struct wslay_event_imsg * m, size_t len, uint64_t remaining )
+{
+    struct wslay_event_byte_chunk * chunk = wslay_queue_tail ( &m->chunks );
+    size_t needed = chunk->data_length + len;
+    if ( needed <= chunk->capacity ) {
+        return 0;
+    }
+    size_t capacity = chunk->capacity * 2;
+    if ( capacity < needed ) {
+        capacity = needed;
+    }
+    if ( capacity - chunk->data_length > remaining ) {
+        capacity = chunk->data_length + remaining;
+    }
+    return wslay_event_chunk_resize ( chunk, capacity );
+}
+
+// Appends len bytes of data to the message buffered in a single chunk of m.
+static uint8_t wslay_event_imsg_append ( wslay_event_context * ctx, struct wslay_event_imsg * m, const uint8_t * data, size_t len )
+{
+    if ( len == 0 ) {
+        return 0;
+    }
+    uint8_t r;
+    if ( wslay_queue_is_empty ( &m->chunks ) ) {
+        r = wslay_event_imsg_push_chunk ( ctx, m, len );
+    } else {
+        r = wslay_event_imsg_reserve ( m, len, UINT64_MAX );
+    }
+    if ( r != 0 ) {
+        return r;
+    }
+    struct wslay_event_byte_chunk * chunk = wslay_queue_tail ( &m->chunks );
+    memcpy ( chunk->data + chunk->data_length, data, len );
+    chunk->data_length += len;
+    m->msg_length      += len;
+    return 0;
+}
+
+/*
+ * Releases the chunks of m. The first one is kept as spare for the next message,
+ * unless its capacity is above the high-water mark set by wslay_event_config_set_recv_buffer_high_water().
+ */
+static void wslay_event_imsg_recycle_chunks ( wslay_event_context * ctx, struct wslay_event_imsg * m )
+{
+    while ( !wslay_queue_is_empty ( &m->chunks ) ) {
+        struct wslay_event_byte_chunk * chunk = wslay_queue_top ( &m->chunks );
+        wslay_queue_pop ( &m->chunks );
+        if ( m->spare == NULL && chunk->capacity <= ctx->recv_buffer_high_water ) {
+            m->spare = chunk;
+            if ( ctx->recv_buffer_idle_timeout != 0 ) {
+                m->spare_time = wslay_event_get_time();
+            }
+        } else {
+            talloc_free ( chunk );
+        }
+    }
+    m->msg_length = 0;
+}
+
+// Returns the copy of payload stored right after omsg in the same allocation.
 static inline
-struct wslay_event_omsg * wslay_event_omsg_non_fragmented_new ( void * ctx, uint8_t opcode, const uint8_t * msg, size_t msg_length )
+uint8_t * wslay_event_omsg_copy ( struct wslay_event_omsg * omsg )
 {
-    struct wslay_event_omsg * omsg = talloc ( ctx, sizeof ( struct wslay_event_omsg ) );
+    return ( uint8_t * ) ( omsg + 1 );
+}
+
+/*
+ * Creates message with a copy of msg_length bytes of msg, both allocated at once by the allocator of ctx.
+ * With arena set by wslay_event_config_set_arena() messages freed in FIFO order make no calls to malloc.
+ */
+static inline
+struct wslay_event_omsg * wslay_event_omsg_non_fragmented_new ( wslay_event_context * ctx, uint8_t opcode, const uint8_t * msg, size_t msg_length )
+{
+    struct wslay_event_omsg * omsg = wslay_alloc ( ctx->allocator, sizeof ( struct wslay_event_omsg ) + msg_length );
     if ( omsg == NULL ) {
         return NULL;
     }
     omsg->fin    = 1;
     omsg->opcode = opcode;
     omsg->type   = WSLAY_NON_FRAGMENTED;
+    omsg->copy_length = msg_length;
 
     if ( msg_length != 0 ) {
-        void * data = talloc ( omsg, msg_length );
-        if ( data == NULL ) {
-            talloc_free ( omsg );
-            return NULL;
-        }
-        memcpy ( data, msg, msg_length );
-
-        omsg->data        = data;
+        memcpy ( wslay_event_omsg_copy ( omsg ), msg, msg_length );
+        omsg->data        = wslay_event_omsg_copy ( omsg );
         omsg->data_length = msg_length;
     } else {
         omsg->data        = NULL;
         omsg->data_length = 0;
     }
+    omsg->data_offset   = 0;
+    omsg->keyed         = false;
+    omsg->key           = 0;
+    omsg->deadline      = 0;
+    omsg->id            = 0;
+    omsg->cancelled     = false;
+    omsg->rsv           = 0;
+    omsg->transformed   = false;
+    omsg->broadcast     = NULL;
     omsg->read_callback = NULL;
     memset ( &omsg->source, 0, sizeof ( omsg->source ) );
 
@@ -108,18 +231,28 @@ struct wslay_event_omsg * wslay_event_omsg_non_fragmented_new ( void * ctx, uint
 }
 
 static inline
-struct wslay_event_omsg * wslay_event_omsg_fragmented_new ( void * ctx, uint8_t opcode, const union wslay_event_msg_source source, wslay_event_fragmented_msg_callback read_callback )
+struct wslay_event_omsg * wslay_event_omsg_fragmented_new ( wslay_event_context * ctx, uint8_t opcode, const union wslay_event_msg_source source, wslay_event_fragmented_msg_callback read_callback )
 {
-    struct wslay_event_omsg * omsg = talloc ( ctx, sizeof ( struct wslay_event_omsg ) );
+    struct wslay_event_omsg * omsg = wslay_alloc ( ctx->allocator, sizeof ( struct wslay_event_omsg ) );
     if ( omsg == NULL ) {
         return NULL;
     }
     omsg->fin    = 0;
     omsg->opcode = opcode;
     omsg->type   = WSLAY_FRAGMENTED;
+    omsg->copy_length = 0;
 
     omsg->data        = NULL;
     omsg->data_length = 0;
+    omsg->data_offset = 0;
+    omsg->keyed       = false;
+    omsg->key         = 0;
+    omsg->deadline    = 0;
+    omsg->id          = 0;
+    omsg->cancelled   = false;
+    omsg->rsv         = 0;
+    omsg->transformed = false;
+    omsg->broadcast   = NULL;
 
     omsg->source        = source;
     omsg->read_callback = read_callback;
@@ -127,36 +260,15 @@ struct wslay_event_omsg * wslay_event_omsg_fragmented_new ( void * ctx, uint8_t
     return omsg;
 }
 
+// Returns the payload of m gathered in a single chunk, or NULL if it is empty.
 static inline
-uint8_t * wslay_event_flatten_queue ( wslay_queue * queue, size_t len )
+uint8_t * wslay_event_imsg_data ( struct wslay_event_imsg * m )
 {
-    if ( len == 0 ) {
+    if ( wslay_queue_is_empty ( &m->chunks ) ) {
         return NULL;
-    } else {
-        size_t off    = 0;
-        uint8_t * buf = talloc ( queue, len * sizeof ( uint8_t ) );
-        if ( buf == NULL ) {
-            return NULL;
-        }
-
-        while ( !wslay_queue_is_empty ( queue ) ) {
-            struct wslay_event_byte_chunk * chunk = wslay_queue_top ( queue );
-            memcpy ( buf + off, chunk->data, chunk->data_length );
-            off += chunk->data_length;
-            talloc_free ( chunk );
-            if ( wslay_queue_pop ( queue ) != 0 ) {
-                return NULL;
-            }
-            if ( off > len ) {
-                return NULL;
-            }
-        }
-
-        if ( len != off ) {
-            return NULL;
-        }
-        return buf;
     }
+    struct wslay_event_byte_chunk * chunk = wslay_queue_top ( &m->chunks );
+    return chunk->data;
 }
 
 static inline
@@ -207,52 +319,265 @@ static int wslay_event_queue_close_wrapper ( wslay_event_context * ctx, uint16_t
     return 0;
 }
 
-int wslay_event_queue_msg ( wslay_event_context * ctx, const wslay_event_msg * arg )
+/*
+ * Queues omsg whose options (key, deadline, broadcast) are set by the caller, omsg is freed if it fails.
+ * Keyed message replaces the queued message with the same key which has not started to be sent.
+ * Returns 0 if it succeeds, WSLAY_ERR_NO_MORE_MSG or WSLAY_ERR_NOMEM.
+ */
+static int wslay_event_queue_omsg ( wslay_event_context * ctx, struct wslay_event_omsg * omsg )
 {
-    int r;
     if ( !wslay_event_is_msg_queueable ( ctx ) ) {
+        wslay_event_omsg_free ( ctx, omsg );
         return WSLAY_ERR_NO_MORE_MSG;
     }
+    if ( omsg->keyed ) {
+        wslay_queue_cell * cell;
+        for ( cell = ctx->send_queue.top; cell != NULL; cell = cell->next ) {
+            struct wslay_event_omsg * queued = cell->data;
+            // Message split by max_send_frame_length may be pushed back after its first frame was sent.
+            if ( queued->keyed && queued->key == omsg->key && queued->data_offset == 0 ) {
+                cell->data = omsg;
+                omsg->id = ++ctx->last_msg_id;
+                ctx->queued_msg_length -= queued->data_length;
+                ctx->queued_msg_length += omsg->data_length;
+                wslay_event_omsg_free ( ctx, queued );
+                return 0;
+            }
+        }
+    }
+
+    wslay_queue * queue = wslay_is_ctrl_frame ( omsg->opcode ) ? &ctx->send_ctrl_queue : &ctx->send_queue;
+    if ( wslay_queue_push ( queue, omsg ) != 0 ) {
+        wslay_event_omsg_free ( ctx, omsg );
+        return WSLAY_ERR_NOMEM;
+    }
+    omsg->id = ++ctx->last_msg_id;
+    ctx->queued_msg_count ++;
+    ctx->queued_msg_length += omsg->data_length;
+    return 0;
+}
+
+int wslay_event_queue_msg ( wslay_event_context * ctx, const wslay_event_msg * arg )
+{
     if ( wslay_is_ctrl_frame ( arg->opcode ) && arg->msg_length > 125 ) {
         return WSLAY_ERR_INVALID_ARGUMENT;
     }
+    struct wslay_event_omsg * omsg = wslay_event_omsg_non_fragmented_new ( ctx, arg->opcode, arg->msg, arg->msg_length );
+    if ( omsg == NULL ) {
+        return -1;
+    }
+    return wslay_event_queue_omsg ( ctx, omsg );
+}
 
-    wslay_queue * queue;
+int wslay_event_queue_msg_with_options ( wslay_event_context * ctx, const wslay_event_msg * arg, const wslay_event_msg_options * options )
+{
     if ( wslay_is_ctrl_frame ( arg->opcode ) ) {
-        queue = ctx->send_ctrl_queue;
-    } else {
-        queue = ctx->send_queue;
+        return WSLAY_ERR_INVALID_ARGUMENT;
     }
-
-    struct wslay_event_omsg * omsg = wslay_event_omsg_non_fragmented_new ( queue, arg->opcode, arg->msg, arg->msg_length );
+    struct wslay_event_omsg * omsg = wslay_event_omsg_non_fragmented_new ( ctx, arg->opcode, arg->msg, arg->msg_length );
     if ( omsg == NULL ) {
-        return -1;
+        return WSLAY_ERR_NOMEM;
     }
-    if ( ( r = wslay_queue_push ( queue, omsg ) ) != 0 ) {
-        return r;
+    omsg->keyed = options->keyed;
+    omsg->key   = options->key;
+    if ( options->ttl != 0 ) {
+        omsg->deadline = wslay_event_get_time() + options->ttl;
     }
+    return wslay_event_queue_omsg ( ctx, omsg );
+}
 
-    ctx->queued_msg_count++;
-    ctx->queued_msg_length += arg->msg_length;
-    return 0;
+int wslay_event_queue_keyed_msg ( wslay_event_context * ctx, const wslay_event_msg * arg, uint64_t key )
+{
+    const wslay_event_msg_options options = { .keyed = true, .key = key };
+    return wslay_event_queue_msg_with_options ( ctx, arg, &options );
 }
 
-int wslay_event_queue_fragmented_msg ( wslay_event_context * ctx, const struct wslay_event_fragmented_msg *arg )
+int wslay_event_queue_expiring_msg ( wslay_event_context * ctx, const wslay_event_msg * arg, uint32_t ttl )
 {
-    if ( !wslay_event_is_msg_queueable ( ctx ) ) {
-        return WSLAY_ERR_NO_MORE_MSG;
+    const wslay_event_msg_options options = { .ttl = ttl };
+    return wslay_event_queue_msg_with_options ( ctx, arg, &options );
+}
+
+wslay_event_broadcast * wslay_event_broadcast_new ( uint8_t opcode, const uint8_t * msg, size_t msg_length, uint8_t window_bits )
+{
+    if ( ( opcode != WSLAY_TEXT_FRAME && opcode != WSLAY_BINARY_FRAME ) || ( window_bits != 0 && ( window_bits < 9 || window_bits > 15 ) ) ) {
+        return NULL;
+    }
+    wslay_event_broadcast * broadcast = talloc_zero ( NULL, sizeof ( wslay_event_broadcast ) );
+    if ( broadcast == NULL ) {
+        return NULL;
+    }
+    broadcast->opcode      = opcode;
+    broadcast->window_bits = window_bits;
+    broadcast->refcount    = 1;
+
+    if ( msg_length != 0 ) {
+        broadcast->data = talloc ( broadcast, msg_length );
+        if ( broadcast->data == NULL ) {
+            talloc_free ( broadcast );
+            return NULL;
+        }
+        memcpy ( broadcast->data, msg, msg_length );
+        broadcast->data_length = msg_length;
+
+        if ( window_bits != 0 ) {
+            size_t length;
+            uint8_t * data = wslay_deflate_once ( broadcast, window_bits, msg, msg_length, &length );
+            if ( data == NULL ) {
+                talloc_free ( broadcast );
+                return NULL;
+            }
+            if ( length < msg_length ) {
+                broadcast->deflated_data   = data;
+                broadcast->deflated_length = length;
+            } else {
+                talloc_free ( data );
+            }
+        }
+    }
+    return broadcast;
+}
+
+void wslay_event_broadcast_release ( wslay_event_broadcast * broadcast )
+{
+    // The last reference can be released by a context of another thread.
+    if ( __atomic_sub_fetch ( &broadcast->refcount, 1, __ATOMIC_ACQ_REL ) == 0 ) {
+        talloc_free ( broadcast );
     }
+}
+
+void wslay_event_omsg_free ( wslay_event_context * ctx, struct wslay_event_omsg * omsg )
+{
+    if ( omsg->broadcast != NULL ) {
+        wslay_event_broadcast_release ( omsg->broadcast );
+    } else if ( omsg->data != NULL && omsg->data != wslay_event_omsg_copy ( omsg ) ) {
+        // payload encoded by extensions
+        talloc_free ( omsg->data );
+    }
+    wslay_free ( ctx->allocator, omsg, sizeof ( struct wslay_event_omsg ) + omsg->copy_length );
+}
+
+// Returns true if the payload of broadcast compressed once can be sent by ctx.
+static inline
+bool wslay_event_broadcast_is_deflatable ( wslay_event_context * ctx, const wslay_event_broadcast * broadcast )
+{
+    wslay_deflate_context * deflate_ctx = wslay_event_get_extension_data ( ctx, &wslay_deflate_extension );
+    return broadcast->window_bits != 0 && deflate_ctx != NULL && deflate_ctx->deflate_no_context_takeover &&
+           deflate_ctx->deflate_window_bits >= broadcast->window_bits;
+}
+
+int wslay_event_queue_broadcast ( wslay_event_context * ctx, wslay_event_broadcast * broadcast )
+{
+    struct wslay_event_omsg * omsg = wslay_event_omsg_non_fragmented_new ( ctx, broadcast->opcode, NULL, 0 );
+    if ( omsg == NULL ) {
+        return WSLAY_ERR_NOMEM;
+    }
+    if ( broadcast->deflated_data != NULL && wslay_event_broadcast_is_deflatable ( ctx, broadcast ) ) {
+        omsg->data        = broadcast->deflated_data;
+        omsg->data_length = broadcast->deflated_length;
+        omsg->rsv         = WSLAY_DEFLATE_RSV;
+        omsg->transformed = true;
+    } else {
+        omsg->data        = broadcast->data;
+        omsg->data_length = broadcast->data_length;
+    }
+    omsg->broadcast = broadcast;
+    __atomic_add_fetch ( &broadcast->refcount, 1, __ATOMIC_ACQ_REL );
+    return wslay_event_queue_omsg ( ctx, omsg );
+}
+
+int wslay_event_queue_fragmented_msg ( wslay_event_context * ctx, const struct wslay_event_fragmented_msg *arg )
+{
     if ( wslay_is_ctrl_frame ( arg->opcode ) ) {
         return WSLAY_ERR_INVALID_ARGUMENT;
     }
-    struct wslay_event_omsg * omsg = wslay_event_omsg_fragmented_new ( ctx->send_queue, arg->opcode, arg->source, arg->read_callback );
+    struct wslay_event_omsg * omsg = wslay_event_omsg_fragmented_new ( ctx, arg->opcode, arg->source, arg->read_callback );
     if ( omsg == NULL ) {
         return -1;
     }
-    if ( wslay_queue_push ( ctx->send_queue, omsg ) != 0 ) {
-        return -1;
+    return wslay_event_queue_omsg ( ctx, omsg );
+}
+
+uint64_t wslay_event_get_last_msg_id ( wslay_event_context * ctx )
+{
+    return ctx->last_msg_id;
+}
+
+// Returns true if some bytes of non-control omsg have been sent.
+static bool wslay_event_omsg_is_started ( wslay_event_context * ctx, struct wslay_event_omsg * omsg )
+{
+    if ( omsg->opcode == WSLAY_CONTINUATION_FRAME || omsg->data_offset != 0 ) {
+        return true;
     }
-    ctx->queued_msg_count ++;
+    return omsg == ctx->omsg && ctx->frame_ctx->ostate != PREP_HEADER;
+}
+
+/*
+ * Returns true if obuf is owned by fragmented omsg: it is being sent,
+ * or it holds coalesced data and was pushed back to send_queue by a control frame.
+ */
+static bool wslay_event_omsg_owns_obuf ( wslay_event_context * ctx, struct wslay_event_omsg * omsg )
+{
+    if ( omsg->type != WSLAY_FRAGMENTED ) {
+        return false;
+    }
+    if ( omsg == ctx->omsg ) {
+        return true;
+    }
+    return ctx->obufmark != ctx->obuflimit && !wslay_queue_is_empty ( &ctx->send_queue ) &&
+           wslay_queue_top ( &ctx->send_queue ) == omsg;
+}
+
+// Frees obuf once fragmented message no longer needs it, it is allocated again by wslay_event_fill_obuf().
+static void wslay_event_release_obuf ( wslay_event_context * ctx )
+{
+    if ( ctx->obuf != NULL ) {
+        wslay_free ( ctx->allocator, ctx->obuf, ctx->obuf_length );
+    }
+    ctx->obuf     = NULL;
+    ctx->obufmark = ctx->obuflimit = NULL;
+}
+
+int wslay_event_cancel_msg ( wslay_event_context * ctx, uint64_t id )
+{
+    struct wslay_event_omsg * omsg = NULL;
+    if ( ctx->omsg != NULL && ctx->omsg->id == id && !wslay_is_ctrl_frame ( ctx->omsg->opcode ) ) {
+        omsg = ctx->omsg;
+    } else {
+        wslay_queue_cell * cell;
+        for ( cell = ctx->send_queue.top; cell != NULL; cell = cell->next ) {
+            if ( ( ( struct wslay_event_omsg * ) cell->data )->id == id ) {
+                omsg = cell->data;
+                break;
+            }
+        }
+    }
+    if ( omsg == NULL || omsg->cancelled ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+
+    if ( wslay_event_omsg_is_started ( ctx, omsg ) ) {
+        // Truncated compressed message would break decompression on peer.
+        if ( omsg->fin || omsg->transformed ) {
+            // The last frame is being sent.
+            return WSLAY_ERR_INVALID_ARGUMENT;
+        }
+        omsg->cancelled = true;
+        return 0;
+    }
+
+    if ( wslay_event_omsg_owns_obuf ( ctx, omsg ) ) {
+        // Drop data held by coalescing.
+        wslay_event_release_obuf ( ctx );
+    }
+    if ( omsg == ctx->omsg ) {
+        ctx->omsg = NULL;
+    } else {
+        wslay_queue_remove ( &ctx->send_queue, omsg );
+    }
+    ctx->queued_msg_count --;
+    ctx->queued_msg_length -= omsg->data_length;
+    wslay_event_omsg_free ( ctx, omsg );
     return 0;
 }
 
@@ -297,7 +622,201 @@ static int wslay_event_config_get_no_buffering ( wslay_event_context * ctx )
     return ( ctx->config & WSLAY_CONFIG_NO_BUFFERING ) > 0;
 }
 
-int wslay_event_recv ( wslay_event_context * ctx )
+/*
+ * Decides whether payload of the message starting with opcode is validated as UTF-8.
+ * Text messages are sampled by the interval set by wslay_event_config_set_text_validation().
+ */
+static bool wslay_event_should_validate ( wslay_event_context * ctx, uint8_t opcode )
+{
+    if ( opcode == WSLAY_CONNECTION_CLOSE ) {
+        return true;
+    }
+    if ( opcode != WSLAY_TEXT_FRAME ) {
+        return false;
+    }
+    uint64_t count = ctx->validated_text_msg_count + ctx->trusted_text_msg_count;
+    if ( ctx->text_validation_interval != 0 && count % ctx->text_validation_interval == 0 ) {
+        ++ctx->validated_text_msg_count;
+        return true;
+    }
+    ++ctx->trusted_text_msg_count;
+    return false;
+}
+
+// Starts receiving the message of the first frame iocb on ctx->imsg.
+static void wslay_event_imsg_start ( wslay_event_context * ctx, const struct wslay_frame_iocb * iocb )
+{
+    struct wslay_event_imsg * imsg = ctx->imsg;
+    wslay_event_imsg_set ( imsg, iocb->fin, iocb->rsv, iocb->opcode );
+    imsg->validate = wslay_event_should_validate ( ctx, iocb->opcode );
+    if ( wslay_is_ctrl_frame ( iocb->opcode ) ) {
+        imsg->buffered = true;
+        imsg->peeking  = false;
+    } else {
+        // Peeked bytes are buffered until the application decides.
+        imsg->peeking  = ctx->peek_length > 0 && ctx->callbacks.on_msg_peek_callback != NULL;
+        imsg->buffered = imsg->peeking || !wslay_event_config_get_no_buffering ( ctx );
+    }
+}
+
+// Returns RSV bits of enabled extensions which decode received messages.
+static uint8_t wslay_event_get_decodable_rsv ( wslay_event_context * ctx )
+{
+    uint8_t rsv = 0;
+    uint8_t i;
+    for ( i = 0; i < ctx->extension_count; ++i ) {
+        const struct wslay_event_extension_slot * slot = &ctx->extensions[i];
+        if ( slot->enabled && slot->extension->decode_input != NULL && slot->extension->decode_read != NULL ) {
+            rsv |= slot->extension->rsv;
+        }
+    }
+    return rsv;
+}
+
+static bool wslay_event_is_valid_rsv ( wslay_event_context * ctx, const struct wslay_frame_iocb * iocb )
+{
+    if ( iocb->rsv == 0 ) {
+        return true;
+    }
+    // RSV bits of enabled extensions which can decode are allowed on the first frame of data message.
+    return ( iocb->rsv & ~wslay_event_get_decodable_rsv ( ctx ) ) == 0 &&
+           ( iocb->opcode == WSLAY_TEXT_FRAME || iocb->opcode == WSLAY_BINARY_FRAME );
+}
+
+static inline
+bool wslay_event_imsg_is_encoded ( struct wslay_event_imsg * m )
+{
+    // RSV bits are validated by wslay_event_is_valid_rsv().
+    return m->rsv != 0;
+}
+
+/*
+ * Validates and buffers the part of decoded message payload.
+ * Returns 0 if it succeeds, 1 if the connection is failed and close frame is queued, or negative error code.
+ */
+static int wslay_event_accept_decoded_payload ( wslay_event_context * ctx, const uint8_t * data, size_t data_length )
+{
+    int r;
+    if ( data_length == 0 || ctx->imsg->discard ) {
+        return 0;
+    }
+    ctx->imsg->decoded_length += data_length;
+    if ( ctx->imsg->decoded_length > ctx->max_recv_msg_length ) {
+        r = wslay_event_queue_close_wrapper ( ctx, WSLAY_CODE_MESSAGE_TOO_BIG, NULL, 0 );
+        return r != 0 ? r : 1;
+    }
+    if ( ctx->imsg->validate && wslay_utf8_validate ( &ctx->imsg->utf8state, data, data_length ) == UTF8_REJECT ) {
+        r = wslay_event_queue_close_wrapper ( ctx, WSLAY_CODE_INVALID_FRAME_PAYLOAD_DATA, NULL, 0 );
+        return r != 0 ? r : 1;
+    }
+    if ( ctx->callbacks.on_frame_recv_chunk_callback && !ctx->imsg->peeking ) {
+        struct wslay_event_on_frame_recv_chunk_arg arg;
+        arg.data = data;
+        arg.data_length = data_length;
+        ctx->callbacks.on_frame_recv_chunk_callback ( ctx, &arg, ctx->user_data );
+    }
+    if ( ctx->imsg->buffered && wslay_event_imsg_append ( ctx, ctx->imsg, data, data_length ) != 0 ) {
+        ctx->read_enabled = 0;
+        return WSLAY_ERR_NOMEM;
+    }
+    return 0;
+}
+
+/*
+ * Decodes the part of encoded message payload by enabled extensions with index below index,
+ * whose RSV bits are set on the message, in reverse order.
+ * fin is true for the last part of the message.
+ * Returns 0 if it succeeds, 1 if the connection is failed and close frame is queued, or negative error code.
+ */
+static int wslay_event_decode_payload ( wslay_event_context * ctx, uint8_t index, const uint8_t * data, size_t data_length, bool fin )
+{
+    struct wslay_event_extension_slot * slot = NULL;
+    while ( index > 0 && slot == NULL ) {
+        index --;
+        if ( ctx->extensions[index].enabled && ( ctx->imsg->rsv & ctx->extensions[index].extension->rsv ) != 0 ) {
+            slot = &ctx->extensions[index];
+        }
+    }
+    if ( slot == NULL ) {
+        return wslay_event_accept_decoded_payload ( ctx, data, data_length );
+    }
+
+    uint8_t buf[4096];
+    int r;
+    if ( ( r = slot->extension->decode_input ( slot->data, data, data_length, fin ) ) != 0 ) {
+        ctx->read_enabled = 0;
+        return r;
+    }
+    while ( true ) {
+        ssize_t length = slot->extension->decode_read ( slot->data, buf, sizeof ( buf ) );
+        if ( length < 0 ) {
+            r = wslay_event_queue_close_wrapper ( ctx, WSLAY_CODE_INVALID_FRAME_PAYLOAD_DATA, NULL, 0 );
+            return r != 0 ? r : 1;
+        } else if ( length == 0 ) {
+            break;
+        }
+        if ( ( r = wslay_event_decode_payload ( ctx, index, buf, length, false ) ) != 0 ) {
+            return r;
+        }
+    }
+    if ( fin ) {
+        if ( slot->extension->decode_end != NULL ) {
+            slot->extension->decode_end ( slot->data );
+        }
+        // Inner extensions finish after the whole output of this one.
+        return wslay_event_decode_payload ( ctx, index, NULL, 0, true );
+    }
+    return 0;
+}
+
+/*
+ * Passes the first bytes of the message being received to on_msg_peek_callback and applies its decision.
+ * received is the number of (decoded) bytes buffered so far.
+ */
+static void wslay_event_peek_msg ( wslay_event_context * ctx, uint64_t received )
+{
+    struct wslay_event_imsg * imsg = ctx->imsg;
+    struct wslay_event_on_msg_peek_arg arg;
+    wslay_queue_cell * cell;
+    size_t length = 0;
+    arg.data_length = received < ctx->peek_length ? received : ctx->peek_length;
+    for ( cell = imsg->chunks.top; cell != NULL && length < arg.data_length; cell = cell->next ) {
+        struct wslay_event_byte_chunk * chunk = cell->data;
+        size_t chunk_length = chunk->data_length;
+        if ( chunk_length > arg.data_length - length ) {
+            chunk_length = arg.data_length - length;
+        }
+        memcpy ( ctx->peek_buf + length, chunk->data, chunk_length );
+        length += chunk_length;
+    }
+    arg.rsv    = imsg->rsv;
+    arg.opcode = imsg->opcode;
+    arg.data   = ctx->peek_buf;
+    arg.fin    = imsg->fin && ctx->ipayloadoff == ctx->ipayloadlen;
+    imsg->peeking = false;
+    int action = ctx->callbacks.on_msg_peek_callback ( ctx, &arg, ctx->user_data );
+    if ( action == WSLAY_PEEK_DISCARD ) {
+        wslay_event_discard_msg ( ctx );
+        return;
+    }
+    // Chunks held back while peeking are delivered now, streamed message drops them afterwards.
+    for ( cell = imsg->chunks.top; cell != NULL; cell = cell->next ) {
+        struct wslay_event_byte_chunk * chunk = cell->data;
+        struct wslay_event_on_frame_recv_chunk_arg chunk_arg;
+        chunk_arg.data        = chunk->data;
+        chunk_arg.data_length = chunk->data_length;
+        if ( ctx->callbacks.on_frame_recv_chunk_callback && chunk_arg.data_length > 0 ) {
+            ctx->callbacks.on_frame_recv_chunk_callback ( ctx, &chunk_arg, ctx->user_data );
+        }
+    }
+    if ( action == WSLAY_PEEK_STREAM ) {
+        wslay_event_imsg_recycle_chunks ( ctx, imsg );
+        imsg->buffered = false;
+    }
+}
+
+// Receives frames until reading would block or is disabled, see wslay_event_recv().
+static int wslay_event_recv_frames ( wslay_event_context * ctx )
 {
     struct wslay_frame_iocb iocb;
     ssize_t r;
@@ -307,8 +826,7 @@ int wslay_event_recv ( wslay_event_context * ctx )
         memset ( &iocb, 0, sizeof ( iocb ) );
         if ( ( result = wslay_frame_recv ( ctx->frame_ctx, &iocb, &data_length ) ) == 0 ) {
             int new_frame = 0;
-            /* We only allow rsv == 0 ATM. */
-            if ( iocb.rsv != 0 || ( ( ctx->server && !iocb.mask ) || ( !ctx->server && iocb.mask ) ) ) {
+            if ( !wslay_event_is_valid_rsv ( ctx, &iocb ) || ( ( ctx->server && !iocb.mask ) || ( !ctx->server && iocb.mask ) ) ) {
                 if ( ( r = wslay_event_queue_close_wrapper ( ctx, WSLAY_CODE_PROTOCOL_ERROR, NULL, 0 ) ) != 0 ) {
                     return r;
                 }
@@ -322,7 +840,7 @@ int wslay_event_recv ( wslay_event_context * ctx )
                     iocb.opcode == WSLAY_PING ||
                     iocb.opcode == WSLAY_PONG
                 ) {
-                    wslay_event_imsg_set ( ctx->imsg, iocb.fin, iocb.rsv, iocb.opcode );
+                    wslay_event_imsg_start ( ctx, &iocb );
                     new_frame = 1;
                 } else {
                     if ( ( r = wslay_event_queue_close_wrapper ( ctx, WSLAY_CODE_PROTOCOL_ERROR, NULL, 0 ) ) != 0 ) {
@@ -339,7 +857,7 @@ int wslay_event_recv ( wslay_event_context * ctx )
                     iocb.opcode == WSLAY_PONG
                 ) {
                     ctx->imsg = &ctx->imsgs[1];
-                    wslay_event_imsg_set ( ctx->imsg, iocb.fin, iocb.rsv, iocb.opcode );
+                    wslay_event_imsg_start ( ctx, &iocb );
                 } else {
                     if ( ( r = wslay_event_queue_close_wrapper ( ctx, WSLAY_CODE_PROTOCOL_ERROR, NULL, 0 ) ) != 0 ) {
                         return r;
@@ -349,74 +867,128 @@ int wslay_event_recv ( wslay_event_context * ctx )
                 new_frame = 1;
             }
             if ( new_frame ) {
+                ctx->ipayloadlen = iocb.payload_length;
+                // The callback can discard the message before its length is checked and buffer is allocated.
+                if ( !ctx->imsg->discard ) {
+                    wslay_event_call_on_frame_recv_start_callback ( ctx, &iocb );
+                }
+            }
+            if ( new_frame && !ctx->imsg->discard ) {
                 if ( ctx->imsg->msg_length + iocb.payload_length > ctx->max_recv_msg_length ) {
                     if ( ( r = wslay_event_queue_close_wrapper ( ctx, WSLAY_CODE_MESSAGE_TOO_BIG, NULL, 0 ) ) != 0 ) {
                         return r;
                     }
                     break;
                 }
-                ctx->ipayloadlen = iocb.payload_length;
-                wslay_event_call_on_frame_recv_start_callback ( ctx, &iocb );
-                if ( !wslay_event_config_get_no_buffering ( ctx ) || wslay_is_ctrl_frame ( iocb.opcode ) ) {
-                    if ( wslay_event_imsg_append_chunk ( ctx->imsg, iocb.payload_length ) != 0 ) {
+                // Encoded message is buffered as it is decoded.
+                // Only the first bytes of the frame are allocated upfront, the chunk grows as payload arrives.
+                // Continuation frames are appended to the same chunk.
+                if ( ctx->imsg->buffered && !wslay_event_imsg_is_encoded ( ctx->imsg ) && iocb.payload_length > 0 &&
+                        wslay_queue_is_empty ( &ctx->imsg->chunks ) ) {
+                    size_t capacity = ctx->recv_prealloc_length;
+                    if ( capacity > iocb.payload_length ) {
+                        capacity = iocb.payload_length;
+                    }
+                    if ( wslay_event_imsg_push_chunk ( ctx, ctx->imsg, capacity ) != 0 ) {
                         ctx->read_enabled = 0;
                         return -1;
                     }
                 }
             }
-            if ( ctx->imsg->opcode == WSLAY_TEXT_FRAME || ctx->imsg->opcode == WSLAY_CONNECTION_CLOSE ) {
-                size_t i;
-                if ( ctx->imsg->opcode == WSLAY_CONNECTION_CLOSE ) {
-                    i = 2;
-                } else {
-                    i = 0;
+            // The frame layer keeps payload masked, so it is unmasked in the same pass which validates and copies it.
+            const uint8_t * mask = iocb.mask ? ctx->frame_ctx->imaskkey : NULL;
+            if ( ctx->imsg->discard && !wslay_event_imsg_is_encoded ( ctx->imsg ) ) {
+                ctx->ipayloadoff += iocb.data_length;
+            } else if ( wslay_event_imsg_is_encoded ( ctx->imsg ) ) {
+                bool fin = ctx->imsg->fin && ctx->ipayloadoff + iocb.data_length == ctx->ipayloadlen;
+                wslay_frame_apply_mask ( ( uint8_t * ) iocb.data, iocb.data, iocb.data_length, mask, ctx->ipayloadoff );
+                if ( ( r = wslay_event_decode_payload ( ctx, ctx->extension_count, iocb.data, iocb.data_length, fin ) ) != 0 ) {
+                    if ( r < 0 ) {
+                        return r;
+                    }
+                    break;
                 }
-                for ( ; i < iocb.data_length; ++i ) {
-                    uint32_t codep;
-                    if ( decode ( &ctx->imsg->utf8state, &codep, iocb.data[i] ) == UTF8_REJECT ) {
+                ctx->ipayloadoff += iocb.data_length;
+            } else {
+                // Buffered payload is unmasked into the chunk, otherwise in place in the frame buffer.
+                uint8_t * dst = NULL;
+                if ( iocb.data_length > 0 && ctx->imsg->buffered ) {
+                    if ( wslay_event_imsg_reserve ( ctx->imsg, iocb.data_length, ctx->ipayloadlen - ctx->ipayloadoff ) != 0 ) {
+                        ctx->read_enabled = 0;
+                        return WSLAY_ERR_NOMEM;
+                    }
+                    struct wslay_event_byte_chunk * chunk = wslay_queue_tail ( &ctx->imsg->chunks );
+                    dst = chunk->data + chunk->data_length;
+                } else if ( mask != NULL ) {
+                    dst = ( uint8_t * ) iocb.data;
+                }
+                if ( ctx->imsg->validate ) {
+                    // The status code of close frame is not text, it can arrive in separate parts.
+                    size_t i = 0;
+                    if ( ctx->imsg->opcode == WSLAY_CONNECTION_CLOSE && ctx->ipayloadoff < 2 ) {
+                        i = 2 - ctx->ipayloadoff;
+                        if ( i > iocb.data_length ) {
+                            i = iocb.data_length;
+                        }
+                        if ( dst != NULL ) {
+                            wslay_frame_apply_mask ( dst, iocb.data, i, mask, ctx->ipayloadoff );
+                        }
+                    }
+                    uint32_t state;
+                    if ( dst != NULL ) {
+                        state = wslay_utf8_validate_copy ( &ctx->imsg->utf8state, dst + i, iocb.data + i, iocb.data_length - i, mask, ctx->ipayloadoff + i );
+                    } else {
+                        state = wslay_utf8_validate ( &ctx->imsg->utf8state, iocb.data + i, iocb.data_length - i );
+                    }
+                    if ( state == UTF8_REJECT ) {
                         if ( ( r = wslay_event_queue_close_wrapper ( ctx, WSLAY_CODE_INVALID_FRAME_PAYLOAD_DATA, NULL, 0 ) ) != 0 ) {
                             return r;
                         }
                         break;
                     }
+                } else if ( dst != NULL ) {
+                    wslay_frame_apply_mask ( dst, iocb.data, iocb.data_length, mask, ctx->ipayloadoff );
                 }
-            }
-            if ( ctx->imsg->utf8state == UTF8_REJECT ) {
-                break;
-            }
-            wslay_event_call_on_frame_recv_chunk_callback ( ctx, &iocb );
-            if ( iocb.data_length > 0 ) {
-                if ( !wslay_event_config_get_no_buffering ( ctx ) || wslay_is_ctrl_frame ( iocb.opcode ) ) {
-                    struct wslay_event_byte_chunk *chunk;
-                    chunk = wslay_queue_tail ( ctx->imsg->chunks );
-                    memcpy ( chunk->data + ctx->ipayloadoff, iocb.data, iocb.data_length );
+                if ( dst != NULL ) {
+                    iocb.data = dst;
+                }
+                if ( iocb.data_length > 0 && ctx->imsg->buffered ) {
+                    struct wslay_event_byte_chunk * chunk = wslay_queue_tail ( &ctx->imsg->chunks );
+                    chunk->data_length    += iocb.data_length;
+                    ctx->imsg->msg_length += iocb.data_length;
+                }
+                if ( !ctx->imsg->peeking ) {
+                    wslay_event_call_on_frame_recv_chunk_callback ( ctx, &iocb );
                 }
                 ctx->ipayloadoff += iocb.data_length;
             }
+            if ( ctx->imsg->peeking ) {
+                uint64_t received = ctx->imsg->msg_length;
+                if ( received >= ctx->peek_length || ( ctx->imsg->fin && ctx->ipayloadoff == ctx->ipayloadlen ) ) {
+                    wslay_event_peek_msg ( ctx, received );
+                }
+            }
             if ( ctx->ipayloadoff == ctx->ipayloadlen ) {
                 if (
-                    ctx->imsg->fin &&
-                    ( ctx->imsg->opcode == WSLAY_TEXT_FRAME || ctx->imsg->opcode == WSLAY_CONNECTION_CLOSE ) &&
-                    ctx->imsg->utf8state != UTF8_ACCEPT
+                    ctx->imsg->fin && ctx->imsg->validate && ctx->imsg->utf8state != UTF8_ACCEPT
                 ) {
                     if ( ( r = wslay_event_queue_close_wrapper ( ctx, WSLAY_CODE_INVALID_FRAME_PAYLOAD_DATA, NULL, 0 ) ) != 0 ) {
                         return r;
                     }
                     break;
                 }
-                wslay_event_call_on_frame_recv_end_callback ( ctx );
+                if ( !ctx->imsg->discard ) {
+                    wslay_event_call_on_frame_recv_end_callback ( ctx );
+                }
                 if ( ctx->imsg->fin ) {
-                    if ( ctx->callbacks.on_msg_recv_callback || ctx->imsg->opcode == WSLAY_CONNECTION_CLOSE || ctx->imsg->opcode == WSLAY_PING ) {
+                    if ( !ctx->imsg->discard &&
+                            ( ctx->callbacks.on_msg_recv_callback || ctx->imsg->opcode == WSLAY_CONNECTION_CLOSE || ctx->imsg->opcode == WSLAY_PING ) ) {
                         struct wslay_event_on_msg_recv_arg arg;
                         uint16_t status_code = 0;
                         uint8_t *msg = NULL;
                         size_t msg_length = 0;
-                        if ( !wslay_event_config_get_no_buffering ( ctx ) || wslay_is_ctrl_frame ( iocb.opcode ) ) {
-                            msg = wslay_event_flatten_queue ( ctx->imsg->chunks, ctx->imsg->msg_length );
-                            if ( ctx->imsg->msg_length && !msg ) {
-                                ctx->read_enabled = 0;
-                                return WSLAY_ERR_NOMEM;
-                            }
+                        if ( ctx->imsg->buffered ) {
+                            msg = wslay_event_imsg_data ( ctx->imsg );
                             msg_length = ctx->imsg->msg_length;
                         }
                         if ( ctx->imsg->opcode == WSLAY_CONNECTION_CLOSE ) {
@@ -426,7 +998,6 @@ int wslay_event_recv ( wslay_event_context * ctx )
                                 memcpy ( &status_code, msg, 2 );
                                 status_code = ntohs ( status_code );
                                 if ( !wslay_event_is_valid_status_code ( status_code ) ) {
-                                    talloc_free ( msg );
                                     if ( ( r = wslay_event_queue_close_wrapper ( ctx, WSLAY_CODE_PROTOCOL_ERROR, NULL, 0 ) ) != 0 ) {
                                         return r;
                                     }
@@ -445,7 +1016,6 @@ int wslay_event_recv ( wslay_event_context * ctx )
                                 ctx->status_code_recv = status_code;
                             }
                             if ( ( r = wslay_event_queue_close_wrapper ( ctx, status_code, reason, reason_length ) ) != 0 ) {
-                                talloc_free ( msg );
                                 return r;
                             }
                         } else if ( ctx->imsg->opcode == WSLAY_PING ) {
@@ -456,7 +1026,6 @@ int wslay_event_recv ( wslay_event_context * ctx )
                             if ( ( r = wslay_event_queue_msg ( ctx, &arg ) ) &&
                                     r != WSLAY_ERR_NO_MORE_MSG ) {
                                 ctx->read_enabled = 0;
-                                talloc_free ( msg );
                                 return r;
                             }
                         }
@@ -469,8 +1038,8 @@ int wslay_event_recv ( wslay_event_context * ctx )
                             ctx->error = 0;
                             ctx->callbacks.on_msg_recv_callback ( ctx, &arg, ctx->user_data );
                         }
-                        talloc_free ( msg );
                     }
+                    wslay_event_imsg_recycle_chunks ( ctx, ctx->imsg );
                     wslay_event_imsg_reset ( ctx->imsg );
                     if ( ctx->imsg == &ctx->imsgs[1] ) {
                         ctx->imsg = &ctx->imsgs[0];
@@ -479,6 +1048,10 @@ int wslay_event_recv ( wslay_event_context * ctx )
                 ctx->ipayloadlen = ctx->ipayloadoff = 0;
             }
         } else {
+            if ( result == WSLAY_ERR_NOMEM ) {
+                ctx->read_enabled = 0;
+                return WSLAY_ERR_NOMEM;
+            }
             if ( result != WSLAY_ERR_WANT_READ || ( ctx->error != WSLAY_ERR_WOULDBLOCK && ctx->error != 0 ) ) {
                 if ( ( r = wslay_event_queue_close_wrapper ( ctx, 0, NULL, 0 ) ) != 0 ) {
                     return r;
@@ -491,13 +1064,99 @@ int wslay_event_recv ( wslay_event_context * ctx )
     return 0;
 }
 
+int wslay_event_recv ( wslay_event_context * ctx )
+{
+    int r = wslay_event_recv_frames ( ctx );
+    // The scratch buffer is shared with other contexts, unconsumed bytes must not stay in it.
+    if ( wslay_frame_park_ibuf ( ctx->frame_ctx ) != 0 ) {
+        ctx->read_enabled = 0;
+        return WSLAY_ERR_NOMEM;
+    }
+    return r;
+}
+
 static void wslay_event_on_non_fragmented_msg_popped ( wslay_event_context * ctx )
 {
-    ctx->omsg->fin = 1;
-    ctx->opayloadlen = ctx->omsg->data_length;
+    size_t remaining = ctx->omsg->data_length - ctx->omsg->data_offset;
+    if (
+        ctx->max_send_frame_length == 0 ||
+        remaining <= ctx->max_send_frame_length ||
+        wslay_is_ctrl_frame ( ctx->omsg->opcode )
+    ) {
+        ctx->omsg->fin = 1;
+        ctx->opayloadlen = remaining;
+    } else {
+        ctx->omsg->fin = 0;
+        ctx->opayloadlen = ctx->max_send_frame_length;
+    }
     ctx->opayloadoff = 0;
 }
 
+// Drops ctx->omsg if its deadline passed before any of its bytes were sent.
+static bool wslay_event_drop_expired_omsg ( wslay_event_context * ctx )
+{
+    struct wslay_event_omsg * omsg = ctx->omsg;
+    if ( omsg->deadline == 0 || omsg->data_offset != 0 || wslay_event_get_time() < omsg->deadline ) {
+        return false;
+    }
+    ctx->omsg = NULL;
+    ctx->queued_msg_count --;
+    ctx->queued_msg_length -= omsg->data_length;
+    ctx->expired_msg_count ++;
+    if ( ctx->callbacks.on_msg_expired_callback ) {
+        wslay_event_msg arg;
+        arg.opcode     = omsg->opcode;
+        arg.msg        = omsg->data;
+        arg.msg_length = omsg->data_length;
+        ctx->callbacks.on_msg_expired_callback ( ctx, &arg, ctx->user_data );
+    }
+    wslay_event_omsg_free ( ctx, omsg );
+    return true;
+}
+
+// Encodes data message popped from send_queue by enabled extensions in the order of registration.
+static int wslay_event_encode_omsg ( wslay_event_context * ctx )
+{
+    struct wslay_event_omsg * omsg = ctx->omsg;
+    if (
+        ctx->extension_rsv == 0 || omsg->type != WSLAY_NON_FRAGMENTED || omsg->transformed ||
+        omsg->data_offset != 0 || omsg->data_length == 0 ||
+        ( omsg->opcode != WSLAY_TEXT_FRAME && omsg->opcode != WSLAY_BINARY_FRAME ) ||
+        // Broadcast payload was not reduced by compression with the same parameters.
+        ( omsg->broadcast != NULL && wslay_event_broadcast_is_deflatable ( ctx, omsg->broadcast ) )
+    ) {
+        return 0;
+    }
+    uint8_t i;
+    for ( i = 0; i < ctx->extension_count; ++i ) {
+        struct wslay_event_extension_slot * slot = &ctx->extensions[i];
+        if ( !slot->enabled || slot->extension->encode == NULL ) {
+            continue;
+        }
+        uint8_t * data;
+        size_t length;
+        int r = slot->extension->encode ( slot->data, omsg->opcode, omsg->data, omsg->data_length, ctx, &data, &length );
+        if ( r == 1 ) {
+            continue;
+        } else if ( r != 0 ) {
+            return r;
+        }
+        if ( omsg->broadcast != NULL ) {
+            wslay_event_broadcast_release ( omsg->broadcast );
+            omsg->broadcast = NULL;
+        } else if ( omsg->data != wslay_event_omsg_copy ( omsg ) ) {
+            talloc_free ( omsg->data );
+        }
+        ctx->queued_msg_length -= omsg->data_length;
+        ctx->queued_msg_length += length;
+        omsg->data        = data;
+        omsg->data_length = length;
+        omsg->rsv        |= slot->extension->rsv;
+        omsg->transformed = true;
+    }
+    return 0;
+}
+
 static struct wslay_event_omsg* wslay_event_send_ctrl_queue_pop ( wslay_event_context * ctx )
 {
     /*
@@ -505,34 +1164,96 @@ static struct wslay_event_omsg* wslay_event_send_ctrl_queue_pop ( wslay_event_co
      * other than Close.
      */
     if ( ctx->close_status & WSLAY_CLOSE_QUEUED ) {
-        while ( !wslay_queue_is_empty ( ctx->send_ctrl_queue ) ) {
-            struct wslay_event_omsg *msg = wslay_queue_top ( ctx->send_ctrl_queue );
-            wslay_queue_pop ( ctx->send_ctrl_queue );
+        while ( !wslay_queue_is_empty ( &ctx->send_ctrl_queue ) ) {
+            struct wslay_event_omsg *msg = wslay_queue_top ( &ctx->send_ctrl_queue );
+            wslay_queue_pop ( &ctx->send_ctrl_queue );
             if ( msg->opcode == WSLAY_CONNECTION_CLOSE ) {
                 return msg;
             } else {
-                talloc_free ( msg );
+                wslay_event_omsg_free ( ctx, msg );
             }
         }
         return NULL;
     } else {
-        struct wslay_event_omsg *msg = wslay_queue_top ( ctx->send_ctrl_queue );
-        wslay_queue_pop ( ctx->send_ctrl_queue );
+        struct wslay_event_omsg *msg = wslay_queue_top ( &ctx->send_ctrl_queue );
+        wslay_queue_pop ( &ctx->send_ctrl_queue );
         return msg;
     }
 }
 
+/*
+ * Reads data of fragmented message into obuf, which is allocated on first use.
+ * Returns 1 if the frame is ready to be sent, 0 if it should be held, or negative error code.
+ */
+static int wslay_event_fill_obuf ( wslay_event_context * ctx )
+{
+    if ( ctx->omsg->cancelled ) {
+        // Terminate the message by the empty final frame.
+        ctx->obufmark = ctx->obuflimit = ctx->obuf;
+        ctx->omsg->fin = 1;
+        return 1;
+    }
+    if ( ctx->obuf == NULL ) {
+        ctx->obuf = wslay_alloc ( ctx->allocator, ctx->obuf_length );
+        if ( ctx->obuf == NULL ) {
+            return WSLAY_ERR_NOMEM;
+        }
+        ctx->obufmark = ctx->obuflimit = ctx->obuf;
+    }
+    size_t min_length = ctx->ofragment_min_length;
+    if ( min_length > ctx->obuf_length ) {
+        min_length = ctx->obuf_length;
+    }
+    while ( ctx->omsg->fin == 0 && ctx->obuflimit != ctx->obuf + ctx->obuf_length ) {
+        int eof = 0;
+        ssize_t r = ctx->omsg->read_callback ( ctx, ctx->obuflimit, ctx->obuf + ctx->obuf_length - ctx->obuflimit,
+                                               &ctx->omsg->source,
+                                               &eof, ctx->user_data );
+        if ( r < 0 ) {
+            return WSLAY_ERR_CALLBACK_FAILURE;
+        }
+        if ( r > 0 && ctx->obuflimit == ctx->obuf && min_length != 0 ) {
+            ctx->obuftime = wslay_event_get_time();
+        }
+        ctx->obuflimit += r;
+        if ( eof ) {
+            ctx->omsg->fin = 1;
+        }
+        if ( r == 0 || ( size_t ) ( ctx->obuflimit - ctx->obuf ) >= min_length ) {
+            break;
+        }
+    }
+    if ( ctx->omsg->fin ) {
+        return 1;
+    }
+    size_t length = ctx->obuflimit - ctx->obuf;
+    if ( length == 0 ) {
+        return 0;
+    }
+    if ( length < min_length && ctx->obuflimit != ctx->obuf + ctx->obuf_length ) {
+        return wslay_event_get_time() - ctx->obuftime >= ctx->ofragment_max_delay;
+    }
+    return 1;
+}
+
 int wslay_event_send ( wslay_event_context * ctx )
 {
     struct wslay_frame_iocb iocb;
     ssize_t r;
     while ( ctx->write_enabled &&
-            ( !wslay_queue_is_empty ( ctx->send_queue ) ||
-              !wslay_queue_is_empty ( ctx->send_ctrl_queue ) || ctx->omsg ) ) {
+            ( !wslay_queue_is_empty ( &ctx->send_queue ) ||
+              !wslay_queue_is_empty ( &ctx->send_ctrl_queue ) || ctx->omsg ) ) {
         if ( !ctx->omsg ) {
-            if ( wslay_queue_is_empty ( ctx->send_ctrl_queue ) ) {
-                ctx->omsg = wslay_queue_top ( ctx->send_queue );
-                wslay_queue_pop ( ctx->send_queue );
+            if ( wslay_queue_is_empty ( &ctx->send_ctrl_queue ) ) {
+                ctx->omsg = wslay_queue_top ( &ctx->send_queue );
+                wslay_queue_pop ( &ctx->send_queue );
+                if ( wslay_event_drop_expired_omsg ( ctx ) ) {
+                    continue;
+                }
+                if ( ( r = wslay_event_encode_omsg ( ctx ) ) != 0 ) {
+                    ctx->write_enabled = 0;
+                    return r;
+                }
             } else {
                 ctx->omsg = wslay_event_send_ctrl_queue_pop ( ctx );
                 if ( ctx->omsg == NULL ) {
@@ -544,8 +1265,8 @@ int wslay_event_send ( wslay_event_context * ctx )
             }
         } else if ( !wslay_is_ctrl_frame ( ctx->omsg->opcode ) &&
                     ctx->frame_ctx->ostate == PREP_HEADER &&
-                    !wslay_queue_is_empty ( ctx->send_ctrl_queue ) ) {
-            if ( ( r = wslay_queue_push_front ( ctx->send_queue, ctx->omsg ) ) != 0 ) {
+                    !wslay_queue_is_empty ( &ctx->send_ctrl_queue ) ) {
+            if ( ( r = wslay_queue_push_front ( &ctx->send_queue, ctx->omsg ) ) != 0 ) {
                 ctx->write_enabled = 0;
                 return r;
             }
@@ -558,17 +1279,28 @@ int wslay_event_send ( wslay_event_context * ctx )
         }
         if ( ctx->omsg->type == WSLAY_NON_FRAGMENTED ) {
             memset ( &iocb, 0, sizeof ( iocb ) );
-            iocb.fin = 1;
+            iocb.fin = ctx->omsg->fin;
+            iocb.rsv = ctx->omsg->rsv;
             iocb.opcode = ctx->omsg->opcode;
             iocb.mask = !ctx->server;
-            iocb.data = ctx->omsg->data + ctx->opayloadoff;
+            iocb.data = ctx->omsg->data + ctx->omsg->data_offset + ctx->opayloadoff;
             iocb.data_length = ctx->opayloadlen - ctx->opayloadoff;
             iocb.payload_length = ctx->opayloadlen;
             size_t length;
             int16_t result = wslay_frame_send ( ctx->frame_ctx, &iocb, &length );
             if ( result == 0 ) {
                 ctx->opayloadoff += length;
-                if ( ctx->opayloadoff == ctx->opayloadlen ) {
+                if ( ctx->opayloadoff == ctx->opayloadlen && !ctx->omsg->fin ) {
+                    // Next frame of the split message, control frames may be sent before it.
+                    ctx->omsg->data_offset += ctx->opayloadlen;
+                    if ( ctx->omsg->cancelled ) {
+                        // Skip the rest of payload, the message is terminated by the empty final frame.
+                        ctx->omsg->data_offset = ctx->omsg->data_length;
+                    }
+                    ctx->omsg->opcode = WSLAY_CONTINUATION_FRAME;
+                    ctx->omsg->rsv = 0;
+                    wslay_event_on_non_fragmented_msg_popped ( ctx );
+                } else if ( ctx->opayloadoff == ctx->opayloadlen ) {
                     ctx->queued_msg_count --;
                     ctx->queued_msg_length -= ctx->omsg->data_length;
                     if ( ctx->omsg->opcode == WSLAY_CONNECTION_CLOSE ) {
@@ -582,7 +1314,7 @@ int wslay_event_send ( wslay_event_context * ctx )
                         ctx->status_code_sent =
                             status_code == 0 ? WSLAY_CODE_NO_STATUS_RCVD : status_code;
                     }
-                    talloc_free ( ctx->omsg );
+                    wslay_event_omsg_free ( ctx, ctx->omsg );
                     ctx->omsg = NULL;
                 } else {
                     break;
@@ -595,22 +1327,15 @@ int wslay_event_send ( wslay_event_context * ctx )
                 break;
             }
         } else {
-            if ( ctx->omsg->fin == 0 && ctx->obuflimit == ctx->obufmark ) {
-                int eof = 0;
-                r = ctx->omsg->read_callback ( ctx, ctx->obuf, sizeof ( ctx->obuf ),
-                                               &ctx->omsg->source,
-                                               &eof, ctx->user_data );
-                if ( r == 0 ) {
-                    break;
-                } else if ( r < 0 ) {
+            if ( ctx->omsg->fin == 0 && ctx->frame_ctx->ostate == PREP_HEADER ) {
+                r = wslay_event_fill_obuf ( ctx );
+                if ( r < 0 ) {
                     ctx->write_enabled = 0;
-                    return WSLAY_ERR_CALLBACK_FAILURE;
-                }
-                ctx->obuflimit = ctx->obuf + r;
-                if ( eof ) {
-                    ctx->omsg->fin = 1;
+                    return r;
+                } else if ( r == 0 ) {
+                    break;
                 }
-                ctx->opayloadlen = r;
+                ctx->opayloadlen = ctx->obuflimit - ctx->obuf;
                 ctx->opayloadoff = 0;
             }
             memset ( &iocb, 0, sizeof ( iocb ) );
@@ -627,8 +1352,9 @@ int wslay_event_send ( wslay_event_context * ctx )
                 if ( ctx->obufmark == ctx->obuflimit ) {
                     ctx->obufmark = ctx->obuflimit = ctx->obuf;
                     if ( ctx->omsg->fin ) {
+                        wslay_event_release_obuf ( ctx );
                         ctx->queued_msg_count --;
-                        talloc_free ( ctx->omsg );
+                        wslay_event_omsg_free ( ctx, ctx->omsg );
                         ctx->omsg = NULL;
                     } else {
                         ctx->omsg->opcode = WSLAY_CONTINUATION_FRAME;
@@ -661,8 +1387,27 @@ int wslay_event_want_read ( wslay_event_context * ctx )
 int wslay_event_want_write ( wslay_event_context * ctx )
 {
     return ctx->write_enabled &&
-           ( !wslay_queue_is_empty ( ctx->send_queue ) ||
-             !wslay_queue_is_empty ( ctx->send_ctrl_queue ) || ctx->omsg );
+           ( !wslay_queue_is_empty ( &ctx->send_queue ) ||
+             !wslay_queue_is_empty ( &ctx->send_ctrl_queue ) || ctx->omsg );
+}
+
+uint32_t wslay_event_get_send_delay ( wslay_event_context * ctx )
+{
+    struct wslay_event_omsg * omsg = ctx->omsg;
+    size_t min_length = ctx->ofragment_min_length;
+    if ( min_length > ctx->obuf_length ) {
+        min_length = ctx->obuf_length;
+    }
+    // Same condition as wslay_event_fill_obuf() holding the data, a control frame is sent without delay.
+    if (
+        !ctx->write_enabled || omsg == NULL || omsg->type != WSLAY_FRAGMENTED || omsg->fin ||
+        ctx->frame_ctx->ostate != PREP_HEADER || !wslay_queue_is_empty ( &ctx->send_ctrl_queue ) ||
+        ctx->obuflimit == ctx->obuf || ( size_t ) ( ctx->obuflimit - ctx->obuf ) >= min_length
+    ) {
+        return 0;
+    }
+    uint64_t elapsed = wslay_event_get_time() - ctx->obuftime;
+    return elapsed >= ctx->ofragment_max_delay ? 0 : ctx->ofragment_max_delay - elapsed;
 }
 
 void wslay_event_shutdown_read ( wslay_event_context * ctx )
@@ -704,12 +1449,137 @@ void wslay_event_config_set_no_buffering ( wslay_event_context * ctx, int val )
     }
 }
 
+int wslay_event_config_set_msg_peek ( wslay_event_context * ctx, size_t length )
+{
+    uint8_t * peek_buf = NULL;
+    if ( length > 0 ) {
+        peek_buf = wslay_alloc ( ctx->allocator, length );
+        if ( peek_buf == NULL ) {
+            return WSLAY_ERR_NOMEM;
+        }
+    }
+    if ( ctx->peek_buf != NULL ) {
+        wslay_free ( ctx->allocator, ctx->peek_buf, ctx->peek_length );
+    }
+    ctx->peek_buf    = peek_buf;
+    ctx->peek_length = length;
+    return 0;
+}
+
+void wslay_event_config_set_text_validation ( wslay_event_context * ctx, uint32_t interval )
+{
+    ctx->text_validation_interval = interval;
+}
+
 void wslay_event_config_set_max_recv_msg_length ( wslay_event_context * ctx,
         uint64_t val )
 {
     ctx->max_recv_msg_length = val;
 }
 
+void wslay_event_config_set_recv_prealloc_length ( wslay_event_context * ctx, size_t val )
+{
+    ctx->recv_prealloc_length = val;
+}
+
+void wslay_event_config_set_recv_buffer_high_water ( wslay_event_context * ctx, size_t val )
+{
+    ctx->recv_buffer_high_water = val;
+}
+
+void wslay_event_config_set_recv_buffer_idle_timeout ( wslay_event_context * ctx, uint64_t val )
+{
+    ctx->recv_buffer_idle_timeout = val;
+}
+
+int wslay_event_config_set_recv_scratch_buffer ( wslay_event_context * ctx, uint8_t * buf, size_t length )
+{
+    return wslay_frame_set_scratch_buffer ( ctx->frame_ctx, buf, length );
+}
+
+int wslay_event_config_set_allocator ( wslay_event_context * ctx, const wslay_allocator * allocator )
+{
+    wslay_frame_context * frame_ctx = ctx->frame_ctx;
+    uint8_t i;
+    for ( i = 0; i < 2; i ++ ) {
+        if ( ctx->imsgs[i].spare != NULL || !wslay_queue_is_empty ( &ctx->imsgs[i].chunks ) ) {
+            return WSLAY_ERR_INVALID_ARGUMENT;
+        }
+    }
+    if ( ctx->omsg != NULL || ctx->obuf != NULL || ctx->peek_buf != NULL ||
+         !wslay_queue_is_empty ( &ctx->send_queue ) || !wslay_queue_is_empty ( &ctx->send_ctrl_queue ) ||
+         ( frame_ctx->ibuf != NULL && frame_ctx->ibuf != frame_ctx->iscratch ) ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    if ( allocator == NULL ) {
+        allocator = wslay_get_default_allocator();
+    }
+    ctx->allocator = allocator;
+    ctx->send_queue.allocator      = allocator;
+    ctx->send_ctrl_queue.allocator = allocator;
+    for ( i = 0; i < 2; i ++ ) {
+        ctx->imsgs[i].chunks.allocator = allocator;
+    }
+    frame_ctx->allocator = allocator;
+    return 0;
+}
+
+int wslay_event_config_set_arena ( wslay_event_context * ctx, size_t block_length )
+{
+    if ( ctx->arena != NULL ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    wslay_arena * arena = wslay_arena_new ( ctx->allocator, block_length );
+    if ( arena == NULL ) {
+        return WSLAY_ERR_NOMEM;
+    }
+    int r = wslay_event_config_set_allocator ( ctx, &arena->allocator );
+    if ( r != 0 ) {
+        wslay_arena_free ( arena );
+        return r;
+    }
+    ctx->arena = arena;
+    return 0;
+}
+
+void wslay_event_config_set_max_send_frame_length ( wslay_event_context * ctx, size_t val )
+{
+    ctx->max_send_frame_length = val;
+}
+
+int wslay_event_config_set_fragment_buffer_length ( wslay_event_context * ctx, size_t val )
+{
+    // Fragmented message pushed back to send_queue by a control frame can still hold data in obuf.
+    if ( val == 0 || ( ctx->omsg != NULL && ctx->omsg->type == WSLAY_FRAGMENTED ) || ctx->obufmark != ctx->obuflimit ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    wslay_event_release_obuf ( ctx );
+    ctx->obuf_length = val;
+    return 0;
+}
+
+int wslay_event_config_set_deflate ( wslay_event_context * ctx, const struct wslay_deflate_params * params, wslay_deflate_pool * pool )
+{
+    if ( wslay_event_get_extension_data ( ctx, &wslay_deflate_extension ) != NULL || wslay_deflate_check_params ( params, ctx->server ) != 0 ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    wslay_deflate_context * deflate_ctx = wslay_deflate_context_new ( ctx, params, ctx->server, pool );
+    if ( deflate_ctx == NULL ) {
+        return WSLAY_ERR_NOMEM;
+    }
+    int r = wslay_event_config_enable_extension ( ctx, &wslay_deflate_extension, deflate_ctx );
+    if ( r != 0 ) {
+        talloc_free ( deflate_ctx );
+    }
+    return r;
+}
+
+void wslay_event_config_set_fragment_coalescing ( wslay_event_context * ctx, size_t min_length, uint32_t max_delay )
+{
+    ctx->ofragment_min_length = min_length;
+    ctx->ofragment_max_delay  = max_delay;
+}
+
 uint16_t wslay_event_get_status_code_received ( wslay_event_context * ctx )
 {
     return ctx->status_code_recv;
@@ -730,3 +1600,53 @@ size_t wslay_event_get_queued_msg_length ( wslay_event_context * ctx )
     return ctx->queued_msg_length;
 }
 
+size_t wslay_event_get_expired_msg_count ( wslay_event_context * ctx )
+{
+    return ctx->expired_msg_count;
+}
+
+int wslay_event_discard_msg ( wslay_event_context * ctx )
+{
+    struct wslay_event_imsg * imsg = ctx->imsg;
+    if ( imsg->opcode != WSLAY_TEXT_FRAME && imsg->opcode != WSLAY_BINARY_FRAME ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    imsg->discard  = true;
+    imsg->validate = false;
+    imsg->peeking  = false;
+    wslay_event_imsg_recycle_chunks ( ctx, imsg );
+    return 0;
+}
+
+void wslay_event_shrink_recv_buffers ( wslay_event_context * ctx )
+{
+    if ( ctx->recv_buffer_idle_timeout == 0 ) {
+        return;
+    }
+    uint64_t now = 0;
+    uint8_t i;
+    for ( i = 0; i < 2; i ++ ) {
+        struct wslay_event_imsg * imsg = &ctx->imsgs[i];
+        if ( imsg->spare == NULL ) {
+            continue;
+        }
+        if ( now == 0 ) {
+            now = wslay_event_get_time();
+        }
+        if ( now - imsg->spare_time >= ctx->recv_buffer_idle_timeout ) {
+            talloc_free ( imsg->spare );
+            imsg->spare = NULL;
+        }
+    }
+}
+
+uint64_t wslay_event_get_validated_text_msg_count ( wslay_event_context * ctx )
+{
+    return ctx->validated_text_msg_count;
+}
+
+uint64_t wslay_event_get_trusted_text_msg_count ( wslay_event_context * ctx )
+{
+    return ctx->trusted_text_msg_count;
+}
+
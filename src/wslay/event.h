@@ -27,23 +27,47 @@
 
 #include "wslay.h"
 #include "frame.h"
+#include "allocator.h"
+#include "arena.h"
 #include "queue.h"
 #include "utf8.h"
+#include "extension.h"
+#include "deflate.h"
 
 #include <stdbool.h>
 
 struct wslay_event_byte_chunk {
     uint8_t * data;
+    // the number of bytes received into data
     size_t data_length;
+    // the number of bytes allocated for data
+    size_t capacity;
+    // allocator of data
+    const wslay_allocator * allocator;
 };
 
 struct wslay_event_imsg {
     uint8_t fin;
     uint8_t rsv;
     uint8_t opcode;
+    // payload is validated as UTF-8: close messages and sampled text messages
+    bool validate;
+    // the rest of the message is skipped, see wslay_event_discard_msg()
+    bool discard;
+    // payload is buffered for wslay_event_on_msg_recv_callback, otherwise only delivered by chunk callback
+    bool buffered;
+    // the first bytes are buffered until wslay_event_on_msg_peek_callback decides how to receive the rest
+    bool peeking;
     uint32_t utf8state;
-    wslay_queue * chunks;
+    // payload of the message being received, gathered in a single chunk
+    wslay_queue chunks;
+    // chunk kept from the previous message for reuse, NULL if none
+    struct wslay_event_byte_chunk * spare;
+    // time in milliseconds when spare was released, see wslay_event_shrink_recv_buffers()
+    uint64_t spare_time;
     size_t msg_length;
+    // length of decoded payload of the message encoded by extensions
+    uint64_t decoded_length;
 };
 
 enum wslay_event_msg_type {
@@ -61,6 +85,13 @@ enum wslay_event_config {
     WSLAY_CONFIG_NO_BUFFERING = 1
 };
 
+// Default length of the buffer used for fragmented messages.
+#define WSLAY_EVENT_OBUF_LENGTH 4096
+// the default number of bytes allocated upfront for payload of received frame
+#define WSLAY_EVENT_RECV_PREALLOC_LENGTH 4096
+// the default capacity above which receive buffer is released rather than kept for the next message
+#define WSLAY_EVENT_RECV_HIGH_WATER 65536
+
 struct wslay_event_on_msg_recv_arg {
     // reserved bits: rsv = (RSV1 << 2) | (RSV2 << 1) | RSV3
     uint8_t rsv;
@@ -94,6 +125,33 @@ struct wslay_event_frame_user_data {
 // Callback function invoked by wslay_event_recv() when a message is completely received.
 typedef void ( * wslay_event_on_msg_recv_callback ) ( struct wslay_event_context_t * ctx, const struct wslay_event_on_msg_recv_arg * arg, void * user_data );
 
+enum wslay_event_peek_action {
+    // the message is buffered and delivered by wslay_event_on_msg_recv_callback
+    WSLAY_PEEK_BUFFER = 0,
+    // the payload is delivered by wslay_event_on_frame_recv_chunk_callback, starting with the buffered bytes,
+    // and wslay_event_on_msg_recv_callback is invoked with msg_length 0
+    WSLAY_PEEK_STREAM,
+    // the rest of the message is discarded as by wslay_event_discard_msg()
+    WSLAY_PEEK_DISCARD
+};
+
+struct wslay_event_on_msg_peek_arg {
+    // reserved bits of the first frame: rsv = (RSV1 << 2) | (RSV2 << 1) | RSV3
+    uint8_t rsv;
+    // opcode of the message
+    uint8_t opcode;
+    // the first bytes of (decoded) payload
+    const uint8_t * data;
+    // peek length set by wslay_event_config_set_msg_peek(), or less if the message is shorter
+    size_t data_length;
+    // 1 if data is the whole message, otherwise 0
+    uint8_t fin;
+};
+
+// Callback function invoked by wslay_event_recv() when the first bytes of text or binary message are received.
+// Returns enum wslay_event_peek_action value.
+typedef int ( * wslay_event_on_msg_peek_callback ) ( struct wslay_event_context_t * ctx, const struct wslay_event_on_msg_peek_arg * arg, void * user_data );
+
 // Callback function invoked by wslay_event_recv() when a new frame starts to be received.
 // This callback function is only invoked once for each frame.
 typedef void ( *wslay_event_on_frame_recv_start_callback ) ( struct wslay_event_context_t * ctx, const struct wslay_event_on_frame_recv_start_arg * arg, void * user_data );
@@ -111,6 +169,12 @@ typedef void ( * wslay_event_on_frame_recv_chunk_callback ) ( struct wslay_event
 // Callback function invoked by wslay_event_recv() when a frame is completely received.
 typedef void ( * wslay_event_on_frame_recv_end_callback ) ( struct wslay_event_context_t * ctx, void * user_data );
 
+struct wslay_event_msg_t;
+
+// Callback function invoked by wslay_event_send() when a message queued by wslay_event_queue_expiring_msg()
+// is dropped because its time to live elapsed before it was sent.
+typedef void ( * wslay_event_on_msg_expired_callback ) ( struct wslay_event_context_t * ctx, const struct wslay_event_msg_t * arg, void * user_data );
+
 /*
  * Callback function invoked by wslay_event_recv() when it wants to receive more data from peer.
  * The implementation of this callback function must read data at most len bytes from peer
@@ -154,21 +218,16 @@ struct wslay_event_callbacks {
     wslay_event_on_frame_recv_chunk_callback on_frame_recv_chunk_callback;
     wslay_event_on_frame_recv_end_callback on_frame_recv_end_callback;
     wslay_event_on_msg_recv_callback on_msg_recv_callback;
+    wslay_event_on_msg_expired_callback on_msg_expired_callback;
+    wslay_event_on_msg_peek_callback on_msg_peek_callback;
 };
 
 typedef struct wslay_event_context_t {
-    // config status, bitwise OR of enum wslay_event_config values
-    uint32_t config;
-    // maximum message length that can be received
-    uint64_t max_recv_msg_length;
-    bool server;
-    // bitwise OR of enum wslay_event_close_status values
-    uint8_t close_status;
-    // status code in received close control frame
-    uint16_t status_code_recv;
-    // status code in sent close control frame
-    uint16_t status_code_sent;
-    wslay_frame_context * frame_ctx;
+    /*
+     * Hot header: the fields read for every context by wslay_event_want_read(), wslay_event_want_write()
+     * and on entry of wslay_event_recv() and wslay_event_send(), kept in the first 64 bytes,
+     * so an event loop sweeping many idle contexts touches one or two cache lines of each.
+     */
     // 1 if reading is enabled, otherwise 0.
     // Upon receiving close control frame this value set to 0.
     // If any errors in read operation will also set this value to 0. */
@@ -176,8 +235,19 @@ typedef struct wslay_event_context_t {
     // 1 if writing is enabled, otherwise 0 Upon completing sending close control frame, this value set to 0.
     // If any errors in write opration will also set this value to 0.
     uint8_t write_enabled;
-    // imsg buffer to allow interleaved control frame between non-control frames.
-    struct wslay_event_imsg imsgs[2];
+    // bitwise OR of enum wslay_event_close_status values
+    uint8_t close_status;
+    bool server;
+    // config status, bitwise OR of enum wslay_event_config values
+    uint32_t config;
+    // Pointer to the message currently being sent. NULL if no message is currently sent.
+    struct wslay_event_omsg * omsg;
+    // Queue for non-control frames
+    wslay_queue send_queue;
+    // Queue for control frames
+    wslay_queue send_ctrl_queue;
+    // State of the frames and messages being received and sent.
+    wslay_frame_context * frame_ctx;
     // Pointer to imsgs to indicate current used buffer.
     struct wslay_event_imsg * imsg;
     // payload length of frame currently being received.
@@ -186,27 +256,67 @@ typedef struct wslay_event_context_t {
     uint64_t ipayloadoff;
     // error value set by user callback
     int error;
-    // Pointer to the message currently being sent. NULL if no message is currently sent.
-    struct wslay_event_omsg * omsg;
-    // Queue for non-control frames
-    wslay_queue * send_queue;
-    // Queue for control frames
-    wslay_queue * send_ctrl_queue;
     // Size of send_queue + size of send_ctrl_queue
     size_t queued_msg_count;
     // The sum of message length in send_queue
     size_t queued_msg_length;
-    // Buffer used for fragmented messages
-    uint8_t obuf[4096];
-    uint8_t * obuflimit;
-    uint8_t * obufmark;
+    // Identifier of the last queued message
+    uint64_t last_msg_id;
     // payload length of frame currently being sent.
     uint64_t opayloadlen;
     // next byte offset of payload currently being sent.
     uint64_t opayloadoff;
+    // Buffer used for fragmented messages
+    uint8_t * obuf;
+    size_t obuf_length;
+    uint8_t * obuflimit;
+    uint8_t * obufmark;
+    // Monotonic time in milliseconds when the first byte was stored in obuf
+    uint64_t obuftime;
+    // RSV bits of enabled extensions
+    uint8_t extension_rsv;
+    // allocator of buffers, queue cells and queued messages, see wslay_event_config_set_allocator()
+    const wslay_allocator * allocator;
     struct wslay_event_callbacks callbacks;
     struct wslay_event_frame_user_data frame_user_data;
     void * user_data;
+    // imsg buffer to allow interleaved control frame between non-control frames.
+    struct wslay_event_imsg imsgs[2];
+    // Cold data: configuration, extensions, close status codes and statistics.
+    // maximum message length that can be received
+    uint64_t max_recv_msg_length;
+    // maximum payload length of a single frame being sent, 0 for unlimited
+    size_t max_send_frame_length;
+    // maximum number of bytes allocated for payload of received frame before it arrives
+    size_t recv_prealloc_length;
+    // receive buffer with larger capacity is released when the message is received
+    size_t recv_buffer_high_water;
+    // milliseconds after which unused receive buffer is released by wslay_event_shrink_recv_buffers(), 0 for never
+    uint64_t recv_buffer_idle_timeout;
+    // every n-th received text message is validated as UTF-8, 0 for none
+    uint32_t text_validation_interval;
+    // the number of first bytes of data messages passed to on_msg_peek_callback, 0 if disabled
+    size_t peek_length;
+    // the first bytes copied from chunks for on_msg_peek_callback
+    uint8_t * peek_buf;
+    // Short reads of fragmented message are coalesced until this length, 0 for no coalescing
+    size_t ofragment_min_length;
+    // Maximum time in milliseconds to hold coalesced data before it is sent
+    uint32_t ofragment_max_delay;
+    // arena owned by the context, NULL if wslay_event_config_set_arena() was not called
+    wslay_arena * arena;
+    // extensions in the order of registration
+    struct wslay_event_extension_slot extensions[WSLAY_EVENT_MAX_EXTENSIONS];
+    uint8_t extension_count;
+    // status code in received close control frame
+    uint16_t status_code_recv;
+    // status code in sent close control frame
+    uint16_t status_code_sent;
+    // The number of messages dropped from send_queue because of expired time to live
+    size_t expired_msg_count;
+    // The number of received text messages validated as UTF-8 and accepted without validation
+    uint64_t validated_text_msg_count;
+    uint64_t trusted_text_msg_count;
 } wslay_event_context;
 
 /*
@@ -220,6 +330,34 @@ typedef struct wslay_event_context_t {
  */
 void wslay_event_config_set_no_buffering ( wslay_event_context * ctx, int val );
 
+/*
+ * Enables peeking at the first length bytes of received text and binary messages.
+ * The first bytes are buffered until length bytes are received or the message ends,
+ * then wslay_event_on_msg_peek_callback is invoked with them and returns how the rest of the message is received:
+ * buffered, streamed by wslay_event_on_frame_recv_chunk_callback or discarded, see enum wslay_event_peek_action.
+ * Chunk callbacks are held back until the decision, then the buffered bytes are delivered unless discarded.
+ * The decision overrides wslay_event_config_set_no_buffering() for the message.
+ *
+ * If length is 0, peeking is disabled, the callback must be set to enable it.
+ *
+ * wslay_event_config_set_msg_peek() returns 0 if it succeeds, or WSLAY_ERR_NOMEM if out of memory.
+ */
+int wslay_event_config_set_msg_peek ( wslay_event_context * ctx, size_t length );
+
+/*
+ * Sets which received text messages are validated as UTF-8.
+ * If interval is 1, every text message is validated as RFC 6455 requires.
+ * If interval is n > 1, only the first of every n text messages is validated, others are delivered as they are.
+ * If interval is 0, text messages are not validated, it is only suitable for trusted peers which validate text themselves.
+ * The reason of close control frames is always validated.
+ *
+ * The numbers of validated and trusted messages are returned by wslay_event_get_validated_text_msg_count()
+ * and wslay_event_get_trusted_text_msg_count().
+ *
+ * The default value is 1.
+ */
+void wslay_event_config_set_text_validation ( wslay_event_context * ctx, uint32_t interval );
+
 /*
  * Sets maximum length of a message that can be received.
  * The length of message is checked by wslay_event_recv() function.
@@ -230,6 +368,162 @@ void wslay_event_config_set_no_buffering ( wslay_event_context * ctx, int val );
  */
 void wslay_event_config_set_max_recv_msg_length ( wslay_event_context * ctx, uint64_t val );
 
+/*
+ * Sets the number of bytes allocated for payload of received frame when the frame starts.
+ * The buffer of longer frame grows geometrically as payload arrives, so memory tracks the received bytes
+ * rather than the payload length announced by the peer. SIZE_MAX allocates the whole payload upfront.
+ *
+ * The default value is WSLAY_EVENT_RECV_PREALLOC_LENGTH.
+ */
+void wslay_event_config_set_recv_prealloc_length ( wslay_event_context * ctx, size_t val );
+
+/*
+ * Makes ctx read into buf of length bytes, which can be shared by all contexts used by one thread,
+ * instead of input buffer allocated for each context.
+ * When wslay_event_recv() returns, a partial frame header is kept in a small area inside the context,
+ * so input buffer memory scales with threads rather than connections.
+ * buf must not be used by another context until wslay_event_recv() returns, so callbacks must not
+ * receive on other contexts sharing it. If buf is NULL, ctx uses its own input buffer again.
+ *
+ * wslay_event_config_set_recv_scratch_buffer() returns 0 if it succeeds, or WSLAY_ERR_INVALID_ARGUMENT
+ * if length is less than WSLAY_FRAME_IBUF_LENGTH or received bytes are waiting to be processed.
+ */
+int wslay_event_config_set_recv_scratch_buffer ( wslay_event_context * ctx, uint8_t * buf, size_t length );
+
+/*
+ * Makes ctx allocate its receive and send buffers and queue cells by allocator instead of
+ * the one set by wslay_set_default_allocator() when ctx was created. If allocator is NULL, the default one is used.
+ * allocator must stay valid until ctx is freed.
+ *
+ * wslay_event_config_set_allocator() returns 0 if it succeeds, or WSLAY_ERR_INVALID_ARGUMENT
+ * if ctx already holds memory of the previous allocator: queued or received messages, buffers kept for reuse
+ * or received bytes, so it should be called right after the context is created or reset.
+ */
+int wslay_event_config_set_allocator ( wslay_event_context * ctx, const wslay_allocator * allocator );
+
+/*
+ * Makes ctx allocate queued messages, receive buffers and queue cells from its own arena with blocks of block_length bytes,
+ * 0 for WSLAY_ARENA_BLOCK_LENGTH. The blocks are requested from the allocator ctx used so far,
+ * and released when all messages allocated from them are sent or received, so steady traffic makes almost no calls to it.
+ * The arena is kept by wslay_event_context_reset() and freed with ctx.
+ *
+ * wslay_event_config_set_arena() returns 0 if it succeeds, WSLAY_ERR_NOMEM if out of memory,
+ * or WSLAY_ERR_INVALID_ARGUMENT if ctx already has an arena or wslay_event_config_set_allocator() would fail.
+ */
+int wslay_event_config_set_arena ( wslay_event_context * ctx, size_t block_length );
+
+/*
+ * Sets the high-water mark of receive buffer.
+ * The buffer which holds received message is kept for the next message, so steady receiving does not allocate.
+ * If its capacity grew above val, it is released instead.
+ *
+ * The default value is WSLAY_EVENT_RECV_HIGH_WATER.
+ */
+void wslay_event_config_set_recv_buffer_high_water ( wslay_event_context * ctx, size_t val );
+
+/*
+ * Sets the number of milliseconds after which receive buffer kept for the next message
+ * is released by wslay_event_shrink_recv_buffers().
+ *
+ * The default value is 0, which means that the buffer is kept until the context is freed.
+ */
+void wslay_event_config_set_recv_buffer_idle_timeout ( wslay_event_context * ctx, uint64_t val );
+
+/*
+ * Sets maximum payload length of a single frame sent by wslay_event_send().
+ * Non-control messages queued using wslay_event_queue_msg() which are longer than this value
+ * are split into a starting frame followed by continuation frames of at most val bytes.
+ * Control frames can be sent between these frames, so val bounds the latency of ping, pong and close frames.
+ * Control messages are never split.
+ *
+ * The default value is 0, which means that messages are sent without fragmentation.
+ */
+void wslay_event_config_set_max_send_frame_length ( wslay_event_context * ctx, size_t val );
+
+/*
+ * Sets length of the buffer used to read data of messages queued by wslay_event_queue_fragmented_msg().
+ * It is the maximum payload length of a frame of such messages.
+ * The buffer is allocated when such message starts to be sent and freed when it is sent.
+ *
+ * The default value is WSLAY_EVENT_OBUF_LENGTH.
+ *
+ * wslay_event_config_set_fragment_buffer_length() returns 0 if it succeeds, or returns the following negative error codes:
+ *
+ * WSLAY_ERR_INVALID_ARGUMENT
+ *   val is 0, fragmented message is being sent or a queued one holds data read into the buffer.
+ */
+int wslay_event_config_set_fragment_buffer_length ( wslay_event_context * ctx, size_t val );
+
+/*
+ * Enables coalescing of data read by wslay_event_fragmented_msg_callback.
+ * wslay_event_send() calls this callback until at least min_length bytes are buffered
+ * (or the buffer is full, or end of message is reached) before the frame is sent.
+ * If the callback returns 0 earlier, the buffered data is held until max_delay milliseconds
+ * elapsed since its first byte was read. wslay_event_want_write() keeps returning 1 in the meantime,
+ * so the application should call wslay_event_send() again within max_delay,
+ * wslay_event_get_send_delay() returns the time left.
+ *
+ * If min_length is 0, coalescing is disabled and each result of the callback is sent as a separate frame.
+ * This is the default.
+ */
+void wslay_event_config_set_fragment_coalescing ( wslay_event_context * ctx, size_t min_length, uint32_t max_delay );
+
+/*
+ * Enables permessage-deflate extension with params negotiated in the opening handshake.
+ * See wslay_deflate_parse_params() and wslay_deflate_format_params() to negotiate them,
+ * or register wslay_deflate_extension by wslay_event_config_add_extension() to negotiate it with other extensions.
+ *
+ * Received messages with RSV1 bit are decompressed as they arrive.
+ * wslay_event_on_frame_recv_chunk_callback receives decompressed data for them,
+ * so it also works when buffering is disabled.
+ * The length of decompressed message is checked against the value set by wslay_event_config_set_max_recv_msg_length().
+ *
+ * Non-control messages queued by wslay_event_queue_msg() and its variants are compressed when wslay_event_send() starts sending them.
+ * Messages queued by wslay_event_queue_fragmented_msg() are sent uncompressed.
+ *
+ * zlib streams are allocated on the first message through pool, see wslay_deflate_pool_new().
+ * Sides which negotiated no_context_takeover borrow their streams from the pool for each message,
+ * so idle connections keep no zlib state. If the memory limit of the pool is reached, messages are sent uncompressed.
+ * pool can be NULL, then the streams are allocated by ctx and kept.
+ *
+ * This function must not be used after the first invocation of wslay_event_recv() or wslay_event_send() function.
+ *
+ * wslay_event_config_set_deflate() returns 0 if it succeeds, or returns the following negative error codes:
+ *
+ * WSLAY_ERR_INVALID_ARGUMENT
+ *   params can not be used by this endpoint, the extension is already enabled or RSV1 bit is used by another extension.
+ *
+ * WSLAY_ERR_NOMEM
+ *   Out of memory.
+ */
+int wslay_event_config_set_deflate ( wslay_event_context * ctx, const struct wslay_deflate_params * params, wslay_deflate_pool * pool );
+
+/*
+ * Registers extension to be negotiated by wslay_event_extensions_offer(), wslay_event_extensions_accept()
+ * or wslay_event_extensions_confirm(). user_data is passed to its negotiation callbacks.
+ * See wslay_event_extension for the order of extensions.
+ *
+ * This function must not be used after the first invocation of wslay_event_recv() or wslay_event_send() function.
+ *
+ * wslay_event_config_add_extension() returns 0 if it succeeds, or WSLAY_ERR_INVALID_ARGUMENT
+ * if the extension is already registered, its RSV bits are invalid or there are WSLAY_EVENT_MAX_EXTENSIONS extensions.
+ */
+int wslay_event_config_add_extension ( wslay_event_context * ctx, const wslay_event_extension * extension, void * user_data );
+
+/*
+ * Enables extension negotiated by the application with state data.
+ * The extension is registered if it is not registered yet.
+ *
+ * This function must not be used after the first invocation of wslay_event_recv() or wslay_event_send() function.
+ *
+ * wslay_event_config_enable_extension() returns 0 if it succeeds, or WSLAY_ERR_INVALID_ARGUMENT
+ * if the extension can not be registered, it is already enabled or its RSV bits are used by another enabled extension.
+ */
+int wslay_event_config_enable_extension ( wslay_event_context * ctx, const wslay_event_extension * extension, void * data );
+
+// Returns the state of enabled extension, or NULL if the extension is not enabled.
+void * wslay_event_get_extension_data ( wslay_event_context * ctx, const wslay_event_extension * extension );
+
 // Sets callbacks to ctx.
 // The callbacks previouly set by this function or wslay_event_context_server_init() or wslay_event_context_client_init() are replaced with callbacks.
 void wslay_event_config_set_callbacks ( wslay_event_context * ctx, const struct wslay_event_callbacks * callbacks );
@@ -297,7 +591,8 @@ typedef struct wslay_event_msg_t {
 /*
  * Queues message specified in arg.
  *
- * This function supports both control and non-control messages and the given message is sent without fragmentation.
+ * This function supports both control and non-control messages and the given message is sent without fragmentation,
+ * unless it is longer than the value set by wslay_event_config_set_max_send_frame_length().
  * If fragmentation is needed, use wslay_event_queue_fragmented_msg() function instead.
  *
  * This function just queues a message and does not send it.
@@ -318,6 +613,128 @@ typedef struct wslay_event_msg_t {
  */
 int wslay_event_queue_msg ( wslay_event_context * ctx, const wslay_event_msg * arg );
 
+/*
+ * Queues non-control message specified in arg tagged with key.
+ * If a message with the same key is still waiting in the queue and none of its bytes have been sent,
+ * it is replaced by the given message, which takes its position in the queue.
+ * So only the latest message for each key is sent and the number of queued messages is bounded by the number of keys.
+ * Otherwise the message is queued as wslay_event_queue_msg() does.
+ *
+ * wslay_event_queue_keyed_msg() returns 0 if it succeeds, or returns the following negative error codes:
+ *
+ * WSLAY_ERR_NO_MORE_MSG
+ *   Could not queue given message. The one of possible reason is that
+ *   close control frame has been queued/sent and no further queueing
+ *   message is not allowed.
+ *
+ * WSLAY_ERR_INVALID_ARGUMENT
+ *   The given message is invalid.
+ *
+ * WSLAY_ERR_NOMEM
+ *   Out of memory.
+ */
+int wslay_event_queue_keyed_msg ( wslay_event_context * ctx, const wslay_event_msg * arg, uint64_t key );
+
+/*
+ * Queues non-control message specified in arg which is useful only for ttl milliseconds.
+ * If none of its bytes have been sent when wslay_event_send() reaches it after ttl elapsed,
+ * the message is dropped from the queue instead of being sent and wslay_event_on_msg_expired_callback is invoked.
+ * The number of dropped messages is returned by wslay_event_get_expired_msg_count().
+ * If ttl is 0, the message never expires.
+ *
+ * wslay_event_queue_expiring_msg() returns 0 if it succeeds, or returns the following negative error codes:
+ *
+ * WSLAY_ERR_NO_MORE_MSG
+ *   Could not queue given message. The one of possible reason is that
+ *   close control frame has been queued/sent and no further queueing
+ *   message is not allowed.
+ *
+ * WSLAY_ERR_INVALID_ARGUMENT
+ *   The given message is invalid.
+ *
+ * WSLAY_ERR_NOMEM
+ *   Out of memory.
+ */
+int wslay_event_queue_expiring_msg ( wslay_event_context * ctx, const wslay_event_msg * arg, uint32_t ttl );
+
+// Options of message queued by wslay_event_queue_msg_with_options().
+typedef struct wslay_event_msg_options_t {
+    // message replaces the queued one with the same key, see wslay_event_queue_keyed_msg()
+    bool keyed;
+    uint64_t key;
+    // milliseconds after which the message is dropped, 0 never expires, see wslay_event_queue_expiring_msg()
+    uint32_t ttl;
+} wslay_event_msg_options;
+
+/*
+ * Queues non-control message specified in arg with the given options combined.
+ * Keyed message with ttl replaces the queued message with the same key and expires ttl milliseconds after this call.
+ * wslay_event_queue_keyed_msg() and wslay_event_queue_expiring_msg() are the shorthands for a single option.
+ *
+ * wslay_event_queue_msg_with_options() returns 0 if it succeeds, or returns the following negative error codes:
+ *
+ * WSLAY_ERR_NO_MORE_MSG
+ *   Could not queue given message. The one of possible reason is that
+ *   close control frame has been queued/sent and no further queueing
+ *   message is not allowed.
+ *
+ * WSLAY_ERR_INVALID_ARGUMENT
+ *   The given message is invalid.
+ *
+ * WSLAY_ERR_NOMEM
+ *   Out of memory.
+ */
+int wslay_event_queue_msg_with_options ( wslay_event_context * ctx, const wslay_event_msg * arg, const wslay_event_msg_options * options );
+
+// Message payload shared by contexts, see wslay_event_broadcast_new().
+typedef struct wslay_event_broadcast_t {
+    uint8_t opcode;
+    uint8_t * data;
+    size_t data_length;
+    // payload compressed once by permessage-deflate, NULL if compression does not reduce it
+    uint8_t * deflated_data;
+    size_t deflated_length;
+    // window bits used to compress the payload, 0 if compression is disabled
+    uint8_t window_bits;
+    // the creator and each queued message hold a reference, updated atomically
+    size_t refcount;
+} wslay_event_broadcast;
+
+/*
+ * Creates text or binary message which can be queued to many contexts by wslay_event_queue_broadcast() without copying.
+ * If window_bits is not 0, the payload is compressed once by permessage-deflate with the given LZ77 window bits [9, 15].
+ *
+ * The message is not a child of any talloc context.
+ * It is freed when wslay_event_broadcast_release() is called and all messages referencing it are sent or dropped.
+ * Its reference count is atomic, so contexts of different threads can queue, send and drop it concurrently,
+ * while wslay_event_broadcast_release() is called once by the creator after its last wslay_event_queue_broadcast().
+ *
+ * wslay_event_broadcast_new() returns NULL if arguments are invalid or out of memory.
+ */
+wslay_event_broadcast * wslay_event_broadcast_new ( uint8_t opcode, const uint8_t * msg, size_t msg_length, uint8_t window_bits );
+
+// Releases the reference of the creator.
+void wslay_event_broadcast_release ( wslay_event_broadcast * broadcast );
+
+/*
+ * Queues broadcast message by reference.
+ *
+ * The compressed payload is used if ctx negotiated permessage-deflate with no_context_takeover for its own messages
+ * and its LZ77 window is not smaller than window bits of broadcast.
+ * Otherwise the uncompressed payload is used, it is compressed by ctx as usual if permessage-deflate is negotiated.
+ *
+ * wslay_event_queue_broadcast() returns 0 if it succeeds, or returns the following negative error codes:
+ *
+ * WSLAY_ERR_NO_MORE_MSG
+ *   Could not queue given message. The one of possible reason is that
+ *   close control frame has been queued/sent and no further queueing
+ *   message is not allowed.
+ *
+ * WSLAY_ERR_NOMEM
+ *   Out of memory.
+ */
+int wslay_event_queue_broadcast ( wslay_event_context * ctx, wslay_event_broadcast * broadcast );
+
 // Specify "source" to generate message.
 union wslay_event_msg_source {
     int fd;
@@ -340,11 +757,33 @@ struct wslay_event_omsg {
 
     uint8_t * data;
     size_t data_length;
+    // offset of the frame currently being sent, used when non-fragmented message is split
+    size_t data_offset;
+    // message queued by wslay_event_queue_keyed_msg() is replaced by the newer one with the same key
+    bool keyed;
+    uint64_t key;
+    // monotonic time in milliseconds after which unsent message is dropped, 0 for no deadline
+    uint64_t deadline;
+    // identifier returned by wslay_event_get_last_msg_id()
+    uint64_t id;
+    // message was cancelled after some of its bytes were sent, it is terminated at the next frame boundary
+    bool cancelled;
+    // reserved bits of the first frame
+    uint8_t rsv;
+    // data is encoded by extensions, rsv holds their bits
+    bool transformed;
+    // data is referenced from the broadcast message instead of being owned
+    wslay_event_broadcast * broadcast;
+    // the number of bytes of payload copy allocated after the message
+    size_t copy_length;
 
     union wslay_event_msg_source source;
     wslay_event_fragmented_msg_callback read_callback;
 };
 
+// Frees omsg allocated by the allocator of ctx together with its payload.
+void wslay_event_omsg_free ( wslay_event_context * ctx, struct wslay_event_omsg * omsg );
+
 struct wslay_event_fragmented_msg {
     // opcode
     uint8_t opcode;
@@ -407,6 +846,25 @@ int wslay_event_queue_fragmented_msg ( wslay_event_context * ctx, const struct w
  */
 int wslay_event_queue_close ( wslay_event_context * ctx, uint16_t status_code, const uint8_t * reason, size_t reason_length );
 
+// Returns identifier of the message queued by the last successful call of any wslay_event_queue_*() function.
+// Identifiers are unique within ctx and start from 1. It can be passed to wslay_event_cancel_msg().
+uint64_t wslay_event_get_last_msg_id ( wslay_event_context * ctx );
+
+/*
+ * Cancels non-control message with identifier id returned by wslay_event_get_last_msg_id().
+ *
+ * If none of the message bytes have been sent, the message is removed from the queue and its memory is released immediately.
+ * If the message is being sent, the frame in progress is completed and the message is terminated
+ * by an empty final continuation frame, so the peer receives the truncated message.
+ * A message that was not split into frames cannot be cancelled once it started.
+ *
+ * wslay_event_cancel_msg() returns 0 if it succeeds, or returns the following negative error codes:
+ *
+ * WSLAY_ERR_INVALID_ARGUMENT
+ *   There is no such message in the queue. It has already been sent or it cannot be cancelled anymore.
+ */
+int wslay_event_cancel_msg ( wslay_event_context * ctx, uint64_t id );
+
 // Sets error code to tell the library there is an error.
 // This function is typically used in user defined callback functions.
 // See the description of callback function to know which error code should be used.
@@ -420,6 +878,14 @@ int wslay_event_want_read ( wslay_event_context * ctx );
 // wslay_event_want_write() returns 1 if the library want to send more data to peer, or returns 0.
 int wslay_event_want_write ( wslay_event_context * ctx );
 
+/*
+ * Returns milliseconds until data held by fragment coalescing has to be sent,
+ * or 0 if no data is held or wslay_event_send() should be called now.
+ * While wslay_event_want_write() returns 1 for held data, the application can wait for the returned delay
+ * instead of polling the socket for writing, see wslay_event_config_set_fragment_coalescing().
+ */
+uint32_t wslay_event_get_send_delay ( wslay_event_context * ctx );
+
 // Prevents the event-based API context from reading any further data from peer.
 // This function may be used with wslay_event_queue_close()
 // if the application detects error in the data received and wants to fail WebSocket connection.
@@ -459,12 +925,44 @@ size_t wslay_event_get_queued_msg_count ( wslay_event_context * ctx );
 // It only counts the message length queued using wslay_event_queue_msg() or wslay_event_queue_close().
 size_t wslay_event_get_queued_msg_length ( wslay_event_context * ctx );
 
+// Returns the number of messages dropped because their time to live elapsed before they were sent.
+size_t wslay_event_get_expired_msg_count ( wslay_event_context * ctx );
+
+/*
+ * Releases receive buffers which were not used for the period set by wslay_event_config_set_recv_buffer_idle_timeout().
+ * Application can call this function periodically, e.g. from its timer, to return memory of idle connections.
+ */
+void wslay_event_shrink_recv_buffers ( wslay_event_context * ctx );
+
+/*
+ * Discards the data message being received, it can be called from wslay_event_on_frame_recv_start_callback
+ * or wslay_event_on_frame_recv_chunk_callback.
+ * The rest of the message is skipped as it is received: it is not buffered, unmasked or validated,
+ * the chunks buffered so far are freed and the limit set by wslay_event_config_set_max_recv_msg_length() does not apply.
+ * No further frame callbacks and no wslay_event_on_msg_recv_callback are invoked for the message.
+ * Messages encoded by extensions are still decoded, so compression contexts stay in sync, but the output is dropped.
+ *
+ * wslay_event_discard_msg() returns 0 if it succeeds, or WSLAY_ERR_INVALID_ARGUMENT
+ * if no text or binary message is being received. Control messages cannot be discarded.
+ */
+int wslay_event_discard_msg ( wslay_event_context * ctx );
+
+// Returns the number of received text messages validated as UTF-8.
+uint64_t wslay_event_get_validated_text_msg_count ( wslay_event_context * ctx );
+
+// Returns the number of received text messages accepted without UTF-8 validation, see wslay_event_config_set_text_validation().
+uint64_t wslay_event_get_trusted_text_msg_count ( wslay_event_context * ctx );
+
 inline
 void wslay_event_imsg_reset ( struct wslay_event_imsg * m )
 {
     m->opcode = 0xff;
+    m->discard = false;
     m->utf8state = UTF8_ACCEPT;
-    talloc_free ( m->chunks );
+    while ( !wslay_queue_is_empty ( &m->chunks ) ) {
+        talloc_free ( wslay_queue_top ( &m->chunks ) );
+        wslay_queue_pop ( &m->chunks );
+    }
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,254 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <string.h>
+
+#include "extension.h"
+#include "event.h"
+
+static inline
+void wslay_extension_trim ( const char ** begin, const char ** end )
+{
+    while ( *begin < *end && ( **begin == ' ' || **begin == '\t' ) ) {
+        ( *begin ) ++;
+    }
+    while ( *begin < *end && ( * ( *end - 1 ) == ' ' || * ( *end - 1 ) == '\t' ) ) {
+        ( *end ) --;
+    }
+}
+
+/*
+ * Finds the next non-empty element of Sec-WebSocket-Extensions header field value starting at *cursor.
+ * Stores the element and its token, moves *cursor after the element.
+ * Returns false if there are no more elements.
+ */
+static bool wslay_extension_next_element ( const char ** cursor, const char * end,
+        const char ** element, size_t * element_length, const char ** token, size_t * token_length )
+{
+    while ( *cursor < end ) {
+        const char * element_begin = *cursor;
+        const char * element_end   = memchr ( element_begin, ',', end - element_begin );
+        if ( element_end == NULL ) {
+            element_end = end;
+            *cursor = end;
+        } else {
+            *cursor = element_end + 1;
+        }
+        wslay_extension_trim ( &element_begin, &element_end );
+        if ( element_begin == element_end ) {
+            continue;
+        }
+        const char * token_begin = element_begin;
+        const char * token_end   = memchr ( element_begin, ';', element_end - element_begin );
+        if ( token_end == NULL ) {
+            token_end = element_end;
+        }
+        wslay_extension_trim ( &token_begin, &token_end );
+
+        *element        = element_begin;
+        *element_length = element_end - element_begin;
+        *token          = token_begin;
+        *token_length   = token_end - token_begin;
+        return true;
+    }
+    return false;
+}
+
+static inline
+bool wslay_extension_token_equals ( const wslay_event_extension * extension, const char * token, size_t token_length )
+{
+    return strlen ( extension->token ) == token_length && memcmp ( extension->token, token, token_length ) == 0;
+}
+
+static struct wslay_event_extension_slot * wslay_event_find_extension ( wslay_event_context * ctx, const wslay_event_extension * extension )
+{
+    uint8_t i;
+    for ( i = 0; i < ctx->extension_count; ++i ) {
+        if ( ctx->extensions[i].extension == extension ) {
+            return &ctx->extensions[i];
+        }
+    }
+    return NULL;
+}
+
+static int wslay_event_enable_extension_slot ( wslay_event_context * ctx, struct wslay_event_extension_slot * slot, void * data )
+{
+    if ( slot->enabled || ( ctx->extension_rsv & slot->extension->rsv ) != 0 ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    slot->data    = data;
+    slot->enabled = true;
+    ctx->extension_rsv |= slot->extension->rsv;
+    return 0;
+}
+
+int wslay_event_config_add_extension ( wslay_event_context * ctx, const wslay_event_extension * extension, void * user_data )
+{
+    if (
+        ctx->extension_count == WSLAY_EVENT_MAX_EXTENSIONS || extension->rsv == 0 || ( extension->rsv & ~7 ) != 0 ||
+        wslay_event_find_extension ( ctx, extension ) != NULL
+    ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    struct wslay_event_extension_slot * slot = &ctx->extensions[ctx->extension_count ++];
+    slot->extension = extension;
+    slot->user_data = user_data;
+    slot->data      = NULL;
+    slot->enabled   = false;
+    return 0;
+}
+
+int wslay_event_config_enable_extension ( wslay_event_context * ctx, const wslay_event_extension * extension, void * data )
+{
+    struct wslay_event_extension_slot * slot = wslay_event_find_extension ( ctx, extension );
+    if ( slot == NULL ) {
+        int r = wslay_event_config_add_extension ( ctx, extension, NULL );
+        if ( r != 0 ) {
+            return r;
+        }
+        slot = &ctx->extensions[ctx->extension_count - 1];
+    }
+    return wslay_event_enable_extension_slot ( ctx, slot, data );
+}
+
+void * wslay_event_get_extension_data ( wslay_event_context * ctx, const wslay_event_extension * extension )
+{
+    struct wslay_event_extension_slot * slot = wslay_event_find_extension ( ctx, extension );
+    if ( slot == NULL || !slot->enabled ) {
+        return NULL;
+    }
+    return slot->data;
+}
+
+// Writes list separator if the list is not empty and terminating NUL.
+static int wslay_extension_write_separator ( char * buf, size_t length, size_t * offset )
+{
+    if ( *offset == 0 ) {
+        return length == 0 ? WSLAY_ERR_INVALID_ARGUMENT : 0;
+    }
+    if ( length - *offset < 3 ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    memcpy ( buf + *offset, ", ", 3 );
+    *offset += 2;
+    return 0;
+}
+
+ssize_t wslay_event_extensions_offer ( wslay_event_context * ctx, char * buf, size_t length )
+{
+    size_t offset = 0;
+    uint8_t i;
+    if ( length == 0 ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    buf[0] = '\0';
+    for ( i = 0; i < ctx->extension_count; ++i ) {
+        const wslay_event_extension * extension = ctx->extensions[i].extension;
+        if ( extension->offer == NULL ) {
+            continue;
+        }
+        size_t previous_offset = offset;
+        if ( wslay_extension_write_separator ( buf, length, &offset ) != 0 ) {
+            return WSLAY_ERR_INVALID_ARGUMENT;
+        }
+        ssize_t r = extension->offer ( ctx, ctx->extensions[i].user_data, buf + offset, length - offset );
+        if ( r < 0 ) {
+            buf[previous_offset] = '\0';
+            return r;
+        }
+        offset += r;
+    }
+    return offset;
+}
+
+ssize_t wslay_event_extensions_accept ( wslay_event_context * ctx, const char * offer, size_t offer_length, char * response, size_t response_length )
+{
+    size_t offset = 0;
+    uint8_t i;
+    if ( response_length == 0 ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    response[0] = '\0';
+    for ( i = 0; i < ctx->extension_count; ++i ) {
+        struct wslay_event_extension_slot * slot = &ctx->extensions[i];
+        if ( slot->enabled || slot->extension->accept == NULL || ( ctx->extension_rsv & slot->extension->rsv ) != 0 ) {
+            continue;
+        }
+        const char * cursor = offer;
+        const char * element, * token;
+        size_t element_length, token_length;
+        while ( wslay_extension_next_element ( &cursor, offer + offer_length, &element, &element_length, &token, &token_length ) ) {
+            if ( !wslay_extension_token_equals ( slot->extension, token, token_length ) ) {
+                continue;
+            }
+            size_t element_offset = offset;
+            if ( wslay_extension_write_separator ( response, response_length, &element_offset ) != 0 ) {
+                return WSLAY_ERR_INVALID_ARGUMENT;
+            }
+            size_t accepted_length = response_length - element_offset;
+            void * data = NULL;
+            int r = slot->extension->accept ( ctx, slot->user_data, element, element_length, response + element_offset, &accepted_length, &data );
+            if ( r == 1 ) {
+                response[offset] = '\0';
+                continue;
+            } else if ( r != 0 ) {
+                response[offset] = '\0';
+                return r;
+            }
+            wslay_event_enable_extension_slot ( ctx, slot, data );
+            offset = element_offset + accepted_length;
+            break;
+        }
+    }
+    return offset;
+}
+
+int wslay_event_extensions_confirm ( wslay_event_context * ctx, const char * response, size_t response_length )
+{
+    const char * cursor = response;
+    const char * element, * token;
+    size_t element_length, token_length;
+    while ( wslay_extension_next_element ( &cursor, response + response_length, &element, &element_length, &token, &token_length ) ) {
+        struct wslay_event_extension_slot * slot = NULL;
+        uint8_t i;
+        for ( i = 0; i < ctx->extension_count && slot == NULL; ++i ) {
+            if ( wslay_extension_token_equals ( ctx->extensions[i].extension, token, token_length ) ) {
+                slot = &ctx->extensions[i];
+            }
+        }
+        if (
+            slot == NULL || slot->enabled || slot->extension->confirm == NULL ||
+            ( ctx->extension_rsv & slot->extension->rsv ) != 0
+        ) {
+            return WSLAY_ERR_INVALID_ARGUMENT;
+        }
+        void * data = NULL;
+        int r = slot->extension->confirm ( ctx, slot->user_data, element, element_length, &data );
+        if ( r != 0 ) {
+            return r;
+        }
+        wslay_event_enable_extension_slot ( ctx, slot, data );
+    }
+    return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef WSLAY_EXTENSION_H
+#define WSLAY_EXTENSION_H
+
+#include "wslay.h"
+
+struct wslay_event_context_t;
+
+// Maximum number of extensions registered in one context.
+#define WSLAY_EVENT_MAX_EXTENSIONS 4
+
+/*
+ * Extension transforming message payload, like permessage-deflate.
+ *
+ * Extensions are registered by wslay_event_config_add_extension() for negotiation,
+ * or enabled directly by wslay_event_config_enable_extension().
+ * Enabled extensions form a pipeline in the order of registration:
+ * sent messages are encoded by each extension in this order, received messages are decoded in reverse order.
+ * Each extension owns its RSV bits, they are set on the first frame of messages it encoded.
+ * Extensions with overlapping RSV bits can be registered, but only one of them can be enabled.
+ *
+ * The negotiation callbacks get user_data given to wslay_event_config_add_extension(),
+ * they store the state of negotiated extension to *data. The state should be allocated as child of ctx.
+ * The other callbacks get this state.
+ */
+typedef struct wslay_event_extension_t {
+    // extension token used in Sec-WebSocket-Extensions header field
+    const char * token;
+    // RSV bits (RSV1 << 2) | (RSV2 << 1) | RSV3 owned by the extension
+    uint8_t rsv;
+
+    // Client: writes extension element offered in the opening handshake to buf of length length.
+    // Returns the number of bytes written without terminating NUL, or negative error code.
+    ssize_t ( * offer ) ( struct wslay_event_context_t * ctx, void * user_data, char * buf, size_t length );
+
+    // Server: element is one element with the extension token from client offer.
+    // Writes the accepted element to response of length *response_length and stores its length to *response_length.
+    // Returns 0 if the element is accepted, 1 if it is declined, or negative error code.
+    int ( * accept ) ( struct wslay_event_context_t * ctx, void * user_data, const char * element, size_t element_length,
+                       char * response, size_t * response_length, void ** data );
+
+    // Client: element is the element with the extension token from server response.
+    // Returns 0 if the element is valid for the offer, or negative error code.
+    int ( * confirm ) ( struct wslay_event_context_t * ctx, void * user_data, const char * element, size_t element_length, void ** data );
+
+    // Encodes the whole payload of non-control message of length length.
+    // The result is allocated as child of parent and stored to *result, its length is stored to *result_length.
+    // Returns 0 if it succeeds, 1 if the message is sent as is, or negative error code.
+    // If it returns 1, the state must not be changed, it can be called again for the same message.
+    int ( * encode ) ( void * data, uint8_t opcode, const uint8_t * msg, size_t length, void * parent, uint8_t ** result, size_t * result_length );
+
+    // Sets the next part of encoded payload, fin is true for the last part of the message.
+    // Returns 0 if it succeeds, or negative error code.
+    // Extension which only encodes leaves it and decode_read NULL, received frame with its RSV bits fails the connection.
+    int ( * decode_input ) ( void * data, const uint8_t * input, size_t length, bool fin );
+
+    // Decodes the input into buf of length length.
+    // Returns the number of bytes stored, 0 if the input is consumed, or negative error code if the input is invalid.
+    ssize_t ( * decode_read ) ( void * data, uint8_t * buf, size_t length );
+
+    // Finishes decoding of the message, it can be NULL.
+    void ( * decode_end ) ( void * data );
+} wslay_event_extension;
+
+struct wslay_event_extension_slot {
+    const wslay_event_extension * extension;
+    void * user_data;
+    // state of the enabled extension
+    void * data;
+    bool enabled;
+};
+
+/*
+ * Client: writes the value of Sec-WebSocket-Extensions header field offering extensions registered in ctx to buf of length length.
+ *
+ * wslay_event_extensions_offer() returns the number of bytes written without terminating NUL,
+ * or WSLAY_ERR_INVALID_ARGUMENT if buf is too small, or negative error code returned by the extension.
+ */
+ssize_t wslay_event_extensions_offer ( struct wslay_event_context_t * ctx, char * buf, size_t length );
+
+/*
+ * Server: parses the value of Sec-WebSocket-Extensions header field offered by client.
+ * Each registered extension accepts the first acceptable element with its token,
+ * the extension is enabled if its RSV bits are not used by already enabled one.
+ * The value of Sec-WebSocket-Extensions response header field is written to response of length response_length.
+ *
+ * wslay_event_extensions_accept() returns the number of bytes written without terminating NUL, 0 if no extension is enabled,
+ * or WSLAY_ERR_INVALID_ARGUMENT if response is too small, or negative error code returned by the extension.
+ */
+ssize_t wslay_event_extensions_accept ( struct wslay_event_context_t * ctx, const char * offer, size_t offer_length, char * response, size_t response_length );
+
+/*
+ * Client: parses the value of Sec-WebSocket-Extensions header field of server response and enables accepted extensions.
+ *
+ * wslay_event_extensions_confirm() returns 0 if it succeeds, or WSLAY_ERR_INVALID_ARGUMENT if the response contains
+ * extension which was not offered, duplicated or conflicting extensions, or negative error code returned by the extension.
+ * The client must fail the connection if it does not succeed.
+ */
+int wslay_event_extensions_confirm ( struct wslay_event_context_t * ctx, const char * response, size_t response_length );
+
+#endif
@@ -36,6 +36,33 @@
 extern inline
 wslay_frame_context * wslay_frame_context_new ( void * ctx, const struct wslay_frame_callbacks * callbacks, void * user_data );
 
+void wslay_frame_apply_mask ( uint8_t * dst, const uint8_t * data, size_t length, const uint8_t * mask, uint64_t mask_offset )
+{
+    uint8_t key[8];
+    uint64_t key_word;
+    size_t i;
+    if ( mask == NULL ) {
+        if ( dst != data ) {
+            memcpy ( dst, data, length );
+        }
+        return;
+    }
+    for ( i = 0; i < 8; ++i ) {
+        key[i] = mask[ ( mask_offset + i ) % 4];
+    }
+    memcpy ( &key_word, key, 8 );
+    // Masking key is repeated every 4 bytes, so 8 bytes are masked by a word.
+    for ( i = 0; i + 8 <= length; i += 8 ) {
+        uint64_t word;
+        memcpy ( &word, data + i, 8 );
+        word ^= key_word;
+        memcpy ( dst + i, &word, 8 );
+    }
+    for ( ; i < length; ++i ) {
+        dst[i] = data[i] ^ key[i % 8];
+    }
+}
+
 int16_t wslay_frame_send ( wslay_frame_context * ctx, struct wslay_frame_iocb * iocb, size_t * length )
 {
     if ( iocb->data_length > iocb->payload_length ) {
@@ -121,10 +148,7 @@ int16_t wslay_frame_send ( wslay_frame_context * ctx, struct wslay_frame_iocb *
                     const uint8_t *writelimit = datamark + wslay_min ( sizeof ( temp ), datalen );
                     size_t writelen = writelimit - datamark;
                     ssize_t r;
-                    size_t i;
-                    for ( i = 0; i < writelen; ++i ) {
-                        temp[i] = datamark[i] ^ ctx->omaskkey[ ( ctx->opayloadoff + i ) % 4];
-                    }
+                    wslay_frame_apply_mask ( temp, datamark, writelen, ctx->omaskkey, ctx->opayloadoff );
                     r = ctx->callbacks.send_callback ( temp, writelen, 0, ctx->user_data, false );
                     if ( r > 0 ) {
                         if ( ( size_t ) r > writelen ) {
@@ -175,17 +199,151 @@ void wslay_shift_ibuf ( wslay_frame_context * ctx )
     ctx->ibufmark = ctx->ibuf;
 }
 
+// Idle connection holds no input buffer, it is allocated by the next read.
+static void wslay_release_ibuf ( wslay_frame_context * ctx )
+{
+    if ( ctx->ibuf != NULL ) {
+        wslay_free ( ctx->allocator, ctx->ibuf, ctx->ibuf_capacity );
+    }
+    ctx->ibuf     = NULL;
+    ctx->ibufmark = ctx->ibuflimit = NULL;
+}
+
+// Returns true if ibuf is private copy of unconsumed bytes made by wslay_frame_park_ibuf().
+static inline
+bool wslay_is_parked_copy ( wslay_frame_context * ctx )
+{
+    return ctx->ibuf != NULL && ctx->ibuf != ctx->iscratch && ctx->ibuf != ctx->ispill;
+}
+
+// Returns true if ibuf was allocated by ctx->allocator.
 static inline
-int16_t wslay_recv ( wslay_frame_context * ctx )
+bool wslay_is_owned_ibuf ( wslay_frame_context * ctx )
+{
+    return ctx->iscratch == NULL ? ctx->ibuf != NULL : wslay_is_parked_copy ( ctx );
+}
+
+uint8_t wslay_frame_context_free ( void * data )
+{
+    wslay_frame_context * ctx = data;
+    if ( wslay_is_owned_ibuf ( ctx ) ) {
+        wslay_free ( ctx->allocator, ctx->ibuf, ctx->ibuf_capacity );
+    }
+    return 0;
+}
+
+void wslay_frame_context_reset ( wslay_frame_context * ctx )
+{
+    if ( wslay_is_owned_ibuf ( ctx ) ) {
+        wslay_free ( ctx->allocator, ctx->ibuf, ctx->ibuf_capacity );
+    }
+    struct wslay_frame_callbacks callbacks = ctx->callbacks;
+    void * user_data = ctx->user_data;
+    bool ikeepmask   = ctx->ikeepmask;
+    const wslay_allocator * allocator = ctx->allocator;
+    memset ( ctx, 0, sizeof ( wslay_frame_context ) );
+    ctx->istate    = RECV_HEADER1;
+    ctx->ireqread  = 2;
+    ctx->ostate    = PREP_HEADER;
+    ctx->ikeepmask = ikeepmask;
+    ctx->callbacks = callbacks;
+    ctx->user_data = user_data;
+    ctx->allocator = allocator;
+}
+
+int16_t wslay_frame_set_scratch_buffer ( wslay_frame_context * ctx, uint8_t * buf, size_t length )
+{
+    if ( ( buf != NULL && length < WSLAY_FRAME_IBUF_LENGTH ) || ctx->ibufmark != ctx->ibuflimit ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    if ( wslay_is_owned_ibuf ( ctx ) ) {
+        wslay_free ( ctx->allocator, ctx->ibuf, ctx->ibuf_capacity );
+    }
+    ctx->ibuf            = NULL;
+    ctx->ibufmark        = ctx->ibuflimit = NULL;
+    ctx->iscratch        = buf;
+    ctx->iscratch_length = length;
+    return 0;
+}
+
+int16_t wslay_frame_park_ibuf ( wslay_frame_context * ctx )
+{
+    if ( ctx->iscratch == NULL || ctx->ibuf != ctx->iscratch ) {
+        return 0;
+    }
+    size_t length = ctx->ibuflimit - ctx->ibufmark;
+    uint8_t * buf = NULL;
+    if ( length > sizeof ( ctx->ispill ) ) {
+        buf = wslay_alloc ( ctx->allocator, length );
+        if ( buf == NULL ) {
+            return WSLAY_ERR_NOMEM;
+        }
+        ctx->ibuf_capacity = length;
+    } else if ( length > 0 ) {
+        buf = ctx->ispill;
+    }
+    if ( length > 0 ) {
+        memcpy ( buf, ctx->ibufmark, length );
+    }
+    ctx->ibuf      = buf;
+    ctx->ibufmark  = buf;
+    ctx->ibuflimit = buf + length;
+    return 0;
+}
+
+// Moves unconsumed bytes parked by wslay_frame_park_ibuf() to the start of scratch buffer.
+static void wslay_unpark_ibuf ( wslay_frame_context * ctx )
 {
-    if ( ctx->ibufmark != ctx->ibuf ) {
-        wslay_shift_ibuf ( ctx );
+    if ( ctx->ibuf == ctx->iscratch ) {
+        if ( ctx->ibufmark != ctx->ibuf ) {
+            wslay_shift_ibuf ( ctx );
+        }
+        return;
+    }
+    size_t length = ctx->ibuflimit - ctx->ibufmark;
+    if ( length > 0 ) {
+        memcpy ( ctx->iscratch, ctx->ibufmark, length );
+    }
+    if ( wslay_is_parked_copy ( ctx ) ) {
+        wslay_free ( ctx->allocator, ctx->ibuf, ctx->ibuf_capacity );
+    }
+    ctx->ibuf      = ctx->iscratch;
+    ctx->ibufmark  = ctx->iscratch;
+    ctx->ibuflimit = ctx->iscratch + length;
+}
+
+static int16_t wslay_recv ( wslay_frame_context * ctx )
+{
+    size_t capacity;
+    if ( ctx->iscratch != NULL ) {
+        wslay_unpark_ibuf ( ctx );
+        capacity = ctx->iscratch_length;
+    } else if ( ctx->ibuf == NULL ) {
+        ctx->ibuf = wslay_alloc ( ctx->allocator, WSLAY_FRAME_IBUF_LENGTH );
+        if ( ctx->ibuf == NULL ) {
+            return WSLAY_ERR_NOMEM;
+        }
+        ctx->ibuf_capacity = WSLAY_FRAME_IBUF_LENGTH;
+        ctx->ibufmark = ctx->ibuflimit = ctx->ibuf;
+        capacity = WSLAY_FRAME_IBUF_LENGTH;
+    } else {
+        if ( ctx->ibufmark != ctx->ibuf ) {
+            wslay_shift_ibuf ( ctx );
+        }
+        capacity = WSLAY_FRAME_IBUF_LENGTH;
     }
     ssize_t result;
-    result = ctx->callbacks.recv_callback ( ctx->ibuflimit, ctx->ibuf + sizeof ( ctx->ibuf ) - ctx->ibuflimit, 0, ctx->user_data );
+    result = ctx->callbacks.recv_callback ( ctx->ibuflimit, ctx->ibuf + capacity - ctx->ibuflimit, 0, ctx->user_data );
     if ( result > 0 ) {
         ctx->ibuflimit += result;
     } else {
+        if ( ctx->iscratch != NULL ) {
+            if ( wslay_frame_park_ibuf ( ctx ) != 0 ) {
+                return WSLAY_ERR_NOMEM;
+            }
+        } else if ( ctx->ibufmark == ctx->ibuflimit ) {
+            wslay_release_ibuf ( ctx );
+        }
         return WSLAY_ERR_WANT_READ;
     }
     return 0;
@@ -294,14 +452,11 @@ int16_t wslay_frame_recv ( wslay_frame_context * ctx, struct wslay_frame_iocb *
         } else {
             readlimit = ctx->ibufmark + rempayloadlen;
         }
-        if ( ctx->imask ) {
-            for ( ; ctx->ibufmark != readlimit; ++ctx->ibufmark, ++ctx->ipayloadoff ) {
-                ctx->ibufmark[0] ^= ctx->imaskkey[ctx->ipayloadoff % 4];
-            }
-        } else {
-            ctx->ibufmark = readlimit;
-            ctx->ipayloadoff += readlimit - readmark;
+        if ( ctx->imask && !ctx->ikeepmask ) {
+            wslay_frame_apply_mask ( readmark, readmark, readlimit - readmark, ctx->imaskkey, ctx->ipayloadoff );
         }
+        ctx->ibufmark = readlimit;
+        ctx->ipayloadoff += readlimit - readmark;
 
         iocb->fin            = ctx->iom.fin;
         iocb->rsv            = ctx->iom.rsv;
@@ -26,8 +26,10 @@
 #define WSLAY_FRAME_H
 
 #include "wslay.h"
+#include "allocator.h"
 
 #include <talloc2/tree.h>
+#include <talloc2/ext/destructor.h>
 
 enum wslay_frame_state {
     PREP_HEADER = 0,
@@ -46,8 +48,14 @@ struct wslay_frame_opcode_memo {
     uint8_t rsv;
 };
 
+#define WSLAY_FRAME_IBUF_LENGTH 4096
+// enough for the longest frame header
+#define WSLAY_FRAME_SPILL_LENGTH 16
+
 typedef struct wslay_frame_context_t {
-    uint8_t ibuf[4096];
+    // allocated when reading starts and freed when all read bytes are consumed, NULL otherwise.
+    // With scratch buffer it is iscratch while reading, then ispill or private copy of unconsumed bytes.
+    uint8_t * ibuf;
     uint8_t * ibufmark;
     uint8_t * ibuflimit;
     struct wslay_frame_opcode_memo iom;
@@ -55,6 +63,8 @@ typedef struct wslay_frame_context_t {
     uint64_t ipayloadoff;
     uint8_t imask;
     uint8_t imaskkey[4];
+    // masked payload is returned without unmasking, the caller unmasks it by imaskkey
+    bool ikeepmask;
     uint8_t istate;
     size_t ireqread;
 
@@ -67,10 +77,23 @@ typedef struct wslay_frame_context_t {
     uint8_t omaskkey[4];
     uint8_t ostate;
 
+    // Cold data, used when a read or write call starts or a receive buffer is allocated or released.
     struct wslay_frame_callbacks callbacks;
     void * user_data;
+    // allocator of ibuf
+    const wslay_allocator * allocator;
+    // the number of bytes allocated for ibuf when it is private or private copy
+    size_t ibuf_capacity;
+    // buffer shared by contexts of a thread to read into, NULL if ibuf is private
+    uint8_t * iscratch;
+    size_t iscratch_length;
+    // unconsumed bytes of partial frame header left when reading into iscratch stops
+    uint8_t ispill[WSLAY_FRAME_SPILL_LENGTH];
 } wslay_frame_context;
 
+// Destructor of frame context, frees ibuf.
+uint8_t wslay_frame_context_free ( void * data );
+
 /*
  * Initializes ctx using given callbacks and user_data.
  * This function allocates memory for struct wslay_frame_context and stores the result to *ctx.
@@ -85,11 +108,16 @@ wslay_frame_context * wslay_frame_context_new ( void * ctx, const struct wslay_f
     if ( frame_ctx == NULL ) {
         return NULL;
     }
+    if ( talloc_set_destructor ( frame_ctx, wslay_frame_context_free ) != 0 ) {
+        talloc_free ( frame_ctx );
+        return NULL;
+    }
+    frame_ctx->allocator = wslay_get_default_allocator();
     frame_ctx->istate    = RECV_HEADER1;
     frame_ctx->ireqread  = 2;
     frame_ctx->ostate    = PREP_HEADER;
     frame_ctx->user_data = user_data;
-    frame_ctx->ibufmark  = frame_ctx->ibuflimit = frame_ctx->ibuf;
+    frame_ctx->ibufmark  = frame_ctx->ibuflimit = NULL;
     frame_ctx->callbacks = * callbacks;
     
     frame_ctx->oheadermark  = NULL;
@@ -97,6 +125,12 @@ wslay_frame_context * wslay_frame_context_new ( void * ctx, const struct wslay_f
     return frame_ctx;
 }
 
+/*
+ * Returns ctx to the state after wslay_frame_context_new(), keeping its callbacks and user_data.
+ * Received bytes are dropped and scratch buffer is unset.
+ */
+void wslay_frame_context_reset ( wslay_frame_context * ctx );
+
 /*
  * Send WebSocket frame specified in iocb.
  * ctx must be initialized using wslay_frame_context_init() function.
@@ -132,6 +166,8 @@ int16_t wslay_frame_send ( wslay_frame_context * ctx, struct wslay_frame_iocb *
  * iocb->data is pointed to the buffer containing received payload data.
  * This buffer is allocated by the library and must be read-only.
  * iocb->data_length is the number of payload bytes recieved.
+ * If ctx->ikeepmask is set, masked payload is not unmasked: iocb->data is masked by ctx->imaskkey
+ * starting at the payload offset of the part, so the caller can unmask it while copying.
  * This function calls recv_callback if it needs to receive additional bytes.
  * If it cannot receive any single bytes of payload, it returns WSLAY_ERR_WANT_READ.
  * If the library detects protocol violation in a received frame, this function returns WSLAY_ERR_PROTO.
@@ -142,4 +178,29 @@ int16_t wslay_frame_send ( wslay_frame_context * ctx, struct wslay_frame_iocb *
  */
 int16_t wslay_frame_recv ( wslay_frame_context * ctx, struct wslay_frame_iocb * iocb, size_t * data_length_ptr );
 
+/*
+ * Makes ctx read into buf of length bytes instead of its private input buffer.
+ * buf can be shared by all contexts used by one thread, because unconsumed bytes are moved out of it
+ * when wslay_frame_recv() returns WSLAY_ERR_WANT_READ or wslay_frame_park_ibuf() is called:
+ * a partial frame header is kept in ctx->ispill, anything longer in a private copy.
+ * If buf is NULL, ctx reads into its private buffer again.
+ *
+ * This function returns 0 if it succeeds, or WSLAY_ERR_INVALID_ARGUMENT if length is less than
+ * WSLAY_FRAME_IBUF_LENGTH or ctx holds unconsumed bytes.
+ */
+int16_t wslay_frame_set_scratch_buffer ( wslay_frame_context * ctx, uint8_t * buf, size_t length );
+
+/*
+ * Moves unconsumed bytes out of the scratch buffer set by wslay_frame_set_scratch_buffer(),
+ * so another context can read into it. It must be called when the caller stops calling wslay_frame_recv().
+ * Returns 0 if it succeeds, or WSLAY_ERR_NOMEM if out of memory.
+ */
+int16_t wslay_frame_park_ibuf ( wslay_frame_context * ctx );
+
+/*
+ * Masks or unmasks data of length length to dst by masking key mask: mask[( mask_offset + i ) % 4] applies to data[i].
+ * dst can be equal to data. If mask is NULL, data is copied.
+ */
+void wslay_frame_apply_mask ( uint8_t * dst, const uint8_t * data, size_t length, const uint8_t * mask, uint64_t mask_offset );
+
 #endif
@@ -0,0 +1,113 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <stdlib.h>
+#include <sys/mman.h>
+
+#include "hugepage.h"
+
+#include <talloc2/tree.h>
+#include <talloc2/ext/destructor.h>
+
+#define wslay_hugepage_round(length) (((length) + WSLAY_HUGEPAGE_LENGTH - 1) & ~((size_t) WSLAY_HUGEPAGE_LENGTH - 1))
+
+void * wslay_hugepage_map ( size_t length, enum wslay_hugepage_kind * kind )
+{
+    length = wslay_hugepage_round ( length );
+    void * ptr;
+#ifdef MAP_HUGETLB
+    ptr = mmap ( NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+    if ( ptr != MAP_FAILED ) {
+        * kind = WSLAY_HUGEPAGE_HUGETLB;
+        return ptr;
+    }
+#endif
+    // Hugetlb pages are not reserved, the mapping is aligned to the huge page so the kernel can back it by one.
+    uint8_t * mapping = mmap ( NULL, length + WSLAY_HUGEPAGE_LENGTH, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( mapping == MAP_FAILED ) {
+        return NULL;
+    }
+    uint8_t * aligned = ( uint8_t * ) wslay_hugepage_round ( ( uintptr_t ) mapping );
+    if ( aligned != mapping ) {
+        munmap ( mapping, aligned - mapping );
+    }
+    munmap ( aligned + length, mapping + WSLAY_HUGEPAGE_LENGTH - aligned );
+    * kind = WSLAY_HUGEPAGE_NONE;
+#ifdef MADV_HUGEPAGE
+    if ( madvise ( aligned, length, MADV_HUGEPAGE ) == 0 ) {
+        * kind = WSLAY_HUGEPAGE_TRANSPARENT;
+    }
+#endif
+    return aligned;
+}
+
+void wslay_hugepage_unmap ( void * ptr, size_t length )
+{
+    munmap ( ptr, wslay_hugepage_round ( length ) );
+}
+
+static void * wslay_hugepage_pool_map ( void * user_data, size_t length, bool slab )
+{
+    wslay_hugepage_pool * pool = user_data;
+    if ( !slab ) {
+        return malloc ( length );
+    }
+    enum wslay_hugepage_kind kind;
+    void * ptr = wslay_hugepage_map ( length, &kind );
+    if ( ptr != NULL ) {
+        pool->slab_counts[kind] ++;
+    }
+    return ptr;
+}
+
+static void wslay_hugepage_pool_unmap ( void * user_data, void * ptr, size_t length, bool slab )
+{
+    ( void ) user_data;
+    if ( slab ) {
+        wslay_hugepage_unmap ( ptr, length );
+    } else {
+        free ( ptr );
+    }
+}
+
+static uint8_t wslay_hugepage_pool_destroy ( void * data )
+{
+    wslay_hugepage_pool * pool = data;
+    wslay_slab_pool_destroy ( &pool->slabs );
+    return 0;
+}
+
+wslay_hugepage_pool * wslay_hugepage_pool_new ( void * ctx )
+{
+    wslay_hugepage_pool * pool = talloc_zero ( ctx, sizeof ( wslay_hugepage_pool ) );
+    if ( pool == NULL ) {
+        return NULL;
+    }
+    if ( talloc_set_destructor ( pool, wslay_hugepage_pool_destroy ) != 0 ) {
+        talloc_free ( pool );
+        return NULL;
+    }
+    wslay_slab_pool_init ( &pool->slabs, WSLAY_HUGEPAGE_LENGTH, wslay_hugepage_pool_map, wslay_hugepage_pool_unmap, pool, false );
+    return pool;
+}
@@ -0,0 +1,74 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef WSLAY_HUGEPAGE_H
+#define WSLAY_HUGEPAGE_H
+
+#include <stdint.h>
+
+#include "wslay.h"
+#include "allocator.h"
+#include "slab_pool.h"
+
+#define WSLAY_HUGEPAGE_LENGTH ( 2 << 20 )
+
+enum wslay_hugepage_kind {
+    // explicit hugetlb page reserved by the administrator
+    WSLAY_HUGEPAGE_HUGETLB = 0,
+    // 2 MiB aligned mapping advised to become transparent huge page
+    WSLAY_HUGEPAGE_TRANSPARENT,
+    // small pages, when neither is available
+    WSLAY_HUGEPAGE_NONE
+};
+
+/*
+ * Maps length bytes rounded up to WSLAY_HUGEPAGE_LENGTH, trying MAP_HUGETLB first,
+ * then 2 MiB aligned mapping with MADV_HUGEPAGE. The kind of mapping is stored to kind.
+ * Returns NULL if out of memory.
+ */
+void * wslay_hugepage_map ( size_t length, enum wslay_hugepage_kind * kind );
+
+void wslay_hugepage_unmap ( void * ptr, size_t length );
+
+/*
+ * Allocator carving blocks of size classes from 2 MiB slabs mapped by wslay_hugepage_map(),
+ * so per-connection buffers and messages of many contexts share few TLB entries.
+ * Allocations larger than size classes are passed to malloc(), slabs are unmapped when the pool is freed.
+ * Contexts using the same pool must be used by one thread.
+ */
+typedef struct wslay_hugepage_pool_t {
+    // slabs.allocator is the allocator of the pool
+    wslay_slab_pool slabs;
+    // the number of slabs of each enum wslay_hugepage_kind
+    size_t slab_counts[3];
+} wslay_hugepage_pool;
+
+/*
+ * Allocates pool, its first slab is mapped on the first allocation.
+ * The pool must be freed after all contexts using it.
+ * wslay_hugepage_pool_new() returns NULL if out of memory.
+ */
+wslay_hugepage_pool * wslay_hugepage_pool_new ( void * ctx );
+
+#endif
@@ -0,0 +1,127 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <sched.h>
+#include <string.h>
+
+#include <numa.h>
+
+#include "numa_pool.h"
+
+#include <talloc2/tree.h>
+#include <talloc2/ext/destructor.h>
+
+static void * wslay_numa_pool_map ( void * user_data, size_t length, bool slab )
+{
+    const wslay_numa_pool * pool = user_data;
+    ( void ) slab;
+    return numa_alloc_onnode ( length, pool->node );
+}
+
+static void wslay_numa_pool_unmap ( void * user_data, void * ptr, size_t length, bool slab )
+{
+    ( void ) user_data;
+    ( void ) slab;
+    numa_free ( ptr, length );
+}
+
+static void wslay_numa_pool_destroy ( wslay_numa_pool * pool )
+{
+    wslay_slab_pool_destroy ( &pool->slabs );
+    numa_free ( pool, sizeof ( wslay_numa_pool ) );
+}
+
+static uint8_t wslay_numa_pools_free ( void * data )
+{
+    wslay_numa_pools * pools = data;
+    int node;
+    for ( node = 0; node < pools->node_count; node ++ ) {
+        if ( pools->pools[node] != NULL ) {
+            wslay_numa_pool_destroy ( pools->pools[node] );
+        }
+    }
+    return 0;
+}
+
+wslay_numa_pools * wslay_numa_pools_new ( void * ctx )
+{
+    if ( numa_available() < 0 ) {
+        return NULL;
+    }
+    wslay_numa_pools * pools = talloc ( ctx, sizeof ( wslay_numa_pools ) );
+    if ( pools == NULL ) {
+        return NULL;
+    }
+    pools->node_count = numa_max_node() + 1;
+    pools->pools      = talloc_zero ( pools, pools->node_count * sizeof ( wslay_numa_pool * ) );
+    if ( pools->pools == NULL || talloc_set_destructor ( pools, wslay_numa_pools_free ) != 0 ) {
+        talloc_free ( pools );
+        return NULL;
+    }
+    int node;
+    for ( node = 0; node < pools->node_count; node ++ ) {
+        // Nodes without memory are left without pool.
+        if ( !numa_bitmask_isbitset ( numa_all_nodes_ptr, node ) ) {
+            continue;
+        }
+        wslay_numa_pool * pool = numa_alloc_onnode ( sizeof ( wslay_numa_pool ), node );
+        if ( pool == NULL ) {
+            talloc_free ( pools );
+            return NULL;
+        }
+        // Worker threads of the node share its pool.
+        wslay_slab_pool_init ( &pool->slabs, WSLAY_NUMA_POOL_SLAB_LENGTH, wslay_numa_pool_map, wslay_numa_pool_unmap, pool, true );
+        pool->node = node;
+        pools->pools[node] = pool;
+    }
+    return pools;
+}
+
+wslay_numa_pool * wslay_numa_pools_get ( wslay_numa_pools * pools, int node )
+{
+    if ( node < 0 ) {
+        int cpu = sched_getcpu();
+        node = cpu < 0 ? 0 : numa_node_of_cpu ( cpu );
+    }
+    if ( node >= 0 && node < pools->node_count && pools->pools[node] != NULL ) {
+        return pools->pools[node];
+    }
+    // Falls back to the first node with memory.
+    for ( node = 0; node < pools->node_count; node ++ ) {
+        if ( pools->pools[node] != NULL ) {
+            return pools->pools[node];
+        }
+    }
+    return NULL;
+}
+
+int wslay_numa_pools_bind ( wslay_numa_pools * pools, wslay_event_context * ctx )
+{
+    wslay_numa_pool * pool = wslay_numa_pools_get ( pools, -1 );
+    if ( pool == NULL ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    return wslay_event_config_set_allocator ( ctx, &pool->slabs.allocator );
+}
@@ -0,0 +1,72 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef WSLAY_NUMA_POOL_H
+#define WSLAY_NUMA_POOL_H
+
+#include "wslay.h"
+#include "allocator.h"
+#include "slab_pool.h"
+#include "event.h"
+
+// memory requested from a node at once and carved into blocks of size classes
+#define WSLAY_NUMA_POOL_SLAB_LENGTH ( 1 << 20 )
+
+/*
+ * Allocator of memory placed on one NUMA node, shared by the worker threads running on that node.
+ * Slabs and allocations larger than size classes are requested from the node, slabs are returned when the pool is freed.
+ */
+typedef struct wslay_numa_pool_t {
+    // slabs of the node, slabs.allocator is the allocator of the pool
+    wslay_slab_pool slabs;
+    int node;
+} wslay_numa_pool;
+
+// Pools of all NUMA nodes of the machine.
+typedef struct wslay_numa_pools_t {
+    wslay_numa_pool ** pools;
+    int node_count;
+} wslay_numa_pools;
+
+/*
+ * Allocates pool for each configured NUMA node, each one placed on its node.
+ * Pools must be freed after all contexts bound to them.
+ * wslay_numa_pools_new() returns NULL if NUMA is not available or out of memory.
+ */
+wslay_numa_pools * wslay_numa_pools_new ( void * ctx );
+
+// Returns pool of node, or the node of the calling thread if node is negative.
+// Node without memory falls back to the first node with memory.
+wslay_numa_pool * wslay_numa_pools_get ( wslay_numa_pools * pools, int node );
+
+/*
+ * Makes ctx allocate its buffers, queued messages and queue cells from the pool of the node running the calling thread,
+ * so it should be called by the worker thread which owns ctx, right after ctx is created or reset.
+ * Use wslay_event_config_set_allocator() with the allocator of wslay_numa_pools_get() to bind ctx to another node.
+ *
+ * wslay_numa_pools_bind() returns 0 if it succeeds, or WSLAY_ERR_INVALID_ARGUMENT if wslay_event_config_set_allocator() fails.
+ */
+int wslay_numa_pools_bind ( wslay_numa_pools * pools, wslay_event_context * ctx );
+
+#endif
@@ -32,6 +32,9 @@
 extern inline
 wslay_queue * wslay_queue_new ();
 
+extern inline
+void wslay_queue_init ( wslay_queue * queue, const wslay_allocator * allocator );
+
 extern inline
 uint8_t wslay_queue_free ( void * data );
 
@@ -44,6 +47,9 @@ uint8_t wslay_queue_push_front ( wslay_queue * queue, void * data );
 extern inline
 uint8_t wslay_queue_pop ( wslay_queue * queue );
 
+extern inline
+uint8_t wslay_queue_remove ( wslay_queue * queue, void * data );
+
 extern inline
 void * wslay_queue_top ( wslay_queue * queue );
 
@@ -31,6 +31,7 @@
 #include <talloc2/ext/destructor.h>
 
 #include "wslay.h"
+#include "allocator.h"
 
 typedef struct wslay_queue_cell_t {
     void * data;
@@ -40,6 +41,7 @@ typedef struct wslay_queue_cell_t {
 typedef struct wslay_queue_t {
     wslay_queue_cell * top;
     wslay_queue_cell * tail;
+    const wslay_allocator * allocator;
 } wslay_queue;
 
 inline
@@ -54,12 +56,20 @@ uint8_t wslay_queue_free ( void * data )
     wslay_queue_cell * next_cell;
     while ( cell != NULL ) {
         next_cell = cell->next;
-        free ( cell );
+        wslay_free ( queue->allocator, cell, sizeof ( wslay_queue_cell ) );
         cell = next_cell;
     }
     return 0;
 }
 
+// Initializes queue embedded in another structure, its cells are freed by wslay_queue_free().
+inline
+void wslay_queue_init ( wslay_queue * queue, const wslay_allocator * allocator )
+{
+    queue->top = queue->tail = NULL;
+    queue->allocator = allocator;
+}
+
 inline
 wslay_queue * wslay_queue_new ( void * ctx )
 {
@@ -70,14 +80,14 @@ wslay_queue * wslay_queue_new ( void * ctx )
     if ( talloc_set_destructor ( queue, wslay_queue_free ) != 0 ) {
         return NULL;
     }
-    queue->top = queue->tail = NULL;
+    wslay_queue_init ( queue, wslay_get_default_allocator() );
     return queue;
 }
 
 inline
 uint8_t wslay_queue_push ( wslay_queue * queue, void * data )
 {
-    wslay_queue_cell * new_cell = malloc ( sizeof ( wslay_queue_cell ) );
+    wslay_queue_cell * new_cell = wslay_alloc ( queue->allocator, sizeof ( wslay_queue_cell ) );
     if ( new_cell == NULL ) {
         return 1;
     }
@@ -95,7 +105,7 @@ uint8_t wslay_queue_push ( wslay_queue * queue, void * data )
 inline
 uint8_t wslay_queue_push_front ( wslay_queue * queue, void * data )
 {
-    wslay_queue_cell * new_cell = malloc ( sizeof ( wslay_queue_cell ) );
+    wslay_queue_cell * new_cell = wslay_alloc ( queue->allocator, sizeof ( wslay_queue_cell ) );
     if ( new_cell == NULL ) {
         return 1;
     }
@@ -119,7 +129,31 @@ uint8_t wslay_queue_pop ( wslay_queue * queue )
     if ( top == queue->tail ) {
         queue->tail = NULL;
     }
-    free ( top );
+    wslay_free ( queue->allocator, top, sizeof ( wslay_queue_cell ) );
+    return 0;
+}
+
+inline
+uint8_t wslay_queue_remove ( wslay_queue * queue, void * data )
+{
+    wslay_queue_cell * prev = NULL;
+    wslay_queue_cell * cell = queue->top;
+    while ( cell != NULL && cell->data != data ) {
+        prev = cell;
+        cell = cell->next;
+    }
+    if ( cell == NULL ) {
+        return 1;
+    }
+    if ( prev == NULL ) {
+        queue->top = cell->next;
+    } else {
+        prev->next = cell->next;
+    }
+    if ( cell == queue->tail ) {
+        queue->tail = prev;
+    }
+    wslay_free ( queue->allocator, cell, sizeof ( wslay_queue_cell ) );
     return 0;
 }
 
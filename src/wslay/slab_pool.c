@@ -0,0 +1,158 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <string.h>
+
+#include "slab_pool.h"
+
+#define WSLAY_SLAB_POOL_MIN_BLOCK_LENGTH 16
+
+// The first bytes of each slab chain the slabs of the pool.
+struct wslay_slab {
+    struct wslay_slab * next;
+};
+
+static inline
+void wslay_slab_pool_lock ( wslay_slab_pool * pool )
+{
+    if ( !pool->shared ) {
+        return;
+    }
+    while ( __atomic_test_and_set ( &pool->lock, __ATOMIC_ACQUIRE ) ) {
+        while ( __atomic_load_n ( &pool->lock, __ATOMIC_RELAXED ) ) {
+#if defined ( __x86_64__ ) || defined ( __i386__ )
+            __builtin_ia32_pause();
+#endif
+        }
+    }
+}
+
+static inline
+void wslay_slab_pool_unlock ( wslay_slab_pool * pool )
+{
+    if ( pool->shared ) {
+        __atomic_clear ( &pool->lock, __ATOMIC_RELEASE );
+    }
+}
+
+static inline
+unsigned int wslay_slab_pool_size_class ( size_t size )
+{
+    unsigned int class = 0;
+    while ( ( ( size_t ) WSLAY_SLAB_POOL_MIN_BLOCK_LENGTH << class ) < size ) {
+        class ++;
+    }
+    return class;
+}
+
+// Carves block of class from the newest slab, maps new slab when it is used up.
+static void * wslay_slab_pool_carve ( wslay_slab_pool * pool, unsigned int class )
+{
+    size_t length = ( size_t ) WSLAY_SLAB_POOL_MIN_BLOCK_LENGTH << class;
+    if ( pool->slab == NULL || pool->slab_offset < sizeof ( struct wslay_slab ) + length ) {
+        struct wslay_slab * slab = pool->map ( pool->user_data, pool->slab_length, true );
+        if ( slab == NULL ) {
+            return NULL;
+        }
+        slab->next = ( struct wslay_slab * ) pool->slab;
+        pool->slab        = ( uint8_t * ) slab;
+        pool->slab_offset = pool->slab_length;
+        pool->slab_count ++;
+    }
+    pool->slab_offset -= length;
+    return pool->slab + pool->slab_offset;
+}
+
+static void * wslay_slab_pool_alloc ( void * user_data, size_t size )
+{
+    wslay_slab_pool * pool = user_data;
+    unsigned int class = wslay_slab_pool_size_class ( size );
+    if ( class >= WSLAY_SLAB_POOL_CLASS_COUNT ) {
+        return pool->map ( pool->user_data, size, false );
+    }
+    wslay_slab_pool_lock ( pool );
+    void * block = pool->free_lists[class];
+    if ( block != NULL ) {
+        pool->free_lists[class] = * ( void ** ) block;
+    } else {
+        block = wslay_slab_pool_carve ( pool, class );
+    }
+    wslay_slab_pool_unlock ( pool );
+    return block;
+}
+
+static void wslay_slab_pool_free ( void * user_data, void * ptr, size_t size )
+{
+    wslay_slab_pool * pool = user_data;
+    unsigned int class = wslay_slab_pool_size_class ( size );
+    if ( class >= WSLAY_SLAB_POOL_CLASS_COUNT ) {
+        pool->unmap ( pool->user_data, ptr, size, false );
+        return;
+    }
+    wslay_slab_pool_lock ( pool );
+    * ( void ** ) ptr = pool->free_lists[class];
+    pool->free_lists[class] = ptr;
+    wslay_slab_pool_unlock ( pool );
+}
+
+static void * wslay_slab_pool_realloc ( void * user_data, void * ptr, size_t old_size, size_t size )
+{
+    unsigned int class = wslay_slab_pool_size_class ( size );
+    if ( class < WSLAY_SLAB_POOL_CLASS_COUNT && class == wslay_slab_pool_size_class ( old_size ) ) {
+        return ptr;
+    }
+    void * data = wslay_slab_pool_alloc ( user_data, size );
+    if ( data == NULL ) {
+        return NULL;
+    }
+    memcpy ( data, ptr, old_size < size ? old_size : size );
+    wslay_slab_pool_free ( user_data, ptr, old_size );
+    return data;
+}
+
+void wslay_slab_pool_init ( wslay_slab_pool * pool, size_t slab_length, wslay_slab_pool_map_function map,
+                            wslay_slab_pool_unmap_function unmap, void * user_data, bool shared )
+{
+    memset ( pool, 0, sizeof ( wslay_slab_pool ) );
+    pool->allocator.alloc     = wslay_slab_pool_alloc;
+    pool->allocator.realloc   = wslay_slab_pool_realloc;
+    pool->allocator.free      = wslay_slab_pool_free;
+    pool->allocator.user_data = pool;
+    pool->map         = map;
+    pool->unmap       = unmap;
+    pool->user_data   = user_data;
+    pool->slab_length = slab_length;
+    pool->shared      = shared;
+}
+
+void wslay_slab_pool_destroy ( wslay_slab_pool * pool )
+{
+    struct wslay_slab * slab = ( struct wslay_slab * ) pool->slab;
+    while ( slab != NULL ) {
+        struct wslay_slab * next = slab->next;
+        pool->unmap ( pool->user_data, slab, pool->slab_length, true );
+        slab = next;
+    }
+    pool->slab = NULL;
+}
@@ -0,0 +1,76 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef WSLAY_SLAB_POOL_H
+#define WSLAY_SLAB_POOL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "wslay.h"
+#include "allocator.h"
+
+// size classes from 16 bytes to 64 KiB, larger allocations are mapped one by one
+#define WSLAY_SLAB_POOL_CLASS_COUNT 13
+
+/*
+ * Maps length bytes for a slab if slab is true, or for one allocation larger than size classes otherwise.
+ * Returns NULL if out of memory.
+ */
+typedef void * ( * wslay_slab_pool_map_function ) ( void * user_data, size_t length, bool slab );
+
+// Unmaps ptr of length bytes returned by map function with the same slab.
+typedef void ( * wslay_slab_pool_unmap_function ) ( void * user_data, void * ptr, size_t length, bool slab );
+
+/*
+ * Allocator carving blocks of size classes from slabs obtained by map function.
+ * Freed blocks are kept in free lists of size classes, slabs are unmapped by wslay_slab_pool_destroy().
+ * The pools of NUMA nodes and huge pages differ only by their map functions.
+ */
+typedef struct wslay_slab_pool_t {
+    // vtable of the pool, its user_data is the pool
+    wslay_allocator allocator;
+    wslay_slab_pool_map_function map;
+    wslay_slab_pool_unmap_function unmap;
+    // user_data of map and unmap
+    void * user_data;
+    size_t slab_length;
+    // free lists and slabs are guarded by spin lock if the pool is shared by threads
+    bool shared;
+    uint8_t lock;
+    void * free_lists[WSLAY_SLAB_POOL_CLASS_COUNT];
+    // the newest slab, blocks are carved from its end
+    uint8_t * slab;
+    size_t slab_offset;
+    size_t slab_count;
+} wslay_slab_pool;
+
+// Initializes pool embedded in another structure, the first slab is mapped on the first allocation.
+void wslay_slab_pool_init ( wslay_slab_pool * pool, size_t slab_length, wslay_slab_pool_map_function map,
+                            wslay_slab_pool_unmap_function unmap, void * user_data, bool shared );
+
+// Unmaps all slabs of pool, its blocks must not be used anymore.
+void wslay_slab_pool_destroy ( wslay_slab_pool * pool );
+
+#endif
@@ -24,6 +24,17 @@
  * SOFTWARE.
  */
 
+#include <stdbool.h>
+#include <string.h>
+
+#if defined ( __GNUC__ ) && ( defined ( __x86_64__ ) || defined ( __i386__ ) )
+#define WSLAY_UTF8_X86
+#include <immintrin.h>
+#elif defined ( __GNUC__ ) && defined ( __aarch64__ )
+#define WSLAY_UTF8_NEON
+#include <arm_neon.h>
+#endif
+
 #include "utf8.h"
 
 const uint8_t wslay_utf8d[] = {
@@ -52,4 +63,439 @@ const uint8_t wslay_utf8d[] = {
 };
 
 extern inline
-uint32_t decode ( uint32_t * state_ptr, uint32_t * codep_ptr, uint32_t byte );
\ No newline at end of file
+uint32_t decode ( uint32_t * state_ptr, uint32_t * codep_ptr, uint32_t byte );
+
+// Zero key leaves bytes unchanged, so unmasked data passes through the same code.
+static const uint8_t wslay_utf8_no_mask[4] = { 0, 0, 0, 0 };
+
+// Stores the masking key starting at offset to rotated, rotated[0] applies to the first byte.
+static void wslay_utf8_rotate_mask ( uint8_t rotated[4], const uint8_t * mask, uint64_t mask_offset )
+{
+    size_t i;
+    for ( i = 0; i < 4; ++i ) {
+        rotated[i] = mask[ ( mask_offset + i ) % 4];
+    }
+}
+
+/*
+ * Portable implementation: 8 bytes of ASCII are skipped at once between characters,
+ * other bytes are passed through the DFA. mask is rotated, dst can be NULL.
+ */
+static uint32_t wslay_utf8_validate_dfa_rotated ( uint32_t * state_ptr, uint8_t * dst, const uint8_t * data, size_t length,
+                                                  const uint8_t mask[4] )
+{
+    uint32_t state = * state_ptr;
+    uint64_t mask_word;
+    // mask_bytes + n holds 8 bytes of the key starting at n, the skip can start at any offset
+    uint8_t mask_bytes[12];
+    size_t i = 0;
+    memcpy ( mask_bytes, mask, 4 );
+    memcpy ( mask_bytes + 4, mask, 4 );
+    memcpy ( mask_bytes + 8, mask, 4 );
+    while ( i < length ) {
+        if ( state == UTF8_ACCEPT ) {
+            uint64_t word;
+            memcpy ( &mask_word, mask_bytes + i % 4, 8 );
+            while ( i + 8 <= length ) {
+                memcpy ( &word, data + i, 8 );
+                word ^= mask_word;
+                if ( word & 0x8080808080808080ull ) {
+                    break;
+                }
+                if ( dst != NULL ) {
+                    memcpy ( dst + i, &word, 8 );
+                }
+                i += 8;
+            }
+            if ( i == length ) {
+                break;
+            }
+        }
+        uint8_t byte = data[i] ^ mask[i % 4];
+        if ( dst != NULL ) {
+            dst[i] = byte;
+        }
+        state = wslay_utf8d[256 + state + wslay_utf8d[byte]];
+        if ( state == UTF8_REJECT ) {
+            break;
+        }
+        ++i;
+    }
+    * state_ptr = state;
+    return state;
+}
+
+static uint32_t wslay_utf8_validate_dfa ( uint32_t * state_ptr, uint8_t * dst, const uint8_t * data, size_t length,
+                                          const uint8_t * mask, uint64_t mask_offset )
+{
+    uint8_t rotated[4];
+    wslay_utf8_rotate_mask ( rotated, mask != NULL ? mask : wslay_utf8_no_mask, mask_offset );
+    return wslay_utf8_validate_dfa_rotated ( state_ptr, dst, data, length, rotated );
+}
+
+#if defined ( WSLAY_UTF8_X86 ) || defined ( WSLAY_UTF8_NEON )
+
+/*
+ * Vector implementations check blocks by the lookup algorithm of simdjson (Keiser, Lemire):
+ * the high and low nibbles of the previous byte and the high nibble of the current byte are looked up in 3 tables,
+ * a bit remains set in all three results only if the pair of bytes is invalid.
+ * Missing and excess continuation bytes of 3 and 4 byte characters are found by the bytes 2 and 3 positions back.
+ */
+#define TOO_SHORT      ( 1 << 0 )
+#define TOO_LONG       ( 1 << 1 )
+#define OVERLONG_3     ( 1 << 2 )
+#define TOO_LARGE      ( 1 << 3 )
+#define SURROGATE      ( 1 << 4 )
+#define OVERLONG_2     ( 1 << 5 )
+#define TOO_LARGE_1000 ( 1 << 6 )
+#define OVERLONG_4     ( 1 << 6 )
+#define TWO_CONTS      ( 1 << 7 )
+#define CARRY          ( TOO_SHORT | TOO_LONG | TWO_CONTS )
+
+static const uint8_t wslay_utf8_byte_1_high[16] = {
+    // ASCII
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,
+    // continuation
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,
+    // 2 byte lead 1100____, 1101____
+    TOO_SHORT | OVERLONG_2,
+    TOO_SHORT,
+    // 3 byte lead
+    TOO_SHORT | OVERLONG_3 | SURROGATE,
+    // 4 byte lead
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+};
+
+static const uint8_t wslay_utf8_byte_1_low[16] = {
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4,
+    CARRY | OVERLONG_2,
+    CARRY,
+    CARRY,
+    CARRY | TOO_LARGE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,
+    CARRY | TOO_LARGE | TOO_LARGE_1000,
+    CARRY | TOO_LARGE | TOO_LARGE_1000
+};
+
+static const uint8_t wslay_utf8_byte_2_high[16] = {
+    // ASCII
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,
+    // continuation 1000____, 1001____, 101_____
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE  | TOO_LARGE,
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE  | TOO_LARGE,
+    // lead
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+};
+
+// Saturating subtraction leaves a byte nonzero if a lead byte at the end of the block is not complete.
+static const uint8_t wslay_utf8_incomplete[32] = {
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255,
+    255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 0xf0 - 1, 0xe0 - 1, 0xc0 - 1
+};
+
+/*
+ * Checks blocks of data, length is a multiple of the block size.
+ * Unmasked blocks are stored to dst if it is not NULL, mask is rotated.
+ * Returns false if data is not valid, a character not complete at the end is not reported.
+ */
+typedef bool ( * wslay_utf8_blocks ) ( uint8_t * dst, const uint8_t * data, size_t length, const uint8_t mask[4] );
+
+/*
+ * Returns the offset of the character which is not complete at the end of the blocks of length length,
+ * or length if the blocks end with a complete character.
+ */
+static size_t wslay_utf8_incomplete_offset ( const uint8_t * data, size_t length )
+{
+    size_t k;
+    for ( k = 1; k <= 3; ++k ) {
+        uint8_t byte = data[length - k];
+        if ( byte < 0x80 ) {
+            break;
+        }
+        if ( byte >= 0xc0 ) {
+            size_t character_length = byte >= 0xf0 ? 4 : byte >= 0xe0 ? 3 : 2;
+            return character_length > k ? length - k : length;
+        }
+    }
+    return length;
+}
+
+/*
+ * The character started by the previous part is finished by the DFA, then whole blocks are checked by vectors.
+ * The character not complete at the end of the blocks is validated by the DFA again with the tail of data,
+ * taken from dst or unmasked again when dst is NULL.
+ */
+static uint32_t wslay_utf8_validate_vector ( wslay_utf8_blocks blocks, size_t block_size, uint32_t * state_ptr,
+                                             uint8_t * dst, const uint8_t * data, size_t length, const uint8_t * mask, uint64_t mask_offset )
+{
+    uint8_t rotated[4];
+    size_t i = 0;
+    if ( mask == NULL ) {
+        mask = wslay_utf8_no_mask;
+    }
+    wslay_utf8_rotate_mask ( rotated, mask, mask_offset );
+    while ( * state_ptr != UTF8_ACCEPT && * state_ptr != UTF8_REJECT && i < length ) {
+        uint8_t byte = data[i] ^ rotated[i % 4];
+        if ( dst != NULL ) {
+            dst[i] = byte;
+        }
+        * state_ptr = wslay_utf8d[256 + * state_ptr + wslay_utf8d[byte]];
+        ++i;
+    }
+    if ( * state_ptr == UTF8_ACCEPT && length - i >= block_size ) {
+        size_t end = i + ( ( length - i ) & ~ ( block_size - 1 ) );
+        wslay_utf8_rotate_mask ( rotated, mask, mask_offset + i );
+        if ( !blocks ( dst != NULL ? dst + i : NULL, data + i, end - i, rotated ) ) {
+            * state_ptr = UTF8_REJECT;
+            return UTF8_REJECT;
+        }
+        // Blocks are unmasked only in dst, without it the last 3 bytes are unmasked again.
+        uint8_t tail[3];
+        size_t k;
+        if ( dst != NULL ) {
+            memcpy ( tail, dst + end - 3, 3 );
+        } else {
+            wslay_utf8_rotate_mask ( rotated, mask, mask_offset + end - 3 );
+            for ( k = 0; k < 3; ++k ) {
+                tail[k] = data[end - 3 + k] ^ rotated[k];
+            }
+        }
+        k = wslay_utf8_incomplete_offset ( tail, 3 );
+        wslay_utf8_validate_dfa_rotated ( state_ptr, NULL, tail + k, 3 - k, wslay_utf8_no_mask );
+        i = end;
+    }
+    wslay_utf8_rotate_mask ( rotated, mask, mask_offset + i );
+    return wslay_utf8_validate_dfa_rotated ( state_ptr, dst != NULL ? dst + i : NULL, data + i, length - i, rotated );
+}
+
+#endif
+
+#ifdef WSLAY_UTF8_X86
+
+__attribute__ ( ( target ( "sse4.1" ) ) )
+static bool wslay_utf8_blocks_sse ( uint8_t * dst, const uint8_t * data, size_t length, const uint8_t mask[4] )
+{
+    const __m128i byte_1_high = _mm_loadu_si128 ( ( const __m128i * ) wslay_utf8_byte_1_high );
+    const __m128i byte_1_low  = _mm_loadu_si128 ( ( const __m128i * ) wslay_utf8_byte_1_low );
+    const __m128i byte_2_high = _mm_loadu_si128 ( ( const __m128i * ) wslay_utf8_byte_2_high );
+    const __m128i incomplete  = _mm_loadu_si128 ( ( const __m128i * ) ( wslay_utf8_incomplete + 16 ) );
+    const __m128i nibble      = _mm_set1_epi8 ( 0x0f );
+    const __m128i third       = _mm_set1_epi8 ( 0xe0 - 0x80 );
+    const __m128i fourth      = _mm_set1_epi8 ( 0xf0 - 0x80 );
+    const __m128i high        = _mm_set1_epi8 ( ( char ) 0x80 );
+    int32_t mask_word;
+    memcpy ( &mask_word, mask, 4 );
+    const __m128i key = _mm_set1_epi32 ( mask_word );
+    __m128i prev = _mm_setzero_si128();
+    __m128i prev_incomplete = _mm_setzero_si128();
+    __m128i error = _mm_setzero_si128();
+    size_t i;
+    for ( i = 0; i < length; i += 16 ) {
+        __m128i input = _mm_xor_si128 ( _mm_loadu_si128 ( ( const __m128i * ) ( data + i ) ), key );
+        if ( dst != NULL ) {
+            _mm_storeu_si128 ( ( __m128i * ) ( dst + i ), input );
+        }
+        if ( _mm_movemask_epi8 ( input ) == 0 ) {
+            error = _mm_or_si128 ( error, prev_incomplete );
+            prev_incomplete = _mm_setzero_si128();
+        } else {
+            __m128i prev1 = _mm_alignr_epi8 ( input, prev, 15 );
+            __m128i prev2 = _mm_alignr_epi8 ( input, prev, 14 );
+            __m128i prev3 = _mm_alignr_epi8 ( input, prev, 13 );
+            __m128i special = _mm_and_si128 (
+                _mm_and_si128 (
+                    _mm_shuffle_epi8 ( byte_1_high, _mm_and_si128 ( _mm_srli_epi16 ( prev1, 4 ), nibble ) ),
+                    _mm_shuffle_epi8 ( byte_1_low, _mm_and_si128 ( prev1, nibble ) )
+                ),
+                _mm_shuffle_epi8 ( byte_2_high, _mm_and_si128 ( _mm_srli_epi16 ( input, 4 ), nibble ) )
+            );
+            __m128i must_be_continuation = _mm_and_si128 (
+                _mm_or_si128 ( _mm_subs_epu8 ( prev2, third ), _mm_subs_epu8 ( prev3, fourth ) ), high
+            );
+            error = _mm_or_si128 ( error, _mm_xor_si128 ( must_be_continuation, special ) );
+            prev_incomplete = _mm_subs_epu8 ( input, incomplete );
+        }
+        prev = input;
+    }
+    return _mm_testz_si128 ( error, error );
+}
+
+__attribute__ ( ( target ( "avx2" ) ) )
+static bool wslay_utf8_blocks_avx2 ( uint8_t * dst, const uint8_t * data, size_t length, const uint8_t mask[4] )
+{
+    const __m256i byte_1_high = _mm256_broadcastsi128_si256 ( _mm_loadu_si128 ( ( const __m128i * ) wslay_utf8_byte_1_high ) );
+    const __m256i byte_1_low  = _mm256_broadcastsi128_si256 ( _mm_loadu_si128 ( ( const __m128i * ) wslay_utf8_byte_1_low ) );
+    const __m256i byte_2_high = _mm256_broadcastsi128_si256 ( _mm_loadu_si128 ( ( const __m128i * ) wslay_utf8_byte_2_high ) );
+    const __m256i incomplete  = _mm256_loadu_si256 ( ( const __m256i * ) wslay_utf8_incomplete );
+    const __m256i nibble      = _mm256_set1_epi8 ( 0x0f );
+    const __m256i third       = _mm256_set1_epi8 ( 0xe0 - 0x80 );
+    const __m256i fourth      = _mm256_set1_epi8 ( 0xf0 - 0x80 );
+    const __m256i high        = _mm256_set1_epi8 ( ( char ) 0x80 );
+    int32_t mask_word;
+    memcpy ( &mask_word, mask, 4 );
+    const __m256i key = _mm256_set1_epi32 ( mask_word );
+    __m256i prev = _mm256_setzero_si256();
+    __m256i prev_incomplete = _mm256_setzero_si256();
+    __m256i error = _mm256_setzero_si256();
+    size_t i;
+    for ( i = 0; i < length; i += 32 ) {
+        __m256i input = _mm256_xor_si256 ( _mm256_loadu_si256 ( ( const __m256i * ) ( data + i ) ), key );
+        if ( dst != NULL ) {
+            _mm256_storeu_si256 ( ( __m256i * ) ( dst + i ), input );
+        }
+        if ( _mm256_movemask_epi8 ( input ) == 0 ) {
+            error = _mm256_or_si256 ( error, prev_incomplete );
+            prev_incomplete = _mm256_setzero_si256();
+        } else {
+            // the high half of prev followed by the low half of input, shifted into each lane
+            __m256i shifted = _mm256_permute2x128_si256 ( prev, input, 0x21 );
+            __m256i prev1 = _mm256_alignr_epi8 ( input, shifted, 15 );
+            __m256i prev2 = _mm256_alignr_epi8 ( input, shifted, 14 );
+            __m256i prev3 = _mm256_alignr_epi8 ( input, shifted, 13 );
+            __m256i special = _mm256_and_si256 (
+                _mm256_and_si256 (
+                    _mm256_shuffle_epi8 ( byte_1_high, _mm256_and_si256 ( _mm256_srli_epi16 ( prev1, 4 ), nibble ) ),
+                    _mm256_shuffle_epi8 ( byte_1_low, _mm256_and_si256 ( prev1, nibble ) )
+                ),
+                _mm256_shuffle_epi8 ( byte_2_high, _mm256_and_si256 ( _mm256_srli_epi16 ( input, 4 ), nibble ) )
+            );
+            __m256i must_be_continuation = _mm256_and_si256 (
+                _mm256_or_si256 ( _mm256_subs_epu8 ( prev2, third ), _mm256_subs_epu8 ( prev3, fourth ) ), high
+            );
+            error = _mm256_or_si256 ( error, _mm256_xor_si256 ( must_be_continuation, special ) );
+            prev_incomplete = _mm256_subs_epu8 ( input, incomplete );
+        }
+        prev = input;
+    }
+    return _mm256_testz_si256 ( error, error );
+}
+
+static uint32_t wslay_utf8_validate_sse ( uint32_t * state_ptr, uint8_t * dst, const uint8_t * data, size_t length,
+                                          const uint8_t * mask, uint64_t mask_offset )
+{
+    return wslay_utf8_validate_vector ( wslay_utf8_blocks_sse, 16, state_ptr, dst, data, length, mask, mask_offset );
+}
+
+static uint32_t wslay_utf8_validate_avx2 ( uint32_t * state_ptr, uint8_t * dst, const uint8_t * data, size_t length,
+                                           const uint8_t * mask, uint64_t mask_offset )
+{
+    return wslay_utf8_validate_vector ( wslay_utf8_blocks_avx2, 32, state_ptr, dst, data, length, mask, mask_offset );
+}
+
+#endif
+
+#ifdef WSLAY_UTF8_NEON
+
+static bool wslay_utf8_blocks_neon ( uint8_t * dst, const uint8_t * data, size_t length, const uint8_t mask[4] )
+{
+    const uint8x16_t byte_1_high = vld1q_u8 ( wslay_utf8_byte_1_high );
+    const uint8x16_t byte_1_low  = vld1q_u8 ( wslay_utf8_byte_1_low );
+    const uint8x16_t byte_2_high = vld1q_u8 ( wslay_utf8_byte_2_high );
+    const uint8x16_t incomplete  = vld1q_u8 ( wslay_utf8_incomplete + 16 );
+    const uint8x16_t nibble      = vdupq_n_u8 ( 0x0f );
+    const uint8x16_t third       = vdupq_n_u8 ( 0xe0 - 0x80 );
+    const uint8x16_t fourth      = vdupq_n_u8 ( 0xf0 - 0x80 );
+    const uint8x16_t high        = vdupq_n_u8 ( 0x80 );
+    uint32_t mask_word;
+    memcpy ( &mask_word, mask, 4 );
+    const uint8x16_t key = vreinterpretq_u8_u32 ( vdupq_n_u32 ( mask_word ) );
+    uint8x16_t prev = vdupq_n_u8 ( 0 );
+    uint8x16_t prev_incomplete = vdupq_n_u8 ( 0 );
+    uint8x16_t error = vdupq_n_u8 ( 0 );
+    size_t i;
+    for ( i = 0; i < length; i += 16 ) {
+        uint8x16_t input = veorq_u8 ( vld1q_u8 ( data + i ), key );
+        if ( dst != NULL ) {
+            vst1q_u8 ( dst + i, input );
+        }
+        if ( vmaxvq_u8 ( input ) < 0x80 ) {
+            error = vorrq_u8 ( error, prev_incomplete );
+            prev_incomplete = vdupq_n_u8 ( 0 );
+        } else {
+            uint8x16_t prev1 = vextq_u8 ( prev, input, 15 );
+            uint8x16_t prev2 = vextq_u8 ( prev, input, 14 );
+            uint8x16_t prev3 = vextq_u8 ( prev, input, 13 );
+            uint8x16_t special = vandq_u8 (
+                vandq_u8 (
+                    vqtbl1q_u8 ( byte_1_high, vshrq_n_u8 ( prev1, 4 ) ),
+                    vqtbl1q_u8 ( byte_1_low, vandq_u8 ( prev1, nibble ) )
+                ),
+                vqtbl1q_u8 ( byte_2_high, vshrq_n_u8 ( input, 4 ) )
+            );
+            uint8x16_t must_be_continuation = vandq_u8 (
+                vorrq_u8 ( vqsubq_u8 ( prev2, third ), vqsubq_u8 ( prev3, fourth ) ), high
+            );
+            error = vorrq_u8 ( error, veorq_u8 ( must_be_continuation, special ) );
+            prev_incomplete = vqsubq_u8 ( input, incomplete );
+        }
+        prev = input;
+    }
+    return vmaxvq_u8 ( error ) == 0;
+}
+
+static uint32_t wslay_utf8_validate_neon ( uint32_t * state_ptr, uint8_t * dst, const uint8_t * data, size_t length,
+                                           const uint8_t * mask, uint64_t mask_offset )
+{
+    return wslay_utf8_validate_vector ( wslay_utf8_blocks_neon, 16, state_ptr, dst, data, length, mask, mask_offset );
+}
+
+#endif
+
+size_t wslay_utf8_get_validators ( wslay_utf8_validator * validators, size_t length )
+{
+    wslay_utf8_validator supported[3];
+    size_t count = 0;
+#if defined ( WSLAY_UTF8_X86 )
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports ( "avx2" ) ) {
+        supported[count++] = wslay_utf8_validate_avx2;
+    }
+    if ( __builtin_cpu_supports ( "sse4.1" ) ) {
+        supported[count++] = wslay_utf8_validate_sse;
+    }
+#elif defined ( WSLAY_UTF8_NEON )
+    supported[count++] = wslay_utf8_validate_neon;
+#endif
+    supported[count++] = wslay_utf8_validate_dfa;
+    if ( length > count ) {
+        length = count;
+    }
+    memcpy ( validators, supported, length * sizeof ( wslay_utf8_validator ) );
+    return count;
+}
+
+static uint32_t wslay_utf8_validate_resolve ( uint32_t * state_ptr, uint8_t * dst, const uint8_t * data, size_t length,
+                                              const uint8_t * mask, uint64_t mask_offset );
+
+// All threads resolve the same implementation, so the relaxed race on the first calls is harmless.
+static wslay_utf8_validator wslay_utf8_validator_selected = wslay_utf8_validate_resolve;
+
+static uint32_t wslay_utf8_validate_resolve ( uint32_t * state_ptr, uint8_t * dst, const uint8_t * data, size_t length,
+                                              const uint8_t * mask, uint64_t mask_offset )
+{
+    wslay_utf8_validator validator;
+    wslay_utf8_get_validators ( &validator, 1 );
+    __atomic_store_n ( &wslay_utf8_validator_selected, validator, __ATOMIC_RELAXED );
+    return validator ( state_ptr, dst, data, length, mask, mask_offset );
+}
+
+uint32_t wslay_utf8_validate ( uint32_t * state_ptr, const uint8_t * data, size_t length )
+{
+    return __atomic_load_n ( &wslay_utf8_validator_selected, __ATOMIC_RELAXED ) ( state_ptr, NULL, data, length, NULL, 0 );
+}
+
+uint32_t wslay_utf8_validate_copy ( uint32_t * state_ptr, uint8_t * dst, const uint8_t * data, size_t length,
+                                    const uint8_t * mask, uint64_t mask_offset )
+{
+    return __atomic_load_n ( &wslay_utf8_validator_selected, __ATOMIC_RELAXED ) ( state_ptr, dst, data, length, mask, mask_offset );
+}
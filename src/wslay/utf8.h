@@ -27,6 +27,7 @@
 #define WSLAY_UTF8_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 #define UTF8_ACCEPT 0
 #define UTF8_REJECT 12
@@ -51,4 +52,34 @@ uint32_t decode ( uint32_t * state_ptr, uint32_t * codep_ptr, uint32_t byte )
     return state;
 }
 
+/*
+ * Implementation of wslay_utf8_validate_copy(), dst can be NULL to validate only.
+ */
+typedef uint32_t ( * wslay_utf8_validator ) ( uint32_t * state_ptr, uint8_t * dst, const uint8_t * data, size_t length,
+                                              const uint8_t * mask, uint64_t mask_offset );
+
+/*
+ * Validates data of length length continuing from *state_ptr, so a message can be validated part by part.
+ * Code points are not decoded: ASCII is skipped by words and multibyte sequences are range checked
+ * by SSE4.1, AVX2 or NEON when the CPU supports them, the implementation is selected on the first call.
+ *
+ * Returns the new state stored to *state_ptr: UTF8_ACCEPT, UTF8_REJECT, or an intermediate state
+ * if data ends inside a character.
+ */
+uint32_t wslay_utf8_validate ( uint32_t * state_ptr, const uint8_t * data, size_t length );
+
+/*
+ * Validates data like wslay_utf8_validate() and copies it to dst in the same pass, dst can be equal to data.
+ * If mask is not NULL, data is unmasked while it is copied: the masking key mask[( mask_offset + i ) % 4] applies to data[i].
+ * If data is rejected, the bytes of dst are unspecified.
+ */
+uint32_t wslay_utf8_validate_copy ( uint32_t * state_ptr, uint8_t * dst, const uint8_t * data, size_t length,
+                                    const uint8_t * mask, uint64_t mask_offset );
+
+/*
+ * Stores up to length implementations supported by the CPU to validators, the best first.
+ * Returns the number of implementations, the last one is the portable DFA.
+ */
+size_t wslay_utf8_get_validators ( wslay_utf8_validator * validators, size_t length );
+
 #endif
\ No newline at end of file
@@ -0,0 +1,303 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <string.h>
+#include <stdio.h>
+
+#include "zstd_ext.h"
+
+#include <talloc2/tree.h>
+#include <talloc2/ext/destructor.h>
+
+static uint8_t wslay_zstd_shared_free ( void * data )
+{
+    wslay_zstd_shared * shared = data;
+    ZSTD_freeCDict ( shared->cdict );
+    ZSTD_freeDDict ( shared->ddict );
+    return 0;
+}
+
+wslay_zstd_shared * wslay_zstd_shared_new ( void * ctx, const void * dictionary, size_t dictionary_length, int level )
+{
+    uint32_t dictionary_id = 0;
+    if ( dictionary != NULL ) {
+        dictionary_id = ZSTD_getDictID_fromDict ( dictionary, dictionary_length );
+        if ( dictionary_id == 0 ) {
+            return NULL;
+        }
+    }
+    wslay_zstd_shared * shared = talloc_zero ( ctx, sizeof ( wslay_zstd_shared ) );
+    if ( shared == NULL ) {
+        return NULL;
+    }
+    if ( talloc_set_destructor ( shared, wslay_zstd_shared_free ) != 0 ) {
+        talloc_free ( shared );
+        return NULL;
+    }
+    shared->dictionary_id = dictionary_id;
+    shared->level         = level;
+    shared->window_log    = WSLAY_ZSTD_WINDOW_LOG;
+    if ( dictionary != NULL ) {
+        shared->cdict = ZSTD_createCDict ( dictionary, dictionary_length, level );
+        shared->ddict = ZSTD_createDDict ( dictionary, dictionary_length );
+        if ( shared->cdict == NULL || shared->ddict == NULL ) {
+            talloc_free ( shared );
+            return NULL;
+        }
+    }
+    return shared;
+}
+
+int wslay_zstd_shared_set_window_log ( wslay_zstd_shared * shared, int window_log )
+{
+    // 0 is accepted by zstd as its default, which would not bound the window. Decoder accepts the same range as encoder.
+    ZSTD_bounds bounds = ZSTD_cParam_getBounds ( ZSTD_c_windowLog );
+    if ( ZSTD_isError ( bounds.error ) || window_log < bounds.lowerBound || window_log > bounds.upperBound ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    shared->window_log = window_log;
+    return 0;
+}
+
+/*
+ * Parses element "x-wslay-zstd; dict=<id>", stores the dictionary identifier or 0 if there is no dict parameter.
+ * Returns 0 if it succeeds or WSLAY_ERR_INVALID_ARGUMENT.
+ */
+static int wslay_zstd_parse_element ( const char * element, size_t element_length, uint32_t * dictionary_id )
+{
+    const char * end = element + element_length;
+    const char * param = memchr ( element, ';', element_length );
+    *dictionary_id = 0;
+    if ( param == NULL ) {
+        return 0;
+    }
+    param ++;
+    while ( param < end && ( *param == ' ' || *param == '\t' ) ) {
+        param ++;
+    }
+    if ( end - param < 6 || memcmp ( param, "dict=", 5 ) != 0 ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    uint64_t value = 0;
+    for ( param += 5; param < end && *param != ' ' && *param != '\t'; param ++ ) {
+        if ( *param < '0' || *param > '9' || value > UINT32_MAX / 10 ) {
+            return WSLAY_ERR_INVALID_ARGUMENT;
+        }
+        value = value * 10 + ( *param - '0' );
+    }
+    while ( param < end && ( *param == ' ' || *param == '\t' ) ) {
+        param ++;
+    }
+    if ( param != end || value == 0 || value > UINT32_MAX ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    *dictionary_id = value;
+    return 0;
+}
+
+static ssize_t wslay_zstd_format_element ( uint32_t dictionary_id, char * buf, size_t length )
+{
+    int r;
+    if ( dictionary_id != 0 ) {
+        r = snprintf ( buf, length, "%s; dict=%u", WSLAY_ZSTD_TOKEN, ( unsigned int ) dictionary_id );
+    } else {
+        r = snprintf ( buf, length, "%s", WSLAY_ZSTD_TOKEN );
+    }
+    if ( r < 0 || ( size_t ) r >= length ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    return r;
+}
+
+static uint8_t wslay_zstd_context_free ( void * data )
+{
+    wslay_zstd_context * ctx = data;
+    ZSTD_freeCCtx ( ctx->cctx );
+    ZSTD_freeDStream ( ctx->dstream );
+    return 0;
+}
+
+wslay_zstd_context * wslay_zstd_context_new ( void * ctx, wslay_zstd_shared * shared, bool dictionary )
+{
+    wslay_zstd_context * zstd_ctx = talloc_zero ( ctx, sizeof ( wslay_zstd_context ) );
+    if ( zstd_ctx == NULL ) {
+        return NULL;
+    }
+    if ( talloc_set_destructor ( zstd_ctx, wslay_zstd_context_free ) != 0 ) {
+        talloc_free ( zstd_ctx );
+        return NULL;
+    }
+    zstd_ctx->shared     = shared;
+    zstd_ctx->dictionary = dictionary;
+    return zstd_ctx;
+}
+
+static ssize_t wslay_zstd_extension_offer ( struct wslay_event_context_t * ctx, void * user_data, char * buf, size_t length )
+{
+    const wslay_zstd_shared * shared = user_data;
+    ( void ) ctx;
+    return wslay_zstd_format_element ( shared->dictionary_id, buf, length );
+}
+
+static int wslay_zstd_extension_accept ( struct wslay_event_context_t * ctx, void * user_data, const char * element, size_t element_length,
+        char * response, size_t * response_length, void ** data )
+{
+    wslay_zstd_shared * shared = user_data;
+    uint32_t dictionary_id;
+    if ( wslay_zstd_parse_element ( element, element_length, &dictionary_id ) != 0 ) {
+        return 1;
+    }
+    // Dictionary is used only if both ends have the same one.
+    bool dictionary = dictionary_id != 0 && dictionary_id == shared->dictionary_id;
+    ssize_t length = wslay_zstd_format_element ( dictionary ? dictionary_id : 0, response, *response_length );
+    if ( length < 0 ) {
+        return length;
+    }
+    * data = wslay_zstd_context_new ( ctx, shared, dictionary );
+    if ( * data == NULL ) {
+        return WSLAY_ERR_NOMEM;
+    }
+    * response_length = length;
+    return 0;
+}
+
+static int wslay_zstd_extension_confirm ( struct wslay_event_context_t * ctx, void * user_data, const char * element, size_t element_length, void ** data )
+{
+    wslay_zstd_shared * shared = user_data;
+    uint32_t dictionary_id;
+    if ( wslay_zstd_parse_element ( element, element_length, &dictionary_id ) != 0 ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    if ( dictionary_id != 0 && dictionary_id != shared->dictionary_id ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    * data = wslay_zstd_context_new ( ctx, shared, dictionary_id != 0 );
+    return * data == NULL ? WSLAY_ERR_NOMEM : 0;
+}
+
+static int wslay_zstd_extension_encode ( void * data, uint8_t opcode, const uint8_t * msg, size_t length, void * parent, uint8_t ** result, size_t * result_length )
+{
+    wslay_zstd_context * ctx = data;
+    wslay_zstd_shared * shared = ctx->shared;
+    ( void ) opcode;
+    if ( ctx->cctx == NULL ) {
+        ctx->cctx = ZSTD_createCCtx();
+        if ( ctx->cctx == NULL ) {
+            return WSLAY_ERR_NOMEM;
+        }
+        // Window of the frames is limited by window_log, which the peer accepts.
+        if (
+            ZSTD_isError ( ZSTD_CCtx_setParameter ( ctx->cctx, ZSTD_c_compressionLevel, shared->level ) ) ||
+            ZSTD_isError ( ZSTD_CCtx_setParameter ( ctx->cctx, ZSTD_c_windowLog, shared->window_log ) ) ||
+            ( ctx->dictionary && ZSTD_isError ( ZSTD_CCtx_refCDict ( ctx->cctx, shared->cdict ) ) )
+        ) {
+            return WSLAY_ERR_INVALID_ARGUMENT;
+        }
+    }
+    size_t capacity = ZSTD_compressBound ( length );
+    uint8_t * buf = talloc ( parent, capacity );
+    if ( buf == NULL ) {
+        return WSLAY_ERR_NOMEM;
+    }
+    // Each message is a separate zstd frame, so contexts do not keep compression history.
+    size_t r = ZSTD_compress2 ( ctx->cctx, buf, capacity, msg, length );
+    if ( ZSTD_isError ( r ) ) {
+        talloc_free ( buf );
+        return WSLAY_ERR_NOMEM;
+    }
+    if ( r >= length ) {
+        talloc_free ( buf );
+        return 1;
+    }
+    * result        = buf;
+    * result_length = r;
+    return 0;
+}
+
+static int wslay_zstd_extension_decode_input ( void * data, const uint8_t * input, size_t length, bool fin )
+{
+    wslay_zstd_context * ctx = data;
+    if ( ctx->dstream == NULL ) {
+        ctx->dstream = ZSTD_createDStream();
+        if ( ctx->dstream == NULL ) {
+            return WSLAY_ERR_NOMEM;
+        }
+        // Peer must not make the context allocate a window larger than the negotiated one.
+        if ( ZSTD_isError ( ZSTD_DCtx_setParameter ( ctx->dstream, ZSTD_d_windowLogMax, ctx->shared->window_log ) ) ) {
+            return WSLAY_ERR_INVALID_ARGUMENT;
+        }
+        if ( ctx->dictionary && ZSTD_isError ( ZSTD_DCtx_refDDict ( ctx->dstream, ctx->shared->ddict ) ) ) {
+            return WSLAY_ERR_NOMEM;
+        }
+    }
+    ctx->input.src  = input;
+    ctx->input.size = length;
+    ctx->input.pos  = 0;
+    ctx->input_fin  = fin;
+    return 0;
+}
+
+static ssize_t wslay_zstd_extension_decode_read ( void * data, uint8_t * buf, size_t length )
+{
+    wslay_zstd_context * ctx = data;
+    ZSTD_outBuffer output = { buf, length, 0 };
+    if ( ctx->frame_end ) {
+        // Message is a single zstd frame.
+        return ctx->input.pos == ctx->input.size ? 0 : WSLAY_ERR_PROTO;
+    }
+    while ( output.pos == 0 ) {
+        size_t r = ZSTD_decompressStream ( ctx->dstream, &output, &ctx->input );
+        if ( ZSTD_isError ( r ) ) {
+            return WSLAY_ERR_PROTO;
+        }
+        ctx->frame_end = r == 0;
+        if ( output.pos == 0 && ctx->input.pos == ctx->input.size ) {
+            break;
+        }
+    }
+    if ( output.pos == 0 && ctx->input_fin && !ctx->frame_end ) {
+        // Message ends in the middle of zstd frame.
+        return WSLAY_ERR_PROTO;
+    }
+    return output.pos;
+}
+
+static void wslay_zstd_extension_decode_end ( void * data )
+{
+    wslay_zstd_context * ctx = data;
+    ctx->frame_end = false;
+    ZSTD_DCtx_reset ( ctx->dstream, ZSTD_reset_session_only );
+}
+
+const wslay_event_extension wslay_zstd_extension = {
+    WSLAY_ZSTD_TOKEN,
+    WSLAY_ZSTD_RSV,
+    wslay_zstd_extension_offer,
+    wslay_zstd_extension_accept,
+    wslay_zstd_extension_confirm,
+    wslay_zstd_extension_encode,
+    wslay_zstd_extension_decode_input,
+    wslay_zstd_extension_decode_read,
+    wslay_zstd_extension_decode_end
+};
@@ -0,0 +1,106 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#ifndef WSLAY_ZSTD_EXT_H
+#define WSLAY_ZSTD_EXT_H
+
+#include "wslay.h"
+#include "extension.h"
+
+#include <zstd.h>
+
+// Private extension token, both ends must be built with WSLAY_ZSTD.
+#define WSLAY_ZSTD_TOKEN "x-wslay-zstd"
+
+// RSV1 bit marks compressed message, so the extension can not be enabled together with permessage-deflate.
+#define WSLAY_ZSTD_RSV 4
+
+/*
+ * Default base 2 logarithm of the window of zstd frames, 128 KiB.
+ * Each context keeps the decompression window of this size while the connection is open.
+ */
+#define WSLAY_ZSTD_WINDOW_LOG 17
+
+/*
+ * Settings shared by all contexts using the extension and the dictionary digested once.
+ * Contexts only read it after it is set up, so contexts using the same shared state can be used by different threads.
+ */
+typedef struct wslay_zstd_shared_t {
+    // digested dictionary, NULL if messages are compressed without dictionary
+    ZSTD_CDict * cdict;
+    ZSTD_DDict * ddict;
+    // identifier of the dictionary negotiated in the opening handshake, 0 without dictionary
+    uint32_t dictionary_id;
+    int level;
+    // frames are compressed with this window log, frames of the peer with larger window are rejected
+    int window_log;
+} wslay_zstd_shared;
+
+// Compression and decompression state of one context.
+typedef struct wslay_zstd_context_t {
+    wslay_zstd_shared * shared;
+    // messages are compressed with the dictionary of shared state
+    bool dictionary;
+    // allocated on the first sent message with level and window log of shared state
+    ZSTD_CCtx * cctx;
+    // allocated on the first compressed message
+    ZSTD_DStream * dstream;
+    ZSTD_inBuffer input;
+    // the input is the last part of the message
+    bool input_fin;
+    // the zstd frame of the message is complete
+    bool frame_end;
+} wslay_zstd_context;
+
+// zstd compression as extension of event-based API, user_data of negotiation is wslay_zstd_shared.
+extern const wslay_event_extension wslay_zstd_extension;
+
+/*
+ * Allocates shared state of zstd extension with compression level.
+ * dictionary of length dictionary_length is trained by "zstd --train" or ZDICT_trainFromBuffer(),
+ * its identifier is offered in the opening handshake and it is used only if the peer has the same dictionary.
+ * dictionary can be NULL.
+ *
+ * The shared state must be freed after all contexts using it.
+ * wslay_zstd_shared_new() returns NULL if dictionary has no identifier or out of memory.
+ */
+wslay_zstd_shared * wslay_zstd_shared_new ( void * ctx, const void * dictionary, size_t dictionary_length, int level );
+
+/*
+ * Sets base 2 logarithm of the window of zstd frames, WSLAY_ZSTD_WINDOW_LOG by default.
+ * Both ends must use the same value: a message compressed with larger window is rejected by the peer
+ * and the connection is closed with WSLAY_CODE_INVALID_FRAME_PAYLOAD_DATA.
+ * It should be set before any context using shared state sends or receives a message.
+ *
+ * wslay_zstd_shared_set_window_log() returns 0 if it succeeds or WSLAY_ERR_INVALID_ARGUMENT if window_log is out of range of zstd.
+ */
+int wslay_zstd_shared_set_window_log ( wslay_zstd_shared * shared, int window_log );
+
+/*
+ * Allocates compression and decompression state of one context using shared state, dictionary is set if the peer uses the dictionary of shared.
+ * Negotiation allocates it, it can be enabled by wslay_event_config_enable_extension() without the handshake.
+ */
+wslay_zstd_context * wslay_zstd_context_new ( void * ctx, wslay_zstd_shared * shared, bool dictionary );
+
+#endif
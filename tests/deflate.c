@@ -0,0 +1,177 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <string.h>
+
+#include <CUnit/CUnit.h>
+#include <talloc2/tree.h>
+
+#include <wslay/deflate.h>
+#include "deflate.h"
+
+void test_wslay_deflate_parse_params ( void )
+{
+    struct wslay_deflate_params params;
+    const char offer[] = "x-webkit-deflate-frame, permessage-deflate ; client_max_window_bits; server_no_context_takeover, permessage-deflate";
+    CU_ASSERT ( 0 == wslay_deflate_parse_params ( offer, sizeof ( offer ) - 1, &params ) );
+    CU_ASSERT ( params.server_no_context_takeover );
+    CU_ASSERT ( !params.client_no_context_takeover );
+    CU_ASSERT ( 15 == params.server_max_window_bits );
+    CU_ASSERT ( 15 == params.client_max_window_bits );
+
+    const char response[] = "permessage-deflate; server_max_window_bits=\"10\"; client_max_window_bits=9; client_no_context_takeover";
+    CU_ASSERT ( 0 == wslay_deflate_parse_params ( response, sizeof ( response ) - 1, &params ) );
+    CU_ASSERT ( !params.server_no_context_takeover );
+    CU_ASSERT ( params.client_no_context_takeover );
+    CU_ASSERT ( 10 == params.server_max_window_bits );
+    CU_ASSERT ( 9 == params.client_max_window_bits );
+
+    const char other[] = "x-webkit-deflate-frame";
+    CU_ASSERT ( 1 == wslay_deflate_parse_params ( other, sizeof ( other ) - 1, &params ) );
+
+    const char unknown[] = "permessage-deflate; foo";
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_deflate_parse_params ( unknown, sizeof ( unknown ) - 1, &params ) );
+    const char duplicated[] = "permessage-deflate; server_no_context_takeover; server_no_context_takeover";
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_deflate_parse_params ( duplicated, sizeof ( duplicated ) - 1, &params ) );
+    const char too_large[] = "permessage-deflate; server_max_window_bits=16";
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_deflate_parse_params ( too_large, sizeof ( too_large ) - 1, &params ) );
+    const char no_value[] = "permessage-deflate; server_max_window_bits";
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_deflate_parse_params ( no_value, sizeof ( no_value ) - 1, &params ) );
+}
+
+void test_wslay_deflate_format_params ( void )
+{
+    struct wslay_deflate_params params;
+    char buf[128];
+    wslay_deflate_params_init ( &params );
+    CU_ASSERT ( 18 == wslay_deflate_format_params ( &params, buf, sizeof ( buf ) ) );
+    CU_ASSERT ( 0 == strcmp ( "permessage-deflate", buf ) );
+
+    params.client_no_context_takeover = true;
+    params.server_max_window_bits = 10;
+    const char ans[] = "permessage-deflate; client_no_context_takeover; server_max_window_bits=10";
+    CU_ASSERT ( sizeof ( ans ) - 1 == wslay_deflate_format_params ( &params, buf, sizeof ( buf ) ) );
+    CU_ASSERT ( 0 == strcmp ( ans, buf ) );
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_deflate_format_params ( &params, buf, 20 ) );
+}
+
+void test_wslay_deflate_message ( void )
+{
+    struct wslay_deflate_params params;
+    /* RFC 7692 7.2.3.1 */
+    const uint8_t ans[] = { 0xf2, 0x48, 0xcd, 0xc9, 0xc9, 0x07, 0x00 };
+    uint8_t buf[16];
+    size_t length;
+    wslay_deflate_params_init ( &params );
+    params.server_no_context_takeover = true;
+
+    wslay_deflate_context * ctx = wslay_deflate_context_new ( NULL, &params, true, NULL );
+    CU_ASSERT_FATAL ( ctx != NULL );
+
+    uint8_t * data;
+    CU_ASSERT_FATAL ( 0 == wslay_deflate_message ( ctx, ctx, ( const uint8_t * ) "Hello", 5, &data, &length ) );
+    CU_ASSERT ( sizeof ( ans ) == length );
+    CU_ASSERT ( 0 == memcmp ( ans, data, length ) );
+    talloc_free ( data );
+
+    /* client messages are inflated by server */
+    CU_ASSERT ( 0 == wslay_inflate_set_input ( ctx, ans, 3, false ) );
+    ssize_t r = wslay_inflate_read ( ctx, buf, sizeof ( buf ) );
+    CU_ASSERT_FATAL ( r >= 0 && r <= 5 );
+    length = r;
+    CU_ASSERT ( 0 == wslay_inflate_set_input ( ctx, ans + 3, sizeof ( ans ) - 3, true ) );
+    r = wslay_inflate_read ( ctx, buf + length, sizeof ( buf ) - length );
+    CU_ASSERT ( 5 == length + r );
+    CU_ASSERT ( 0 == wslay_inflate_read ( ctx, buf + 5, sizeof ( buf ) - 5 ) );
+    wslay_inflate_end ( ctx );
+    CU_ASSERT ( 0 == memcmp ( "Hello", buf, 5 ) );
+
+    /* 8 window bits are not supported by zlib deflate */
+    params.server_max_window_bits = 8;
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_deflate_check_params ( &params, true ) );
+    CU_ASSERT ( 0 == wslay_deflate_check_params ( &params, false ) );
+
+    talloc_free ( ctx );
+}
+
+void test_wslay_deflate_pool ( void )
+{
+    struct wslay_deflate_params params;
+    uint8_t * data;
+    size_t length;
+    /* deflate stream with 15 window bits takes 256 KB, inflate stream takes 39 KB */
+    const size_t deflate_memory = 262144, inflate_memory = 39936;
+    wslay_deflate_pool * pool = wslay_deflate_pool_new ( NULL, deflate_memory + inflate_memory );
+    CU_ASSERT_FATAL ( pool != NULL );
+
+    wslay_deflate_params_init ( &params );
+    params.server_no_context_takeover = true;
+    params.client_no_context_takeover = true;
+    wslay_deflate_context * ctx1 = wslay_deflate_context_new ( pool, &params, true, pool );
+    wslay_deflate_context * ctx2 = wslay_deflate_context_new ( pool, &params, true, pool );
+    CU_ASSERT_FATAL ( ctx1 != NULL && ctx2 != NULL );
+    CU_ASSERT ( 0 == wslay_deflate_pool_get_memory_used ( pool ) );
+
+    /* stream is borrowed for each message */
+    CU_ASSERT ( 0 == wslay_deflate_message ( ctx1, ctx1, ( const uint8_t * ) "Hello", 5, &data, &length ) );
+    CU_ASSERT ( 0 == wslay_deflate_message ( ctx2, ctx2, ( const uint8_t * ) "Hello", 5, &data, &length ) );
+    CU_ASSERT ( 0 == wslay_deflate_message ( ctx1, ctx1, ( const uint8_t * ) "Hello", 5, &data, &length ) );
+    CU_ASSERT ( 1 == wslay_deflate_pool_get_miss_count ( pool ) );
+    CU_ASSERT ( 2 == wslay_deflate_pool_get_hit_count ( pool ) );
+    CU_ASSERT ( deflate_memory == wslay_deflate_pool_get_memory_used ( pool ) );
+
+    /* inflate stream is borrowed until the end of message */
+    CU_ASSERT ( 0 == wslay_inflate_set_input ( ctx1, NULL, 0, false ) );
+    CU_ASSERT ( deflate_memory + inflate_memory == wslay_deflate_pool_get_memory_used ( pool ) );
+
+    /* context takeover stream is kept by the context, idle stream is freed for it */
+    wslay_deflate_params_init ( &params );
+    wslay_deflate_context * ctx3 = wslay_deflate_context_new ( pool, &params, false, pool );
+    CU_ASSERT_FATAL ( ctx3 != NULL );
+    CU_ASSERT ( 0 == wslay_deflate_message ( ctx3, ctx3, ( const uint8_t * ) "Hello", 5, &data, &length ) );
+    CU_ASSERT ( 2 == wslay_deflate_pool_get_miss_count ( pool ) );
+    CU_ASSERT ( deflate_memory + inflate_memory == wslay_deflate_pool_get_memory_used ( pool ) );
+
+    /* deflate stream does not fit into the limit anymore */
+    CU_ASSERT ( 1 == wslay_deflate_message ( ctx2, ctx2, ( const uint8_t * ) "Hello", 5, &data, &length ) );
+    CU_ASSERT ( 1 == wslay_deflate_pool_get_fallback_count ( pool ) );
+
+    /* inflate stream is allocated above the limit */
+    CU_ASSERT ( 0 == wslay_inflate_set_input ( ctx2, NULL, 0, false ) );
+    CU_ASSERT ( deflate_memory + 2 * inflate_memory == wslay_deflate_pool_get_memory_used ( pool ) );
+
+    /* idle inflate stream is freed for deflate stream */
+    talloc_free ( ctx3 );
+    wslay_inflate_end ( ctx1 );
+    CU_ASSERT ( 2 * inflate_memory == wslay_deflate_pool_get_memory_used ( pool ) );
+    CU_ASSERT ( 0 == wslay_deflate_message ( ctx2, ctx2, ( const uint8_t * ) "Hello", 5, &data, &length ) );
+    CU_ASSERT ( deflate_memory + inflate_memory == wslay_deflate_pool_get_memory_used ( pool ) );
+
+    /* borrowed streams return to the pool with their contexts */
+    talloc_free ( ctx1 );
+    talloc_free ( ctx2 );
+    CU_ASSERT ( deflate_memory + inflate_memory == wslay_deflate_pool_get_memory_used ( pool ) );
+
+    talloc_free ( pool );
+}
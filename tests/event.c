@@ -23,11 +23,13 @@
  * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 #include <assert.h>
+#include <unistd.h>
 
 #include <CUnit/CUnit.h>
 
 #include <wslay/event.h>
 #include <wslay/context.h>
+#include <wslay/hugepage.h>
 #include "event.h"
 
 struct scripted_data_feed {
@@ -373,6 +375,19 @@ void test_wslay_event_no_more_msg ( void )
     CU_ASSERT ( wslay_event_queue_close ( ctx, 0, NULL, 0 ) == 0 );
     CU_ASSERT ( wslay_event_queue_close ( ctx, 0, NULL, 0 ) != 0 );
 
+    /* every way of queueing refuses the message after close */
+    wslay_event_msg arg = { WSLAY_TEXT_FRAME, ( const uint8_t * ) "Foo", 3 };
+    CU_ASSERT ( WSLAY_ERR_NO_MORE_MSG == wslay_event_queue_msg ( ctx, &arg ) );
+    CU_ASSERT ( WSLAY_ERR_NO_MORE_MSG == wslay_event_queue_keyed_msg ( ctx, &arg, 1 ) );
+    CU_ASSERT ( WSLAY_ERR_NO_MORE_MSG == wslay_event_queue_expiring_msg ( ctx, &arg, 1000 ) );
+    wslay_event_broadcast * broadcast = wslay_event_broadcast_new ( WSLAY_TEXT_FRAME, arg.msg, arg.msg_length, 0 );
+    CU_ASSERT_FATAL ( broadcast != NULL );
+    CU_ASSERT ( WSLAY_ERR_NO_MORE_MSG == wslay_event_queue_broadcast ( ctx, broadcast ) );
+    CU_ASSERT ( 1 == broadcast->refcount );
+    wslay_event_broadcast_release ( broadcast );
+    CU_ASSERT ( 1 == wslay_event_get_queued_msg_count ( ctx ) );
+    CU_ASSERT ( 1 == wslay_event_get_last_msg_id ( ctx ) );
+
     talloc_free ( ctx );
 }
 
@@ -502,3 +517,1653 @@ void test_wslay_event_message_too_big ( void )
 
     talloc_free ( ctx );
 }
+
+void test_wslay_event_send_split_msg ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    const char msg[] = "Hello";
+    wslay_event_msg arg;
+    const uint8_t ans[] = {
+        0x01, 0x02, 0x48, 0x65, /* "He" */
+        0x00, 0x02, 0x6c, 0x6c, /* "ll" */
+        0x80, 0x01, 0x6f /* "o" */
+    };
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    callbacks.send_callback = accumulator_send_callback;
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.acc = &acc;
+
+    wslay_event_context * ctx = wslay_server_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+
+    wslay_event_config_set_max_send_frame_length ( ctx, 2 );
+    memset ( &arg, 0, sizeof ( arg ) );
+    arg.opcode = WSLAY_TEXT_FRAME;
+    arg.msg = ( const uint8_t* ) msg;
+    arg.msg_length = 5;
+    CU_ASSERT ( 0 == wslay_event_queue_msg ( ctx, &arg ) );
+    CU_ASSERT ( 0 == wslay_event_send ( ctx ) );
+    CU_ASSERT ( 0 == wslay_event_get_queued_msg_count ( ctx ) );
+    CU_ASSERT ( 0 == wslay_event_get_queued_msg_length ( ctx ) );
+    CU_ASSERT ( 11 == acc.length );
+    CU_ASSERT ( 0 == memcmp ( ans, acc.buf, acc.length ) );
+
+    talloc_free ( ctx );
+}
+
+static ssize_t ping_accumulator_send_callback ( wslay_event_context * ctx, const uint8_t *buf, size_t len, int flags, void* user_data, bool user_data_sending )
+{
+    struct accumulator *acc = ( ( struct my_user_data* ) user_data )->acc;
+    wslay_event_msg ping = { WSLAY_PING, NULL, 0 };
+    ssize_t r = accumulator_send_callback ( ctx, buf, len, flags, user_data, user_data_sending );
+    /* queue ping just after the first frame */
+    if ( acc->length == 4 ) {
+        CU_ASSERT ( 0 == wslay_event_queue_msg ( ctx, &ping ) );
+    }
+    return r;
+}
+
+void test_wslay_event_send_split_msg_with_ctrl ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    const char msg[] = "Hello";
+    wslay_event_msg arg;
+    const uint8_t ans[] = {
+        0x01, 0x02, 0x48, 0x65, /* "He" */
+        0x89, 0x00, /* unmasked ping */
+        0x00, 0x02, 0x6c, 0x6c, /* "ll" */
+        0x80, 0x01, 0x6f /* "o" */
+    };
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    callbacks.send_callback = ping_accumulator_send_callback;
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.acc = &acc;
+
+    wslay_event_context * ctx = wslay_server_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+
+    wslay_event_config_set_max_send_frame_length ( ctx, 2 );
+    memset ( &arg, 0, sizeof ( arg ) );
+    arg.opcode = WSLAY_TEXT_FRAME;
+    arg.msg = ( const uint8_t* ) msg;
+    arg.msg_length = 5;
+    CU_ASSERT ( 0 == wslay_event_queue_msg ( ctx, &arg ) );
+    CU_ASSERT ( 0 == wslay_event_send ( ctx ) );
+    CU_ASSERT ( 0 == wslay_event_get_queued_msg_count ( ctx ) );
+    CU_ASSERT ( 13 == acc.length );
+    CU_ASSERT ( 0 == memcmp ( ans, acc.buf, acc.length ) );
+
+    talloc_free ( ctx );
+}
+
+void test_wslay_event_send_fragmented_msg_small_buffer ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    const char msg[] = "Hello";
+    struct scripted_data_feed df;
+    struct wslay_event_fragmented_msg arg;
+    const uint8_t ans[] = {
+        0x01, 0x02, 0x48, 0x65, /* "He" */
+        0x00, 0x02, 0x6c, 0x6c, /* "ll" */
+        0x80, 0x01, 0x6f /* "o" */
+    };
+    int i;
+    scripted_data_feed_init ( &df, ( const uint8_t* ) msg, sizeof ( msg ) - 1 );
+    for ( i = 0; i < 5; ++i ) {
+        df.feedseq[i] = 1;
+    }
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    callbacks.send_callback = accumulator_send_callback;
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.acc = &acc;
+
+    wslay_event_context * ctx = wslay_server_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_event_config_set_fragment_buffer_length ( ctx, 0 ) );
+    CU_ASSERT ( 0 == wslay_event_config_set_fragment_buffer_length ( ctx, 2 ) );
+    /* coalescing is limited by the buffer length */
+    wslay_event_config_set_fragment_coalescing ( ctx, 4, 0 );
+
+    memset ( &arg, 0, sizeof ( arg ) );
+    arg.opcode = WSLAY_TEXT_FRAME;
+    arg.source.data = &df;
+    arg.read_callback = scripted_read_callback;
+    CU_ASSERT ( 0 == wslay_event_queue_fragmented_msg ( ctx, &arg ) );
+    CU_ASSERT ( 0 == wslay_event_send ( ctx ) );
+    CU_ASSERT_EQUAL ( 11, acc.length );
+    CU_ASSERT ( 0 == memcmp ( ans, acc.buf, acc.length ) );
+
+    talloc_free ( ctx );
+}
+
+void test_wslay_event_send_fragmented_msg_coalescing ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    const char msg[] = "Hello";
+    struct scripted_data_feed df;
+    struct wslay_event_fragmented_msg arg;
+    const uint8_t ans[] = {
+        0x81, 0x05, 0x48, 0x65, 0x6c, 0x6c, 0x6f /* "Hello" */
+    };
+    scripted_data_feed_init ( &df, ( const uint8_t* ) msg, sizeof ( msg ) - 1 );
+    df.feedseq[0] = 1;
+    df.feedseq[1] = 2;
+    /* no data at the moment */
+    df.feedseq[2] = 0;
+    df.feedseq[3] = 2;
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    callbacks.send_callback = accumulator_send_callback;
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.acc = &acc;
+
+    wslay_event_context * ctx = wslay_server_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+
+    wslay_event_config_set_fragment_coalescing ( ctx, 8, 60000 );
+
+    memset ( &arg, 0, sizeof ( arg ) );
+    arg.opcode = WSLAY_TEXT_FRAME;
+    arg.source.data = &df;
+    arg.read_callback = scripted_read_callback;
+    CU_ASSERT ( 0 == wslay_event_queue_fragmented_msg ( ctx, &arg ) );
+    CU_ASSERT ( 0 == wslay_event_get_send_delay ( ctx ) );
+    /* "Hel" is held until more data is available */
+    CU_ASSERT ( 0 == wslay_event_send ( ctx ) );
+    CU_ASSERT_EQUAL ( 0, acc.length );
+    CU_ASSERT ( wslay_event_want_write ( ctx ) );
+    CU_ASSERT ( 0 < wslay_event_get_send_delay ( ctx ) );
+    CU_ASSERT ( 60000 >= wslay_event_get_send_delay ( ctx ) );
+    CU_ASSERT ( 0 == wslay_event_send ( ctx ) );
+    CU_ASSERT_EQUAL ( 7, acc.length );
+    CU_ASSERT ( 0 == memcmp ( ans, acc.buf, acc.length ) );
+    CU_ASSERT ( !wslay_event_want_write ( ctx ) );
+    CU_ASSERT ( 0 == wslay_event_get_send_delay ( ctx ) );
+
+    talloc_free ( ctx );
+}
+
+void test_wslay_event_send_fragmented_msg_coalescing_deadline ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    const char msg[] = "Hello";
+    struct scripted_data_feed df;
+    struct wslay_event_fragmented_msg arg;
+    const uint8_t ans[] = {
+        0x01, 0x03, 0x48, 0x65, 0x6c, /* "Hel" */
+        0x80, 0x02, 0x6c, 0x6f /* "lo" */
+    };
+    scripted_data_feed_init ( &df, ( const uint8_t* ) msg, sizeof ( msg ) - 1 );
+    df.feedseq[0] = 1;
+    df.feedseq[1] = 2;
+    df.feedseq[2] = 0;
+    df.feedseq[3] = 2;
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    callbacks.send_callback = accumulator_send_callback;
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.acc = &acc;
+
+    wslay_event_context * ctx = wslay_server_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+
+    /* zero delay sends whatever is buffered when the source has no data */
+    wslay_event_config_set_fragment_coalescing ( ctx, 8, 0 );
+
+    memset ( &arg, 0, sizeof ( arg ) );
+    arg.opcode = WSLAY_TEXT_FRAME;
+    arg.source.data = &df;
+    arg.read_callback = scripted_read_callback;
+    CU_ASSERT ( 0 == wslay_event_queue_fragmented_msg ( ctx, &arg ) );
+    CU_ASSERT ( 0 == wslay_event_send ( ctx ) );
+    CU_ASSERT_EQUAL ( 9, acc.length );
+    CU_ASSERT ( 0 == memcmp ( ans, acc.buf, acc.length ) );
+
+    talloc_free ( ctx );
+}
+
+void test_wslay_event_queue_keyed_msg ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    wslay_event_msg arg;
+    const uint8_t ans[] = {
+        0x81, 0x05, 0x48, 0x65, 0x6c, 0x6c, 0x6f, /* "Hello" */
+        0x81, 0x03, 0x42, 0x61, 0x72, /* "Bar" */
+        0x81, 0x03, 0x42, 0x61, 0x7a /* "Baz" */
+    };
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    callbacks.send_callback = accumulator_send_callback;
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.acc = &acc;
+
+    wslay_event_context * ctx = wslay_server_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+
+    memset ( &arg, 0, sizeof ( arg ) );
+    arg.opcode = WSLAY_TEXT_FRAME;
+    arg.msg = ( const uint8_t* ) "Foo";
+    arg.msg_length = 3;
+    CU_ASSERT ( 0 == wslay_event_queue_keyed_msg ( ctx, &arg, 1 ) );
+    arg.msg = ( const uint8_t* ) "Bar";
+    CU_ASSERT ( 0 == wslay_event_queue_keyed_msg ( ctx, &arg, 2 ) );
+    arg.msg = ( const uint8_t* ) "Baz";
+    CU_ASSERT ( 0 == wslay_event_queue_msg ( ctx, &arg ) );
+    /* replaces "Foo" keeping its position */
+    arg.msg = ( const uint8_t* ) "Hello";
+    arg.msg_length = 5;
+    CU_ASSERT ( 0 == wslay_event_queue_keyed_msg ( ctx, &arg, 1 ) );
+    CU_ASSERT ( 3 == wslay_event_get_queued_msg_count ( ctx ) );
+    CU_ASSERT ( 11 == wslay_event_get_queued_msg_length ( ctx ) );
+
+    arg.opcode = WSLAY_PING;
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_event_queue_keyed_msg ( ctx, &arg, 1 ) );
+
+    CU_ASSERT ( 0 == wslay_event_send ( ctx ) );
+    CU_ASSERT ( 0 == wslay_event_get_queued_msg_count ( ctx ) );
+    CU_ASSERT ( 0 == wslay_event_get_queued_msg_length ( ctx ) );
+    CU_ASSERT ( sizeof ( ans ) == acc.length );
+    CU_ASSERT ( 0 == memcmp ( ans, acc.buf, acc.length ) );
+
+    talloc_free ( ctx );
+}
+
+static size_t expired_msg_count;
+
+static void expired_callback ( wslay_event_context * ctx, const wslay_event_msg *arg, void *user_data )
+{
+    CU_ASSERT ( WSLAY_TEXT_FRAME == arg->opcode );
+    CU_ASSERT ( 3 == arg->msg_length );
+    CU_ASSERT ( 0 == memcmp ( "Foo", arg->msg, arg->msg_length ) );
+    ++expired_msg_count;
+}
+
+void test_wslay_event_queue_expiring_msg ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    wslay_event_msg arg;
+    const uint8_t ans[] = {
+        0x81, 0x03, 0x42, 0x61, 0x72 /* "Bar" */
+    };
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    callbacks.send_callback = accumulator_send_callback;
+    callbacks.on_msg_expired_callback = expired_callback;
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.acc = &acc;
+    expired_msg_count = 0;
+
+    wslay_event_context * ctx = wslay_server_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+
+    memset ( &arg, 0, sizeof ( arg ) );
+    arg.opcode = WSLAY_TEXT_FRAME;
+    arg.msg = ( const uint8_t* ) "Foo";
+    arg.msg_length = 3;
+    CU_ASSERT ( 0 == wslay_event_queue_expiring_msg ( ctx, &arg, 1 ) );
+    arg.msg = ( const uint8_t* ) "Bar";
+    /* never expires */
+    CU_ASSERT ( 0 == wslay_event_queue_expiring_msg ( ctx, &arg, 0 ) );
+    CU_ASSERT ( 2 == wslay_event_get_queued_msg_count ( ctx ) );
+    CU_ASSERT ( 6 == wslay_event_get_queued_msg_length ( ctx ) );
+
+    usleep ( 5000 );
+    CU_ASSERT ( 0 == wslay_event_send ( ctx ) );
+    CU_ASSERT ( 0 == wslay_event_get_queued_msg_count ( ctx ) );
+    CU_ASSERT ( 0 == wslay_event_get_queued_msg_length ( ctx ) );
+    CU_ASSERT ( 1 == wslay_event_get_expired_msg_count ( ctx ) );
+    CU_ASSERT ( 1 == expired_msg_count );
+    CU_ASSERT ( sizeof ( ans ) == acc.length );
+    CU_ASSERT ( 0 == memcmp ( ans, acc.buf, acc.length ) );
+
+    talloc_free ( ctx );
+}
+
+void test_wslay_event_queue_msg_with_options ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    wslay_event_msg arg;
+    wslay_event_msg_options options;
+    const uint8_t ans[] = {
+        0x81, 0x03, 0x42, 0x61, 0x72 /* "Bar" */
+    };
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    callbacks.send_callback = accumulator_send_callback;
+    callbacks.on_msg_expired_callback = expired_callback;
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.acc = &acc;
+    expired_msg_count = 0;
+
+    wslay_event_context * ctx = wslay_server_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+
+    memset ( &arg, 0, sizeof ( arg ) );
+    arg.opcode = WSLAY_TEXT_FRAME;
+    arg.msg_length = 3;
+    memset ( &options, 0, sizeof ( options ) );
+    options.keyed = true;
+    options.key = 1;
+    options.ttl = 1;
+    arg.msg = ( const uint8_t* ) "Baz";
+    CU_ASSERT ( 0 == wslay_event_queue_msg_with_options ( ctx, &arg, &options ) );
+    /* replaces "Baz" and never expires */
+    options.ttl = 0;
+    arg.msg = ( const uint8_t* ) "Bar";
+    CU_ASSERT ( 0 == wslay_event_queue_msg_with_options ( ctx, &arg, &options ) );
+    options.key = 2;
+    options.ttl = 1;
+    arg.msg = ( const uint8_t* ) "Foo";
+    CU_ASSERT ( 0 == wslay_event_queue_msg_with_options ( ctx, &arg, &options ) );
+    CU_ASSERT ( 2 == wslay_event_get_queued_msg_count ( ctx ) );
+    CU_ASSERT ( 6 == wslay_event_get_queued_msg_length ( ctx ) );
+
+    arg.opcode = WSLAY_PING;
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_event_queue_msg_with_options ( ctx, &arg, &options ) );
+
+    usleep ( 5000 );
+    CU_ASSERT ( 0 == wslay_event_send ( ctx ) );
+    CU_ASSERT ( 0 == wslay_event_get_queued_msg_count ( ctx ) );
+    CU_ASSERT ( 1 == wslay_event_get_expired_msg_count ( ctx ) );
+    CU_ASSERT ( 1 == expired_msg_count );
+    CU_ASSERT ( sizeof ( ans ) == acc.length );
+    CU_ASSERT ( 0 == memcmp ( ans, acc.buf, acc.length ) );
+
+    talloc_free ( ctx );
+}
+
+void test_wslay_event_cancel_msg ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    wslay_event_msg arg;
+    uint64_t id;
+    const uint8_t ans[] = {
+        0x81, 0x03, 0x46, 0x6f, 0x6f, /* "Foo" */
+        0x81, 0x03, 0x42, 0x61, 0x7a /* "Baz" */
+    };
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    callbacks.send_callback = accumulator_send_callback;
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.acc = &acc;
+
+    wslay_event_context * ctx = wslay_server_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+
+    memset ( &arg, 0, sizeof ( arg ) );
+    arg.opcode = WSLAY_TEXT_FRAME;
+    arg.msg_length = 3;
+    arg.msg = ( const uint8_t* ) "Foo";
+    CU_ASSERT ( 0 == wslay_event_queue_msg ( ctx, &arg ) );
+    CU_ASSERT ( 1 == wslay_event_get_last_msg_id ( ctx ) );
+    arg.msg = ( const uint8_t* ) "Bar";
+    CU_ASSERT ( 0 == wslay_event_queue_msg ( ctx, &arg ) );
+    id = wslay_event_get_last_msg_id ( ctx );
+    CU_ASSERT ( 2 == id );
+    arg.msg = ( const uint8_t* ) "Baz";
+    CU_ASSERT ( 0 == wslay_event_queue_msg ( ctx, &arg ) );
+
+    CU_ASSERT ( 0 == wslay_event_cancel_msg ( ctx, id ) );
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_event_cancel_msg ( ctx, id ) );
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_event_cancel_msg ( ctx, 42 ) );
+    CU_ASSERT ( 2 == wslay_event_get_queued_msg_count ( ctx ) );
+    CU_ASSERT ( 6 == wslay_event_get_queued_msg_length ( ctx ) );
+
+    CU_ASSERT ( 0 == wslay_event_send ( ctx ) );
+    CU_ASSERT ( 0 == wslay_event_get_queued_msg_count ( ctx ) );
+    CU_ASSERT ( sizeof ( ans ) == acc.length );
+    CU_ASSERT ( 0 == memcmp ( ans, acc.buf, acc.length ) );
+
+    talloc_free ( ctx );
+}
+
+static ssize_t cancel_accumulator_send_callback ( wslay_event_context * ctx, const uint8_t *buf, size_t len, int flags, void* user_data, bool user_data_sending )
+{
+    struct accumulator *acc = ( ( struct my_user_data* ) user_data )->acc;
+    ssize_t r = accumulator_send_callback ( ctx, buf, len, flags, user_data, user_data_sending );
+    /* cancel message just after the first frame */
+    if ( acc->length == 4 ) {
+        CU_ASSERT ( 0 == wslay_event_cancel_msg ( ctx, wslay_event_get_last_msg_id ( ctx ) ) );
+    }
+    return r;
+}
+
+void test_wslay_event_cancel_started_msg ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    const char msg[] = "Hello";
+    wslay_event_msg arg;
+    const uint8_t ans[] = {
+        0x01, 0x02, 0x48, 0x65, /* "He" */
+        0x80, 0x00 /* empty final frame */
+    };
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    callbacks.send_callback = cancel_accumulator_send_callback;
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.acc = &acc;
+
+    wslay_event_context * ctx = wslay_server_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+
+    wslay_event_config_set_max_send_frame_length ( ctx, 2 );
+    memset ( &arg, 0, sizeof ( arg ) );
+    arg.opcode = WSLAY_TEXT_FRAME;
+    arg.msg = ( const uint8_t* ) msg;
+    arg.msg_length = 5;
+    CU_ASSERT ( 0 == wslay_event_queue_msg ( ctx, &arg ) );
+    CU_ASSERT ( 0 == wslay_event_send ( ctx ) );
+    CU_ASSERT ( 0 == wslay_event_get_queued_msg_count ( ctx ) );
+    CU_ASSERT ( 0 == wslay_event_get_queued_msg_length ( ctx ) );
+    CU_ASSERT ( sizeof ( ans ) == acc.length );
+    CU_ASSERT ( 0 == memcmp ( ans, acc.buf, acc.length ) );
+
+    talloc_free ( ctx );
+}
+
+static bool send_blocked;
+
+static ssize_t blocking_accumulator_send_callback ( wslay_event_context * ctx, const uint8_t *buf, size_t len, int flags, void* user_data, bool user_data_sending )
+{
+    struct accumulator *acc = ( ( struct my_user_data* ) user_data )->acc;
+    if ( !send_blocked ) {
+        return accumulator_send_callback ( ctx, buf, len, flags, user_data, user_data_sending );
+    }
+    /* the first byte of ping is sent, then the socket blocks */
+    if ( acc->length == 1 ) {
+        wslay_event_set_error ( ctx, WSLAY_ERR_WOULDBLOCK );
+        return -1;
+    }
+    return one_accumulator_send_callback ( ctx, buf, len, flags, user_data, user_data_sending );
+}
+
+void test_wslay_event_cancel_msg_after_ctrl ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    struct scripted_data_feed df1, df2;
+    struct wslay_event_fragmented_msg arg;
+    wslay_event_msg ping = { WSLAY_PING, NULL, 0 };
+    const uint8_t ans[] = {
+        0x89, 0x00, /* unmasked ping */
+        0x81, 0x05, 0x57, 0x6f, 0x72, 0x6c, 0x64 /* "World" */
+    };
+    scripted_data_feed_init ( &df1, ( const uint8_t* ) "Hello", 5 );
+    df1.feedseq[0] = 3;
+    df1.feedseq[1] = 0;
+    scripted_data_feed_init ( &df2, ( const uint8_t* ) "World", 5 );
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    callbacks.send_callback = blocking_accumulator_send_callback;
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.acc = &acc;
+    send_blocked = true;
+
+    wslay_event_context * ctx = wslay_server_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+
+    wslay_event_config_set_fragment_coalescing ( ctx, 8, 60000 );
+
+    memset ( &arg, 0, sizeof ( arg ) );
+    arg.opcode = WSLAY_TEXT_FRAME;
+    arg.source.data = &df1;
+    arg.read_callback = scripted_read_callback;
+    CU_ASSERT ( 0 == wslay_event_queue_fragmented_msg ( ctx, &arg ) );
+    uint64_t id = wslay_event_get_last_msg_id ( ctx );
+    /* "Hel" is held */
+    CU_ASSERT ( 0 == wslay_event_send ( ctx ) );
+    CU_ASSERT_EQUAL ( 0, acc.length );
+
+    /* ping preempts the fragmented message, which goes back to send_queue with "Hel" */
+    CU_ASSERT ( 0 == wslay_event_queue_msg ( ctx, &ping ) );
+    CU_ASSERT ( 0 == wslay_event_send ( ctx ) );
+    CU_ASSERT_EQUAL ( 1, acc.length );
+    /* held data would be lost */
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_event_config_set_fragment_buffer_length ( ctx, 16 ) );
+    CU_ASSERT ( 0 == wslay_event_cancel_msg ( ctx, id ) );
+    CU_ASSERT ( 0 == wslay_event_config_set_fragment_buffer_length ( ctx, 16 ) );
+
+    /* the next fragmented message does not start with "Hel" */
+    arg.source.data = &df2;
+    CU_ASSERT ( 0 == wslay_event_queue_fragmented_msg ( ctx, &arg ) );
+    send_blocked = false;
+    CU_ASSERT ( 0 == wslay_event_send ( ctx ) );
+    CU_ASSERT ( sizeof ( ans ) == acc.length );
+    CU_ASSERT ( 0 == memcmp ( ans, acc.buf, acc.length ) );
+
+    talloc_free ( ctx );
+}
+
+void test_wslay_event_send_deflate ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    struct wslay_deflate_params params;
+    const char msg[] = "Hello";
+    wslay_event_msg arg;
+    /* RFC 7692 7.2.3.2, second message uses sliding window of the first one */
+    const uint8_t ans[] = {
+        0xc1, 0x07, 0xf2, 0x48, 0xcd, 0xc9, 0xc9, 0x07, 0x00,
+        0xc1, 0x05, 0xf2, 0x00, 0x11, 0x00, 0x00,
+        0x82, 0x00 /* empty message is not compressed */
+    };
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    callbacks.send_callback = accumulator_send_callback;
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.acc = &acc;
+
+    wslay_event_context * ctx = wslay_server_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+
+    wslay_deflate_params_init ( &params );
+    params.server_max_window_bits = 16;
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_event_config_set_deflate ( ctx, &params, NULL ) );
+    params.server_max_window_bits = 15;
+    CU_ASSERT ( 0 == wslay_event_config_set_deflate ( ctx, &params, NULL ) );
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_event_config_set_deflate ( ctx, &params, NULL ) );
+
+    arg.opcode = WSLAY_TEXT_FRAME;
+    arg.msg = ( const uint8_t * ) msg;
+    arg.msg_length = sizeof ( msg ) - 1;
+    CU_ASSERT ( 0 == wslay_event_queue_msg ( ctx, &arg ) );
+    CU_ASSERT ( 0 == wslay_event_queue_msg ( ctx, &arg ) );
+    arg.opcode = WSLAY_BINARY_FRAME;
+    arg.msg = NULL;
+    arg.msg_length = 0;
+    CU_ASSERT ( 0 == wslay_event_queue_msg ( ctx, &arg ) );
+    CU_ASSERT ( 0 == wslay_event_send ( ctx ) );
+    CU_ASSERT ( sizeof ( ans ) == acc.length );
+    CU_ASSERT ( 0 == memcmp ( ans, acc.buf, acc.length ) );
+
+    talloc_free ( ctx );
+}
+
+struct deflate_recv_result {
+    uint8_t no_buffering;
+    size_t msg_count;
+    uint8_t chunks[64];
+    size_t chunks_length;
+};
+
+static void deflate_recv_callback ( wslay_event_context * ctx, const struct wslay_event_on_msg_recv_arg *arg, void *user_data )
+{
+    struct deflate_recv_result *result = ( struct deflate_recv_result* ) ( ( struct my_user_data* ) user_data )->acc;
+    CU_ASSERT ( WSLAY_TEXT_FRAME == arg->opcode );
+    CU_ASSERT ( ( result->msg_count == 2 ? 0 : WSLAY_DEFLATE_RSV ) == arg->rsv );
+    if ( !result->no_buffering ) {
+        CU_ASSERT ( 5 == arg->msg_length );
+        CU_ASSERT ( 0 == memcmp ( "Hello", arg->msg, arg->msg_length ) );
+    }
+    ++result->msg_count;
+}
+
+static void deflate_recv_chunk_callback ( wslay_event_context * ctx, const struct wslay_event_on_frame_recv_chunk_arg *arg, void *user_data )
+{
+    struct deflate_recv_result *result = ( struct deflate_recv_result* ) ( ( struct my_user_data* ) user_data )->acc;
+    assert ( result->chunks_length + arg->data_length <= sizeof ( result->chunks ) );
+    memcpy ( result->chunks + result->chunks_length, arg->data, arg->data_length );
+    result->chunks_length += arg->data_length;
+}
+
+void test_wslay_event_recv_deflate ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct wslay_deflate_params params;
+    struct deflate_recv_result result;
+    const uint8_t msg[] = {
+        0xc1, 0x07, 0xf2, 0x48, 0xcd, 0xc9, 0xc9, 0x07, 0x00, /* compressed "Hello" */
+        0x41, 0x03, 0xf2, 0x48, 0xcd, /* fragmented compressed "Hello" */
+        0x80, 0x04, 0xc9, 0xc9, 0x07, 0x00,
+        0x81, 0x05, 0x48, 0x65, 0x6c, 0x6c, 0x6f /* uncompressed "Hello" */
+    };
+    struct scripted_data_feed df;
+    uint8_t no_buffering;
+    for ( no_buffering = 0; no_buffering < 2; ++no_buffering ) {
+        scripted_data_feed_init ( &df, msg, sizeof ( msg ) );
+        memset ( &callbacks, 0, sizeof ( callbacks ) );
+        memset ( &result, 0, sizeof ( result ) );
+        result.no_buffering = no_buffering;
+        ud.df = &df;
+        ud.acc = ( struct accumulator * ) &result;
+        callbacks.recv_callback = scripted_recv_callback;
+        callbacks.on_msg_recv_callback = deflate_recv_callback;
+        callbacks.on_frame_recv_chunk_callback = deflate_recv_chunk_callback;
+
+        wslay_event_context * ctx = wslay_client_new ( NULL, &callbacks, &ud );
+        CU_ASSERT_FATAL ( ctx != NULL );
+
+        wslay_deflate_params_init ( &params );
+        CU_ASSERT ( 0 == wslay_event_config_set_deflate ( ctx, &params, NULL ) );
+        wslay_event_config_set_no_buffering ( ctx, no_buffering );
+        CU_ASSERT ( 0 == wslay_event_recv ( ctx ) );
+        CU_ASSERT ( 3 == result.msg_count );
+        CU_ASSERT ( 15 == result.chunks_length );
+        CU_ASSERT ( 0 == memcmp ( "HelloHelloHello", result.chunks, result.chunks_length ) );
+        CU_ASSERT ( !wslay_event_want_write ( ctx ) );
+
+        talloc_free ( ctx );
+    }
+}
+
+void test_wslay_event_recv_deflate_not_negotiated ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    /* masked compressed "Hello" */
+    const uint8_t msg[] = { 0xc1, 0x87, 0x00, 0x00, 0x00, 0x00, 0xf2, 0x48, 0xcd, 0xc9, 0xc9, 0x07, 0x00 };
+    struct scripted_data_feed df;
+    scripted_data_feed_init ( &df, msg, sizeof ( msg ) );
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.df = &df;
+    ud.acc = &acc;
+    callbacks.send_callback = accumulator_send_callback;
+    callbacks.recv_callback = scripted_recv_callback;
+
+    wslay_event_context * ctx = wslay_server_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+
+    CU_ASSERT ( 0 == wslay_event_recv ( ctx ) );
+    CU_ASSERT ( 1 == wslay_event_get_queued_msg_count ( ctx ) );
+    CU_ASSERT ( 0 == wslay_event_send ( ctx ) );
+    CU_ASSERT ( WSLAY_CODE_PROTOCOL_ERROR == wslay_event_get_status_code_sent ( ctx ) );
+
+    talloc_free ( ctx );
+}
+
+void test_wslay_event_queue_broadcast ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    struct wslay_deflate_params params;
+    uint8_t msg[256];
+    size_t i, length;
+    wslay_event_context * ctx[3];
+    memset ( msg, 'a', sizeof ( msg ) );
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    callbacks.send_callback = accumulator_send_callback;
+    ud.acc = &acc;
+
+    CU_ASSERT ( NULL == wslay_event_broadcast_new ( WSLAY_PING, msg, sizeof ( msg ), 15 ) );
+    CU_ASSERT ( NULL == wslay_event_broadcast_new ( WSLAY_TEXT_FRAME, msg, sizeof ( msg ), 8 ) );
+    wslay_event_broadcast * broadcast = wslay_event_broadcast_new ( WSLAY_TEXT_FRAME, msg, sizeof ( msg ), 12 );
+    CU_ASSERT_FATAL ( broadcast != NULL );
+    uint8_t * deflated = wslay_deflate_once ( NULL, 12, msg, sizeof ( msg ), &length );
+    CU_ASSERT_FATAL ( deflated != NULL );
+    CU_ASSERT ( length == broadcast->deflated_length );
+    CU_ASSERT ( 0 == memcmp ( deflated, broadcast->deflated_data, length ) );
+    talloc_free ( deflated );
+
+    /* compressed payload is shared, uncompressed one is used without deflate and
+       compressed by the context itself with context takeover */
+    for ( i = 0; i < 3; ++i ) {
+        ctx[i] = wslay_server_new ( NULL, &callbacks, &ud );
+        CU_ASSERT_FATAL ( ctx[i] != NULL );
+    }
+    wslay_deflate_params_init ( &params );
+    params.server_no_context_takeover = true;
+    CU_ASSERT ( 0 == wslay_event_config_set_deflate ( ctx[0], &params, NULL ) );
+    params.server_no_context_takeover = false;
+    CU_ASSERT ( 0 == wslay_event_config_set_deflate ( ctx[2], &params, NULL ) );
+    for ( i = 0; i < 3; ++i ) {
+        CU_ASSERT ( 0 == wslay_event_queue_broadcast ( ctx[i], broadcast ) );
+    }
+    CU_ASSERT ( 4 == broadcast->refcount );
+    CU_ASSERT ( broadcast->deflated_length == wslay_event_get_queued_msg_length ( ctx[0] ) );
+    CU_ASSERT ( sizeof ( msg ) == wslay_event_get_queued_msg_length ( ctx[1] ) );
+    wslay_event_broadcast_release ( broadcast );
+
+    memset ( &acc, 0, sizeof ( acc ) );
+    CU_ASSERT ( 0 == wslay_event_send ( ctx[0] ) );
+    CU_ASSERT ( 2 + broadcast->deflated_length == acc.length );
+    CU_ASSERT ( 0xc1 == acc.buf[0] );
+    CU_ASSERT ( 0 == memcmp ( broadcast->deflated_data, acc.buf + 2, broadcast->deflated_length ) );
+    CU_ASSERT ( 2 == broadcast->refcount );
+
+    memset ( &acc, 0, sizeof ( acc ) );
+    CU_ASSERT ( 0 == wslay_event_send ( ctx[1] ) );
+    CU_ASSERT ( 4 + sizeof ( msg ) == acc.length );
+    CU_ASSERT ( 0x81 == acc.buf[0] );
+    CU_ASSERT ( 0 == memcmp ( msg, acc.buf + 4, sizeof ( msg ) ) );
+
+    /* the last reference is released when ctx compresses the payload */
+    memset ( &acc, 0, sizeof ( acc ) );
+    CU_ASSERT ( 0 == wslay_event_send ( ctx[2] ) );
+    CU_ASSERT ( 0xc1 == acc.buf[0] );
+
+    for ( i = 0; i < 3; ++i ) {
+        talloc_free ( ctx[i] );
+    }
+}
+
+struct xor_extension_data {
+    const uint8_t * input;
+    size_t input_length;
+};
+
+static int xor_accept ( wslay_event_context * ctx, void * user_data, const char * element, size_t element_length,
+                        char * response, size_t * response_length, void ** data )
+{
+    if ( *response_length <= element_length ) {
+        return WSLAY_ERR_INVALID_ARGUMENT;
+    }
+    memcpy ( response, element, element_length );
+    response[element_length] = '\0';
+    *response_length = element_length;
+    *data = talloc_zero ( ctx, sizeof ( struct xor_extension_data ) );
+    return 0;
+}
+
+static ssize_t xor_offer ( wslay_event_context * ctx, void * user_data, char * buf, size_t length )
+{
+    int r = snprintf ( buf, length, "x-xor" );
+    return r < 0 || ( size_t ) r >= length ? WSLAY_ERR_INVALID_ARGUMENT : r;
+}
+
+static int xor_confirm ( wslay_event_context * ctx, void * user_data, const char * element, size_t element_length, void ** data )
+{
+    *data = talloc_zero ( ctx, sizeof ( struct xor_extension_data ) );
+    return 0;
+}
+
+static int xor_encode ( void * data, uint8_t opcode, const uint8_t * msg, size_t length, void * parent, uint8_t ** result, size_t * result_length )
+{
+    size_t i;
+    *result = talloc ( parent, length );
+    for ( i = 0; i < length; ++i ) {
+        ( *result ) [i] = msg[i] ^ 0x20;
+    }
+    *result_length = length;
+    return 0;
+}
+
+static int xor_decode_input ( void * data, const uint8_t * input, size_t length, bool fin )
+{
+    struct xor_extension_data * xor_data = data;
+    xor_data->input = input;
+    xor_data->input_length = length;
+    return 0;
+}
+
+static ssize_t xor_decode_read ( void * data, uint8_t * buf, size_t length )
+{
+    struct xor_extension_data * xor_data = data;
+    size_t i;
+    /* small reads to exercise chaining */
+    length = length < 3 ? length : 3;
+    length = length < xor_data->input_length ? length : xor_data->input_length;
+    for ( i = 0; i < length; ++i ) {
+        buf[i] = xor_data->input[i] ^ 0x20;
+    }
+    xor_data->input += length;
+    xor_data->input_length -= length;
+    return length;
+}
+
+static const wslay_event_extension xor_extension = {
+    "x-xor", 2, xor_offer, xor_accept, xor_confirm, xor_encode, xor_decode_input, xor_decode_read, NULL
+};
+
+void test_wslay_event_extension_negotiation ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct wslay_deflate_options options;
+    char buf[256];
+    const char offer[] = "x-unknown, permessage-deflate; server_max_window_bits=16, permessage-deflate; client_max_window_bits, x-xor";
+    const char response[] = "permessage-deflate; server_no_context_takeover, x-xor";
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    wslay_deflate_params_init ( &options.params );
+    options.params.server_no_context_takeover = true;
+    options.pool = NULL;
+
+    wslay_event_context * server = wslay_server_new ( NULL, &callbacks, NULL );
+    CU_ASSERT_FATAL ( server != NULL );
+    CU_ASSERT ( 0 == wslay_event_config_add_extension ( server, &wslay_deflate_extension, &options ) );
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_event_config_add_extension ( server, &wslay_deflate_extension, &options ) );
+    CU_ASSERT ( 0 == wslay_event_config_add_extension ( server, &xor_extension, NULL ) );
+    CU_ASSERT ( NULL == wslay_event_get_extension_data ( server, &wslay_deflate_extension ) );
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_event_extensions_accept ( server, offer, sizeof ( offer ) - 1, buf, 20 ) );
+    CU_ASSERT ( sizeof ( response ) - 1 == wslay_event_extensions_accept ( server, offer, sizeof ( offer ) - 1, buf, sizeof ( buf ) ) );
+    CU_ASSERT ( 0 == strcmp ( response, buf ) );
+    CU_ASSERT ( NULL != wslay_event_get_extension_data ( server, &wslay_deflate_extension ) );
+    CU_ASSERT ( NULL != wslay_event_get_extension_data ( server, &xor_extension ) );
+    /* RSV1 is already owned by permessage-deflate */
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_event_config_set_deflate ( server, &options.params, NULL ) );
+
+    wslay_event_context * client = wslay_client_new ( NULL, &callbacks, NULL );
+    CU_ASSERT_FATAL ( client != NULL );
+    CU_ASSERT ( 0 == wslay_event_config_add_extension ( client, &wslay_deflate_extension, NULL ) );
+    CU_ASSERT ( 0 == wslay_event_config_add_extension ( client, &xor_extension, NULL ) );
+    CU_ASSERT ( 25 == wslay_event_extensions_offer ( client, buf, sizeof ( buf ) ) );
+    CU_ASSERT ( 0 == strcmp ( "permessage-deflate, x-xor", buf ) );
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_event_extensions_confirm ( client, "x-unknown", 9 ) );
+    CU_ASSERT ( 0 == wslay_event_extensions_confirm ( client, response, sizeof ( response ) - 1 ) );
+    wslay_deflate_context * deflate_ctx = wslay_event_get_extension_data ( client, &wslay_deflate_extension );
+    CU_ASSERT_FATAL ( deflate_ctx != NULL );
+    CU_ASSERT ( deflate_ctx->inflate_no_context_takeover );
+    CU_ASSERT ( NULL != wslay_event_get_extension_data ( client, &xor_extension ) );
+
+    talloc_free ( server );
+    talloc_free ( client );
+}
+
+void test_wslay_event_extension_deflate_confirm ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct wslay_deflate_options options;
+    char buf[256];
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    wslay_deflate_params_init ( &options.params );
+    options.params.server_no_context_takeover = true;
+    options.params.server_max_window_bits = 10;
+    options.params.client_max_window_bits = 12;
+    options.pool = NULL;
+
+    wslay_event_context * client = wslay_client_new ( NULL, &callbacks, NULL );
+    CU_ASSERT_FATAL ( client != NULL );
+    CU_ASSERT ( 0 == wslay_event_config_add_extension ( client, &wslay_deflate_extension, &options ) );
+    CU_ASSERT ( 0 < wslay_event_extensions_offer ( client, buf, sizeof ( buf ) ) );
+    CU_ASSERT ( 0 == strcmp ( "permessage-deflate; server_no_context_takeover; server_max_window_bits=10; client_max_window_bits=12", buf ) );
+    /* offered server_no_context_takeover is dropped */
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_event_extensions_confirm ( client, "permessage-deflate; server_max_window_bits=10", 45 ) );
+    /* server window is larger than offered */
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_event_extensions_confirm ( client, "permessage-deflate; server_no_context_takeover; server_max_window_bits=11", 73 ) );
+    CU_ASSERT ( NULL == wslay_event_get_extension_data ( client, &wslay_deflate_extension ) );
+    /* client window is kept at the offered one */
+    CU_ASSERT ( 0 == wslay_event_extensions_confirm ( client, "permessage-deflate; server_no_context_takeover; server_max_window_bits=9", 72 ) );
+    wslay_deflate_context * deflate_ctx = wslay_event_get_extension_data ( client, &wslay_deflate_extension );
+    CU_ASSERT_FATAL ( deflate_ctx != NULL );
+    CU_ASSERT ( 9 == deflate_ctx->inflate_window_bits );
+    CU_ASSERT ( 12 == deflate_ctx->deflate_window_bits );
+    CU_ASSERT ( deflate_ctx->inflate_no_context_takeover );
+    talloc_free ( client );
+
+    /* client_max_window_bits in response without offer */
+    client = wslay_client_new ( NULL, &callbacks, NULL );
+    CU_ASSERT_FATAL ( client != NULL );
+    CU_ASSERT ( 0 == wslay_event_config_add_extension ( client, &wslay_deflate_extension, NULL ) );
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_event_extensions_confirm ( client, "permessage-deflate; client_max_window_bits=10", 45 ) );
+    CU_ASSERT ( 0 == wslay_event_extensions_confirm ( client, "permessage-deflate; client_no_context_takeover", 46 ) );
+    deflate_ctx = wslay_event_get_extension_data ( client, &wslay_deflate_extension );
+    CU_ASSERT_FATAL ( deflate_ctx != NULL );
+    CU_ASSERT ( deflate_ctx->deflate_no_context_takeover );
+    talloc_free ( client );
+}
+
+static void extension_pipeline_recv_callback ( wslay_event_context * ctx, const struct wslay_event_on_msg_recv_arg *arg, void *user_data )
+{
+    struct accumulator *acc = ( ( struct my_user_data* ) user_data )->acc;
+    CU_ASSERT ( 6 == arg->rsv );
+    memcpy ( acc->buf + acc->length, arg->msg, arg->msg_length );
+    acc->length += arg->msg_length;
+}
+
+void test_wslay_event_extension_pipeline ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    struct scripted_data_feed df;
+    struct wslay_deflate_params params;
+    wslay_event_msg arg;
+    const char msg[] = "Hello, Hello, Hello";
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    callbacks.send_callback = accumulator_send_callback;
+    callbacks.recv_callback = scripted_recv_callback;
+    callbacks.on_msg_recv_callback = extension_pipeline_recv_callback;
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.acc = &acc;
+    ud.df = &df;
+    wslay_deflate_params_init ( &params );
+
+    wslay_event_context * server = wslay_server_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( server != NULL );
+    CU_ASSERT ( 0 == wslay_event_config_set_deflate ( server, &params, NULL ) );
+    CU_ASSERT ( 0 == wslay_event_config_enable_extension ( server, &xor_extension, talloc_zero ( server, sizeof ( struct xor_extension_data ) ) ) );
+    arg.opcode = WSLAY_TEXT_FRAME;
+    arg.msg = ( const uint8_t * ) msg;
+    arg.msg_length = sizeof ( msg ) - 1;
+    CU_ASSERT ( 0 == wslay_event_queue_msg ( server, &arg ) );
+    CU_ASSERT ( 0 == wslay_event_send ( server ) );
+    /* RSV1 and RSV2 are set */
+    CU_ASSERT ( 0xe1 == acc.buf[0] );
+
+    /* client decodes xor first, then inflates */
+    scripted_data_feed_init ( &df, acc.buf, acc.length );
+    memset ( &acc, 0, sizeof ( acc ) );
+    wslay_event_context * client = wslay_client_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( client != NULL );
+    CU_ASSERT ( 0 == wslay_event_config_set_deflate ( client, &params, NULL ) );
+    CU_ASSERT ( 0 == wslay_event_config_enable_extension ( client, &xor_extension, talloc_zero ( client, sizeof ( struct xor_extension_data ) ) ) );
+    CU_ASSERT ( 0 == wslay_event_recv ( client ) );
+    CU_ASSERT ( sizeof ( msg ) - 1 == acc.length );
+    CU_ASSERT ( 0 == memcmp ( msg, acc.buf, acc.length ) );
+
+    talloc_free ( server );
+    talloc_free ( client );
+}
+
+static const wslay_event_extension encode_only_extension = {
+    "x-encode-only", 2, NULL, NULL, NULL, xor_encode, NULL, NULL, NULL
+};
+
+void test_wslay_event_extension_encode_only ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    struct scripted_data_feed df;
+    const uint8_t msg[] = {
+        0xa1, 0x83, 0x00, 0x00, 0x00, 0x00, 0x46, 0x6f, 0x6f /* "Foo" with RSV2, masked by zero key */
+    };
+    const uint8_t ans[] = {
+        0x88, 0x02, 0x03, 0xea /* close 1002 */
+    };
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    callbacks.send_callback = accumulator_send_callback;
+    callbacks.recv_callback = scripted_recv_callback;
+    memset ( &acc, 0, sizeof ( acc ) );
+    scripted_data_feed_init ( &df, msg, sizeof ( msg ) );
+    ud.acc = &acc;
+    ud.df = &df;
+
+    wslay_event_context * ctx = wslay_server_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+    CU_ASSERT ( 0 == wslay_event_config_enable_extension ( ctx, &encode_only_extension, NULL ) );
+    /* RSV2 of extension without decoder is a protocol error */
+    CU_ASSERT ( 0 == wslay_event_recv ( ctx ) );
+    CU_ASSERT ( 0 == wslay_event_get_read_enabled ( ctx ) );
+    CU_ASSERT ( 0 == wslay_event_send ( ctx ) );
+    CU_ASSERT ( sizeof ( ans ) == acc.length );
+    CU_ASSERT ( 0 == memcmp ( ans, acc.buf, acc.length ) );
+
+    talloc_free ( ctx );
+}
+
+static void text_validation_recv_callback ( wslay_event_context * ctx, const struct wslay_event_on_msg_recv_arg *arg, void *user_data )
+{
+    struct my_user_data * ud = user_data;
+    /* the number of delivered text messages */
+    if ( arg->opcode == WSLAY_TEXT_FRAME ) {
+        ud->acc->length++;
+    }
+}
+
+void test_wslay_event_text_validation ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    /* "ok", invalid 0xff, "ok" */
+    const uint8_t msg[] = {
+        0x81, 0x02, 0x6f, 0x6b,
+        0x81, 0x01, 0xff,
+        0x81, 0x02, 0x6f, 0x6b
+    };
+    struct scripted_data_feed df;
+    uint32_t interval;
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    callbacks.send_callback = accumulator_send_callback;
+    callbacks.recv_callback = scripted_recv_callback;
+    callbacks.on_msg_recv_callback = text_validation_recv_callback;
+    ud.df = &df;
+    ud.acc = &acc;
+
+    /* trusted peer and sampling of every other message deliver the invalid message */
+    for ( interval = 0; interval <= 2; interval += 2 ) {
+        scripted_data_feed_init ( &df, msg, sizeof ( msg ) );
+        memset ( &acc, 0, sizeof ( acc ) );
+        wslay_event_context * ctx = wslay_client_new ( NULL, &callbacks, &ud );
+        CU_ASSERT_FATAL ( ctx != NULL );
+        wslay_event_config_set_text_validation ( ctx, interval );
+        CU_ASSERT ( 0 == wslay_event_recv ( ctx ) );
+        CU_ASSERT ( 3 == acc.length );
+        CU_ASSERT ( 0 == wslay_event_get_queued_msg_count ( ctx ) );
+        CU_ASSERT ( ( interval == 0 ? 0 : 2 ) == wslay_event_get_validated_text_msg_count ( ctx ) );
+        CU_ASSERT ( ( interval == 0 ? 3 : 1 ) == wslay_event_get_trusted_text_msg_count ( ctx ) );
+        talloc_free ( ctx );
+    }
+
+    /* the default validates every message */
+    scripted_data_feed_init ( &df, msg, sizeof ( msg ) );
+    memset ( &acc, 0, sizeof ( acc ) );
+    wslay_event_context * ctx = wslay_client_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+    CU_ASSERT ( 0 == wslay_event_recv ( ctx ) );
+    CU_ASSERT ( 1 == acc.length );
+    CU_ASSERT ( 2 == wslay_event_get_validated_text_msg_count ( ctx ) );
+    CU_ASSERT ( 0 == wslay_event_get_trusted_text_msg_count ( ctx ) );
+    CU_ASSERT ( 1 == wslay_event_get_queued_msg_count ( ctx ) );
+    talloc_free ( ctx );
+}
+
+static void discard_frame_recv_start_callback ( wslay_event_context * ctx, const struct wslay_event_on_frame_recv_start_arg *arg, void *user_data )
+{
+    if ( arg->opcode == WSLAY_PING ) {
+        CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_event_discard_msg ( ctx ) );
+    } else if ( arg->opcode == WSLAY_BINARY_FRAME || arg->payload_length == 3 ) {
+        CU_ASSERT ( 0 == wslay_event_discard_msg ( ctx ) );
+    }
+}
+
+static void discard_frame_recv_chunk_callback ( wslay_event_context * ctx, const struct wslay_event_on_frame_recv_chunk_arg *arg, void *user_data )
+{
+    /* only the payload of ping and the last message is delivered */
+    CU_ASSERT ( 0 == memcmp ( "Foo", arg->data, arg->data_length ) || 0 == memcmp ( "ok", arg->data, arg->data_length ) );
+}
+
+static void discard_msg_recv_callback ( wslay_event_context * ctx, const struct wslay_event_on_msg_recv_arg *arg, void *user_data )
+{
+    struct my_user_data * ud = user_data;
+    memcpy ( ud->acc->buf + ud->acc->length, arg->msg, arg->msg_length );
+    ud->acc->length += arg->msg_length;
+}
+
+void test_wslay_event_discard_msg ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    const uint8_t msg[] = {
+        0x01, 0x03, 0x48, 0x65, 0x6c, /* "Hel" */
+        0x89, 0x03, 0x46, 0x6f, 0x6f, /* ping with "Foo" */
+        0x80, 0x02, 0x6c, 0x6f, /* "lo" */
+        0x82, 0x0a, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, /* too big binary */
+        0x81, 0x02, 0x6f, 0x6b /* "ok" */
+    };
+    struct scripted_data_feed df;
+    scripted_data_feed_init ( &df, msg, sizeof ( msg ) );
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.df = &df;
+    ud.acc = &acc;
+    callbacks.recv_callback = scripted_recv_callback;
+    callbacks.on_frame_recv_start_callback = discard_frame_recv_start_callback;
+    callbacks.on_frame_recv_chunk_callback = discard_frame_recv_chunk_callback;
+    callbacks.on_msg_recv_callback = discard_msg_recv_callback;
+
+    wslay_event_context * ctx = wslay_client_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+    wslay_event_config_set_max_recv_msg_length ( ctx, 5 );
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_event_discard_msg ( ctx ) );
+
+    CU_ASSERT ( 0 == wslay_event_recv ( ctx ) );
+    CU_ASSERT ( 5 == acc.length );
+    CU_ASSERT ( 0 == memcmp ( "Foook", acc.buf, acc.length ) );
+    /* only pong is queued */
+    CU_ASSERT ( 1 == wslay_event_get_queued_msg_count ( ctx ) );
+    CU_ASSERT ( 1 == wslay_event_get_read_enabled ( ctx ) );
+
+    talloc_free ( ctx );
+}
+
+static void peek_append ( struct my_user_data * ud, const char * prefix, const uint8_t * data, size_t data_length, const char * suffix )
+{
+    size_t prefix_length = strlen ( prefix ), suffix_length = strlen ( suffix );
+    memcpy ( ud->acc->buf + ud->acc->length, prefix, prefix_length );
+    ud->acc->length += prefix_length;
+    if ( data_length > 0 ) {
+        memcpy ( ud->acc->buf + ud->acc->length, data, data_length );
+        ud->acc->length += data_length;
+    }
+    memcpy ( ud->acc->buf + ud->acc->length, suffix, suffix_length );
+    ud->acc->length += suffix_length;
+}
+
+static int msg_peek_callback ( wslay_event_context * ctx, const struct wslay_event_on_msg_peek_arg *arg, void *user_data )
+{
+    peek_append ( user_data, "<", arg->data, arg->data_length, ">" );
+    if ( arg->data[0] == 'S' ) {
+        return WSLAY_PEEK_STREAM;
+    } else if ( arg->data[0] == 'D' ) {
+        return WSLAY_PEEK_DISCARD;
+    }
+    CU_ASSERT ( arg->fin == ( arg->data_length == 1 ) );
+    return WSLAY_PEEK_BUFFER;
+}
+
+static void msg_peek_recv_chunk_callback ( wslay_event_context * ctx, const struct wslay_event_on_frame_recv_chunk_arg *arg, void *user_data )
+{
+    peek_append ( user_data, "", arg->data, arg->data_length, "" );
+}
+
+static void msg_peek_recv_callback ( wslay_event_context * ctx, const struct wslay_event_on_msg_recv_arg *arg, void *user_data )
+{
+    peek_append ( user_data, "[", arg->msg, arg->msg_length, "]" );
+}
+
+void test_wslay_event_msg_peek ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    const uint8_t msg[] = {
+        0x01, 0x03, 0x48, 0x65, 0x6c, /* "Hel" */
+        0x80, 0x02, 0x6c, 0x6f, /* "lo" */
+        0x02, 0x03, 0x53, 0x74, 0x72, /* "Str" */
+        0x80, 0x03, 0x65, 0x61, 0x6d, /* "eam" */
+        0x81, 0x04, 0x44, 0x72, 0x6f, 0x70, /* "Drop" */
+        0x81, 0x01, 0x61 /* "a" */
+    };
+    const char expected[] = "<He>Hello[Hello]<St>Stream[]<Dr><a>a[a]";
+    struct scripted_data_feed df;
+    scripted_data_feed_init ( &df, msg, sizeof ( msg ) );
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.df = &df;
+    ud.acc = &acc;
+    callbacks.recv_callback = scripted_recv_callback;
+    callbacks.on_frame_recv_chunk_callback = msg_peek_recv_chunk_callback;
+    callbacks.on_msg_recv_callback = msg_peek_recv_callback;
+    callbacks.on_msg_peek_callback = msg_peek_callback;
+
+    wslay_event_context * ctx = wslay_client_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+    CU_ASSERT ( 0 == wslay_event_config_set_msg_peek ( ctx, 2 ) );
+
+    CU_ASSERT ( 0 == wslay_event_recv ( ctx ) );
+    CU_ASSERT ( sizeof ( expected ) - 1 == acc.length );
+    CU_ASSERT ( 0 == memcmp ( expected, acc.buf, acc.length ) );
+
+    talloc_free ( ctx );
+}
+
+static void recv_prealloc_msg_recv_callback ( wslay_event_context * ctx, const struct wslay_event_on_msg_recv_arg *arg, void *user_data )
+{
+    struct my_user_data * ud = user_data;
+    memcpy ( ud->acc->buf + ud->acc->length, arg->msg, arg->msg_length );
+    ud->acc->length += arg->msg_length;
+}
+
+void test_wslay_event_recv_prealloc ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    struct scripted_data_feed df;
+    struct wslay_event_byte_chunk * chunk;
+    uint8_t msg[4 + 300];
+    size_t i;
+    /* binary frame announcing 300 bytes */
+    msg[0] = 0x82;
+    msg[1] = 0x7e;
+    msg[2] = 0x01;
+    msg[3] = 0x2c;
+    for ( i = 0; i < 300; i ++ ) {
+        msg[4 + i] = ( uint8_t ) i;
+    }
+    scripted_data_feed_init ( &df, msg, sizeof ( msg ) );
+    df.feedseq[0] = 4 + 10;
+    df.feedseq[1] = 0;
+    df.feedseq[2] = 20;
+    df.feedseq[3] = 0;
+    df.feedseq[4] = 270;
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.df = &df;
+    ud.acc = &acc;
+    callbacks.recv_callback = scripted_recv_callback;
+    callbacks.on_msg_recv_callback = recv_prealloc_msg_recv_callback;
+
+    wslay_event_context * ctx = wslay_client_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+    wslay_event_config_set_recv_prealloc_length ( ctx, 16 );
+
+    /* only the prealloc length is allocated for the announced payload */
+    CU_ASSERT ( 0 == wslay_event_recv ( ctx ) );
+    chunk = wslay_queue_tail ( &ctx->imsg->chunks );
+    CU_ASSERT ( 10 == chunk->data_length );
+    CU_ASSERT ( 16 == chunk->capacity );
+
+    /* the buffer doubles as payload arrives */
+    CU_ASSERT ( 0 == wslay_event_recv ( ctx ) );
+    chunk = wslay_queue_tail ( &ctx->imsg->chunks );
+    CU_ASSERT ( 30 == chunk->data_length );
+    CU_ASSERT ( 32 == chunk->capacity );
+
+    /* the rest of payload completes the message */
+    CU_ASSERT ( 0 == wslay_event_recv ( ctx ) );
+    CU_ASSERT ( wslay_queue_is_empty ( &ctx->imsg->chunks ) );
+    CU_ASSERT ( 300 == acc.length );
+    CU_ASSERT ( 0 == memcmp ( msg + 4, acc.buf, acc.length ) );
+
+    talloc_free ( ctx );
+}
+
+static void recv_buffer_reuse_msg_recv_callback ( wslay_event_context * ctx, const struct wslay_event_on_msg_recv_arg *arg, void *user_data )
+{
+    const uint8_t ** msgs = ( const uint8_t ** ) ( ( struct my_user_data * ) user_data )->acc->buf;
+    size_t * count = &( ( struct my_user_data * ) user_data )->acc->length;
+    msgs[( *count ) ++] = arg->msg;
+}
+
+void test_wslay_event_recv_buffer_reuse ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    struct scripted_data_feed df;
+    const uint8_t ** msgs = ( const uint8_t ** ) acc.buf;
+    const uint8_t msg[] = {
+        0x81, 0x03, 0x46, 0x6f, 0x6f, /* "Foo" */
+        0x01, 0x02, 0x42, 0x61, /* "Ba" */
+        0x80, 0x01, 0x72, /* "r" */
+        0x82, 0x05, 0x00, 0x01, 0x02, 0x03, 0x04 /* binary above high-water */
+    };
+    scripted_data_feed_init ( &df, msg, sizeof ( msg ) );
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.df = &df;
+    ud.acc = &acc;
+    callbacks.recv_callback = scripted_recv_callback;
+    callbacks.on_msg_recv_callback = recv_buffer_reuse_msg_recv_callback;
+
+    wslay_event_context * ctx = wslay_client_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+    wslay_event_config_set_recv_prealloc_length ( ctx, 3 );
+    wslay_event_config_set_recv_buffer_high_water ( ctx, 4 );
+    wslay_event_config_set_recv_buffer_idle_timeout ( ctx, 1000 );
+
+    CU_ASSERT ( 0 == wslay_event_recv ( ctx ) );
+    CU_ASSERT_FATAL ( 3 == acc.length );
+    /* the fragmented message is gathered in the buffer of the previous one */
+    CU_ASSERT ( msgs[0] == msgs[1] );
+    /* the buffer grown above high-water mark is released */
+    CU_ASSERT ( ctx->imsgs[0].spare == NULL );
+
+    scripted_data_feed_init ( &df, msg, 5 );
+    CU_ASSERT ( 0 == wslay_event_recv ( ctx ) );
+    CU_ASSERT ( ctx->imsgs[0].spare != NULL );
+    /* the buffer is kept until idle timeout passes */
+    wslay_event_shrink_recv_buffers ( ctx );
+    CU_ASSERT ( ctx->imsgs[0].spare != NULL );
+    ctx->imsgs[0].spare_time -= 1000;
+    wslay_event_shrink_recv_buffers ( ctx );
+    CU_ASSERT ( ctx->imsgs[0].spare == NULL );
+
+    talloc_free ( ctx );
+}
+
+void test_wslay_event_idle_footprint ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    struct scripted_data_feed df;
+    const uint8_t msg[] = { 0x81, 0x03, 0x46, 0x6f, 0x6f /* "Foo" */ };
+    size_t footprint = sizeof ( wslay_event_context ) + sizeof ( wslay_frame_context );
+    scripted_data_feed_init ( &df, msg, sizeof ( msg ) );
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.df = &df;
+    ud.acc = &acc;
+    callbacks.recv_callback = scripted_recv_callback;
+    callbacks.send_callback = accumulator_send_callback;
+
+    /* idle connection holds only the two context structures, buffers are allocated on use */
+    printf ( "\n  idle context footprint: %zu bytes\n", footprint );
+    CU_ASSERT ( footprint < 1024 );
+
+    wslay_event_context * ctx = wslay_client_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+    CU_ASSERT ( ctx->obuf == NULL );
+    CU_ASSERT ( ctx->frame_ctx->ibuf == NULL );
+
+    /* input buffer is released when the read bytes are consumed */
+    CU_ASSERT ( 0 == wslay_event_recv ( ctx ) );
+    CU_ASSERT ( ctx->frame_ctx->ibuf == NULL );
+    talloc_free ( ctx );
+
+    ctx = wslay_server_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+
+    /* output buffer of fragmented message is released when it is sent */
+    struct wslay_event_fragmented_msg arg;
+    scripted_data_feed_init ( &df, msg + 2, 3 );
+    memset ( &arg, 0, sizeof ( arg ) );
+    arg.opcode = WSLAY_TEXT_FRAME;
+    arg.source.data = &df;
+    arg.read_callback = scripted_read_callback;
+    CU_ASSERT ( 0 == wslay_event_queue_fragmented_msg ( ctx, &arg ) );
+    CU_ASSERT ( 0 == wslay_event_send ( ctx ) );
+    CU_ASSERT ( 0 == memcmp ( msg, acc.buf, sizeof ( msg ) ) );
+    CU_ASSERT ( ctx->obuf == NULL );
+    CU_ASSERT ( wslay_queue_is_empty ( &ctx->send_queue ) );
+
+    talloc_free ( ctx );
+}
+
+void test_wslay_event_recv_scratch_buffer ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud1, ud2;
+    struct accumulator acc1, acc2;
+    struct scripted_data_feed df1, df2;
+    static uint8_t scratch[WSLAY_FRAME_IBUF_LENGTH];
+    uint8_t msg1[4 + 200] = { 0x81, 0x7e, 0x00, 0xc8 };
+    const uint8_t msg2[] = { 0x82, 0x03, 0x42, 0x61, 0x72 /* "Bar" */ };
+    memset ( msg1 + 4, 'x', 200 );
+    scripted_data_feed_init ( &df1, msg1, sizeof ( msg1 ) );
+    /* the first read ends inside the extended payload length */
+    df1.feedseq[0] = 3;
+    df1.feedseq[1] = 0;
+    df1.feedseq[2] = 201;
+    scripted_data_feed_init ( &df2, msg2, sizeof ( msg2 ) );
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    memset ( &acc1, 0, sizeof ( acc1 ) );
+    memset ( &acc2, 0, sizeof ( acc2 ) );
+    ud1.df = &df1;
+    ud1.acc = &acc1;
+    ud2.df = &df2;
+    ud2.acc = &acc2;
+    callbacks.recv_callback = scripted_recv_callback;
+    callbacks.on_msg_recv_callback = recv_prealloc_msg_recv_callback;
+
+    wslay_event_context * ctx1 = wslay_client_new ( NULL, &callbacks, &ud1 );
+    wslay_event_context * ctx2 = wslay_client_new ( NULL, &callbacks, &ud2 );
+    CU_ASSERT_FATAL ( ctx1 != NULL && ctx2 != NULL );
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_event_config_set_recv_scratch_buffer ( ctx1, scratch, 16 ) );
+    CU_ASSERT ( 0 == wslay_event_config_set_recv_scratch_buffer ( ctx1, scratch, sizeof ( scratch ) ) );
+    CU_ASSERT ( 0 == wslay_event_config_set_recv_scratch_buffer ( ctx2, scratch, sizeof ( scratch ) ) );
+
+    /* the partial header is spilled into the context */
+    CU_ASSERT ( 0 == wslay_event_recv ( ctx1 ) );
+    CU_ASSERT ( ctx1->frame_ctx->ibuf == ctx1->frame_ctx->ispill );
+    CU_ASSERT ( 1 == ctx1->frame_ctx->ibuflimit - ctx1->frame_ctx->ibufmark );
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_event_config_set_recv_scratch_buffer ( ctx1, NULL, 0 ) );
+
+    /* the other context reads into the same scratch buffer */
+    CU_ASSERT ( 0 == wslay_event_recv ( ctx2 ) );
+    CU_ASSERT ( 3 == acc2.length );
+    CU_ASSERT ( 0 == memcmp ( "Bar", acc2.buf, acc2.length ) );
+    CU_ASSERT ( ctx2->frame_ctx->ibuf == NULL );
+
+    CU_ASSERT ( 0 == wslay_event_recv ( ctx1 ) );
+    CU_ASSERT ( 200 == acc1.length );
+    CU_ASSERT ( 0 == memcmp ( msg1 + 4, acc1.buf, acc1.length ) );
+    CU_ASSERT ( ctx1->frame_ctx->ibuf == NULL );
+
+    talloc_free ( ctx1 );
+    talloc_free ( ctx2 );
+}
+
+void test_wslay_event_context_reset ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    struct scripted_data_feed df;
+    const uint8_t msg[] = {
+        0x81, 0x03, 0x46, 0x6f, 0x6f, /* "Foo" */
+        0x82 /* partial header */
+    };
+    wslay_event_msg arg = { WSLAY_TEXT_FRAME, ( const uint8_t * ) "Bar", 3 };
+    scripted_data_feed_init ( &df, msg, sizeof ( msg ) );
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.df = &df;
+    ud.acc = &acc;
+    callbacks.recv_callback = scripted_recv_callback;
+    callbacks.on_msg_recv_callback = recv_prealloc_msg_recv_callback;
+
+    wslay_event_context_slab * slab = wslay_event_context_slab_new ( NULL, 2, false );
+    CU_ASSERT_FATAL ( slab != NULL );
+    wslay_event_context * ctx = wslay_event_context_slab_get ( slab, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+    CU_ASSERT ( !ctx->server );
+    CU_ASSERT ( ctx->user_data == &ud );
+    CU_ASSERT ( ctx->frame_user_data.user_data == &ud );
+
+    wslay_event_config_set_max_recv_msg_length ( ctx, 1024 );
+    CU_ASSERT ( 0 == wslay_event_queue_msg ( ctx, &arg ) );
+    CU_ASSERT ( 0 == wslay_event_recv ( ctx ) );
+    CU_ASSERT ( 3 == acc.length );
+    struct wslay_event_byte_chunk * spare = ctx->imsgs[0].spare;
+    wslay_frame_context * frame_ctx = ctx->frame_ctx;
+    CU_ASSERT ( spare != NULL );
+    CU_ASSERT ( frame_ctx->ibuf != NULL );
+
+    /* the context is back in its initial state, but keeps its allocations */
+    CU_ASSERT ( 0 == wslay_event_context_slab_put ( slab, ctx ) );
+    CU_ASSERT ( ctx == wslay_event_context_slab_get ( slab, &callbacks, &ud ) );
+    CU_ASSERT ( 0 == wslay_event_get_queued_msg_count ( ctx ) );
+    CU_ASSERT ( wslay_queue_is_empty ( &ctx->send_queue ) );
+    CU_ASSERT ( UINT64_MAX == ctx->max_recv_msg_length );
+    CU_ASSERT ( ctx->imsgs[0].spare == spare );
+    CU_ASSERT ( ctx->frame_ctx == frame_ctx );
+    CU_ASSERT ( frame_ctx->ibuf == NULL );
+    CU_ASSERT ( frame_ctx->istate == RECV_HEADER1 );
+
+    /* a new connection is received from the start */
+    scripted_data_feed_init ( &df, msg, 5 );
+    acc.length = 0;
+    CU_ASSERT ( 0 == wslay_event_recv ( ctx ) );
+    CU_ASSERT ( 3 == acc.length );
+    CU_ASSERT ( 0 == memcmp ( "Foo", acc.buf, acc.length ) );
+
+    CU_ASSERT ( NULL != wslay_event_context_slab_get ( slab, &callbacks, &ud ) );
+    CU_ASSERT ( NULL == wslay_event_context_slab_get ( slab, &callbacks, &ud ) );
+    CU_ASSERT ( 0 == wslay_event_context_slab_put ( slab, ctx ) );
+
+    talloc_free ( slab );
+}
+
+struct counting_allocator {
+    size_t alloc_count;
+    size_t free_count;
+    size_t allocated_length;
+};
+
+static void * counting_alloc ( void * user_data, size_t size )
+{
+    struct counting_allocator * counter = user_data;
+    counter->alloc_count ++;
+    counter->allocated_length += size;
+    return malloc ( size );
+}
+
+static void * counting_realloc ( void * user_data, void * ptr, size_t old_size, size_t size )
+{
+    struct counting_allocator * counter = user_data;
+    void * data = realloc ( ptr, size );
+    if ( data != NULL ) {
+        counter->allocated_length += size - old_size;
+    }
+    return data;
+}
+
+static void counting_free ( void * user_data, void * ptr, size_t size )
+{
+    struct counting_allocator * counter = user_data;
+    counter->free_count ++;
+    counter->allocated_length -= size;
+    free ( ptr );
+}
+
+void test_wslay_event_allocator ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    struct scripted_data_feed df;
+    struct counting_allocator counter = { 0, 0, 0 };
+    const wslay_allocator allocator = { counting_alloc, counting_realloc, counting_free, &counter };
+    const uint8_t msg[] = {
+        0x81, 0x03, 0x46, 0x6f, 0x6f, /* "Foo" */
+        0x82 /* partial header */
+    };
+    wslay_event_msg arg = { WSLAY_TEXT_FRAME, ( const uint8_t * ) "Bar", 3 };
+    scripted_data_feed_init ( &df, msg, sizeof ( msg ) );
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.df = &df;
+    ud.acc = &acc;
+    callbacks.recv_callback = scripted_recv_callback;
+    callbacks.on_msg_recv_callback = recv_prealloc_msg_recv_callback;
+
+    /* the default allocator is used by contexts created afterwards */
+    wslay_set_default_allocator ( &allocator );
+    CU_ASSERT ( wslay_get_default_allocator() == &allocator );
+    wslay_event_context * ctx = wslay_client_new ( NULL, &callbacks, &ud );
+    wslay_set_default_allocator ( NULL );
+    CU_ASSERT_FATAL ( ctx != NULL );
+    CU_ASSERT ( wslay_get_default_allocator() == &wslay_malloc_allocator );
+
+    CU_ASSERT ( 0 == wslay_event_config_set_msg_peek ( ctx, 2 ) );
+    CU_ASSERT ( 0 == wslay_event_queue_msg ( ctx, &arg ) );
+    CU_ASSERT ( 0 == wslay_event_recv ( ctx ) );
+    CU_ASSERT ( 3 == acc.length );
+    CU_ASSERT ( 0 == memcmp ( "Foo", acc.buf, acc.length ) );
+    /* queue cell, peek buffer, receive buffer and input buffer holding the partial header */
+    CU_ASSERT ( counter.alloc_count >= 4 );
+    CU_ASSERT ( counter.allocated_length >= WSLAY_FRAME_IBUF_LENGTH );
+
+    /* the allocator can not be replaced while ctx holds its memory */
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_event_config_set_allocator ( ctx, NULL ) );
+
+    talloc_free ( ctx );
+    CU_ASSERT ( counter.alloc_count == counter.free_count );
+    CU_ASSERT ( 0 == counter.allocated_length );
+
+    /* or it is set for a single context */
+    memset ( &counter, 0, sizeof ( counter ) );
+    scripted_data_feed_init ( &df, msg, 5 );
+    acc.length = 0;
+    ctx = wslay_client_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+    CU_ASSERT ( 0 == wslay_event_config_set_allocator ( ctx, &allocator ) );
+    CU_ASSERT ( 0 == wslay_event_recv ( ctx ) );
+    CU_ASSERT ( 3 == acc.length );
+    CU_ASSERT ( counter.alloc_count > 0 );
+
+    talloc_free ( ctx );
+    CU_ASSERT ( counter.alloc_count == counter.free_count );
+    CU_ASSERT ( 0 == counter.allocated_length );
+}
+
+void test_wslay_event_arena ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    struct counting_allocator counter = { 0, 0, 0 };
+    const wslay_allocator allocator = { counting_alloc, counting_realloc, counting_free, &counter };
+    static uint8_t payload[2048];
+    memset ( payload, 'a', sizeof ( payload ) );
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.acc = &acc;
+    callbacks.send_callback = accumulator_send_callback;
+
+    wslay_event_context * ctx = wslay_server_new ( NULL, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+    CU_ASSERT ( 0 == wslay_event_config_set_allocator ( ctx, &allocator ) );
+    CU_ASSERT ( 0 == wslay_event_config_set_arena ( ctx, 1024 ) );
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_event_config_set_arena ( ctx, 1024 ) );
+    CU_ASSERT ( ctx->allocator == &ctx->arena->allocator );
+    CU_ASSERT ( ctx->arena->parent == &allocator );
+
+    size_t alloc_count = 0;
+    int round;
+    for ( round = 0; round < 100; round ++ ) {
+        int i;
+        for ( i = 0; i < 10; i ++ ) {
+            wslay_event_msg arg = { WSLAY_BINARY_FRAME, payload, 100 + i };
+            CU_ASSERT ( 0 == wslay_event_queue_msg ( ctx, &arg ) );
+        }
+        /* the middle message is freed out of order */
+        CU_ASSERT ( 0 == wslay_event_cancel_msg ( ctx, wslay_event_get_last_msg_id ( ctx ) - 5 ) );
+        acc.length = 0;
+        CU_ASSERT ( 0 == wslay_event_send ( ctx ) );
+        CU_ASSERT ( 0 == wslay_event_get_queued_msg_count ( ctx ) );
+        CU_ASSERT ( 9 * 2 + 1045 - 104 == acc.length );
+        if ( round == 0 ) {
+            alloc_count = counter.alloc_count;
+        }
+    }
+    /* blocks are reused after the first round */
+    CU_ASSERT ( alloc_count == counter.alloc_count );
+    CU_ASSERT ( ctx->arena->head == ctx->arena->tail );
+    CU_ASSERT ( 0 == ctx->arena->head->live_count );
+
+    /* messages larger than a quarter of the block are allocated by the parent allocator */
+    size_t parent_alloc_count = ctx->arena->parent_alloc_count;
+    wslay_event_msg arg = { WSLAY_BINARY_FRAME, payload, 1000 };
+    CU_ASSERT ( 0 == wslay_event_queue_msg ( ctx, &arg ) );
+    CU_ASSERT ( parent_alloc_count + 1 == ctx->arena->parent_alloc_count );
+
+    talloc_free ( ctx );
+    CU_ASSERT ( counter.alloc_count == counter.free_count );
+    CU_ASSERT ( 0 == counter.allocated_length );
+}
+
+void test_wslay_event_hugepage_pool ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct my_user_data ud;
+    struct accumulator acc;
+    struct scripted_data_feed df;
+    const uint8_t msg[] = {
+        0x81, 0x03, 0x46, 0x6f, 0x6f /* "Foo" */
+    };
+    scripted_data_feed_init ( &df, msg, sizeof ( msg ) );
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    memset ( &acc, 0, sizeof ( acc ) );
+    ud.df = &df;
+    ud.acc = &acc;
+    callbacks.recv_callback = scripted_recv_callback;
+    callbacks.on_msg_recv_callback = recv_prealloc_msg_recv_callback;
+
+    /* slabs are 2 MiB aligned whatever kind of pages backs them */
+    enum wslay_hugepage_kind kind;
+    uint8_t * page = wslay_hugepage_map ( 1, &kind );
+    CU_ASSERT_FATAL ( page != NULL );
+    CU_ASSERT ( 0 == ( uintptr_t ) page % WSLAY_HUGEPAGE_LENGTH );
+    page[WSLAY_HUGEPAGE_LENGTH - 1] = 1;
+    wslay_hugepage_unmap ( page, 1 );
+
+    wslay_hugepage_pool * pool = wslay_hugepage_pool_new ( NULL );
+    CU_ASSERT_FATAL ( pool != NULL );
+    wslay_event_context_slab * slab = wslay_event_context_slab_new ( NULL, 2, false );
+    CU_ASSERT_FATAL ( slab != NULL );
+    CU_ASSERT ( 0 == wslay_event_context_slab_set_allocator ( slab, &pool->slabs.allocator ) );
+
+    wslay_event_context * ctx = wslay_event_context_slab_get ( slab, &callbacks, &ud );
+    CU_ASSERT_FATAL ( ctx != NULL );
+    CU_ASSERT ( ctx->allocator == &pool->slabs.allocator );
+    CU_ASSERT ( 0 == wslay_event_recv ( ctx ) );
+    CU_ASSERT ( 3 == acc.length );
+    CU_ASSERT ( 0 == memcmp ( "Foo", acc.buf, acc.length ) );
+
+    /* the receive buffer is carved from the only slab */
+    struct wslay_event_byte_chunk * spare = ctx->imsgs[0].spare;
+    CU_ASSERT_FATAL ( spare != NULL );
+    CU_ASSERT ( 1 == pool->slab_counts[WSLAY_HUGEPAGE_HUGETLB] + pool->slab_counts[WSLAY_HUGEPAGE_TRANSPARENT] +
+                pool->slab_counts[WSLAY_HUGEPAGE_NONE] );
+    CU_ASSERT ( spare->data >= pool->slabs.slab && spare->data < pool->slabs.slab + WSLAY_HUGEPAGE_LENGTH );
+
+    /* the allocator is kept when ctx is returned to the slab */
+    CU_ASSERT ( 0 == wslay_event_context_slab_put ( slab, ctx ) );
+    CU_ASSERT ( ctx->allocator == &pool->slabs.allocator );
+
+    talloc_free ( slab );
+    talloc_free ( pool );
+}
@@ -37,5 +37,35 @@ void test_wslay_event_callback_failure ( void );
 void test_wslay_event_no_buffering ( void );
 void test_wslay_event_frame_too_big ( void );
 void test_wslay_event_message_too_big ( void );
+void test_wslay_event_send_split_msg ( void );
+void test_wslay_event_send_split_msg_with_ctrl ( void );
+void test_wslay_event_send_fragmented_msg_small_buffer ( void );
+void test_wslay_event_send_fragmented_msg_coalescing ( void );
+void test_wslay_event_send_fragmented_msg_coalescing_deadline ( void );
+void test_wslay_event_queue_keyed_msg ( void );
+void test_wslay_event_queue_expiring_msg ( void );
+void test_wslay_event_queue_msg_with_options ( void );
+void test_wslay_event_cancel_msg ( void );
+void test_wslay_event_cancel_started_msg ( void );
+void test_wslay_event_send_deflate ( void );
+void test_wslay_event_recv_deflate ( void );
+void test_wslay_event_recv_deflate_not_negotiated ( void );
+void test_wslay_event_queue_broadcast ( void );
+void test_wslay_event_extension_negotiation ( void );
+void test_wslay_event_extension_pipeline ( void );
+void test_wslay_event_text_validation ( void );
+void test_wslay_event_discard_msg ( void );
+void test_wslay_event_msg_peek ( void );
+void test_wslay_event_recv_prealloc ( void );
+void test_wslay_event_recv_buffer_reuse ( void );
+void test_wslay_event_idle_footprint ( void );
+void test_wslay_event_recv_scratch_buffer ( void );
+void test_wslay_event_context_reset ( void );
+void test_wslay_event_allocator ( void );
+void test_wslay_event_arena ( void );
+void test_wslay_event_hugepage_pool ( void );
+void test_wslay_event_cancel_msg_after_ctrl ( void );
+void test_wslay_event_extension_encode_only ( void );
+void test_wslay_event_extension_deflate_confirm ( void );
 
 #endif /* WSLAY_EVENT_TEST_H */
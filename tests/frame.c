@@ -118,6 +118,39 @@ void test_wslay_frame_recv ( void )
     talloc_free ( ctx );
 }
 
+void test_wslay_frame_recv_keep_mask ( void )
+{
+    struct wslay_frame_callbacks callbacks = { NULL, scripted_recv_callback, NULL };
+    struct scripted_data_feed df;
+    struct wslay_frame_iocb iocb;
+    size_t data_length;
+    uint8_t unmasked[5];
+    /* Masked text frame containing "Hello", received in parts */
+    uint8_t msg[] = { 0x81u, 0x85u, 0x37u, 0xfau, 0x21u, 0x3du, 0x7fu, 0x9fu,
+                      0x4du, 0x51u, 0x58u
+                    };
+    scripted_data_feed_init ( &df, msg, sizeof ( msg ) );
+    df.feedseq[0] = 9;
+    df.feedseq[1] = 2;
+
+    wslay_frame_context * ctx = wslay_frame_context_new ( NULL, &callbacks, &df );
+    CU_ASSERT_FATAL ( ctx != NULL );
+    ctx->ikeepmask = true;
+
+    CU_ASSERT ( wslay_frame_recv ( ctx, &iocb, &data_length ) == 0 );
+    CU_ASSERT ( 3 == data_length );
+    CU_ASSERT_EQUAL ( 1, iocb.mask );
+    CU_ASSERT ( 0 == memcmp ( msg + 6, iocb.data, 3 ) );
+    wslay_frame_apply_mask ( unmasked, iocb.data, 3, ctx->imaskkey, 0 );
+
+    CU_ASSERT ( wslay_frame_recv ( ctx, &iocb, &data_length ) == 0 );
+    CU_ASSERT ( 2 == data_length );
+    wslay_frame_apply_mask ( unmasked + 3, iocb.data, 2, ctx->imaskkey, 3 );
+    CU_ASSERT ( 0 == memcmp ( "Hello", unmasked, 5 ) );
+
+    talloc_free ( ctx );
+}
+
 void test_wslay_frame_recv_1byte ( void )
 {
     struct wslay_frame_callbacks callbacks = { NULL, scripted_recv_callback, NULL };
@@ -27,6 +27,7 @@
 
 void test_wslay_frame_context_init ( void );
 void test_wslay_frame_recv ( void );
+void test_wslay_frame_recv_keep_mask ( void );
 void test_wslay_frame_recv_1byte ( void );
 void test_wslay_frame_recv_fragmented ( void );
 void test_wslay_frame_recv_interleaved_ctrl_frame ( void );
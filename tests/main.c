@@ -29,6 +29,14 @@
 #include "frame.h"
 #include "event.h"
 #include "queue.h"
+#include "deflate.h"
+#include "utf8.h"
+#ifdef WSLAY_ZSTD
+#include "zstd_ext.h"
+#endif
+#ifdef WSLAY_NUMA
+#include "numa_pool.h"
+#endif
 
 static int init_suite1 ( void )
 {
@@ -60,6 +68,8 @@ int main ( void )
     if ( !CU_add_test ( pSuite, "wslay_frame_context_init",
                         test_wslay_frame_context_init ) ||
             !CU_add_test ( pSuite, "wslay_frame_recv", test_wslay_frame_recv ) ||
+            !CU_add_test ( pSuite, "wslay_frame_recv_keep_mask",
+                           test_wslay_frame_recv_keep_mask ) ||
             !CU_add_test ( pSuite, "wslay_frame_recv_1byte",
                            test_wslay_frame_recv_1byte ) ||
             !CU_add_test ( pSuite, "wslay_frame_recv_fragmented",
@@ -113,10 +123,104 @@ int main ( void )
                            test_wslay_event_frame_too_big ) ||
             !CU_add_test ( pSuite, "wslay_event_message_too_big",
                            test_wslay_event_message_too_big ) ||
-            !CU_add_test ( pSuite, "wslay_queue", test_wslay_queue ) ) {
+            !CU_add_test ( pSuite, "wslay_event_send_split_msg",
+                           test_wslay_event_send_split_msg ) ||
+            !CU_add_test ( pSuite, "wslay_event_send_split_msg_with_ctrl",
+                           test_wslay_event_send_split_msg_with_ctrl ) ||
+            !CU_add_test ( pSuite, "wslay_event_send_fragmented_msg_small_buffer",
+                           test_wslay_event_send_fragmented_msg_small_buffer ) ||
+            !CU_add_test ( pSuite, "wslay_event_send_fragmented_msg_coalescing",
+                           test_wslay_event_send_fragmented_msg_coalescing ) ||
+            !CU_add_test ( pSuite, "wslay_event_send_fragmented_msg_coalescing_deadline",
+                           test_wslay_event_send_fragmented_msg_coalescing_deadline ) ||
+            !CU_add_test ( pSuite, "wslay_event_queue_keyed_msg",
+                           test_wslay_event_queue_keyed_msg ) ||
+            !CU_add_test ( pSuite, "wslay_event_queue_expiring_msg",
+                           test_wslay_event_queue_expiring_msg ) ||
+            !CU_add_test ( pSuite, "wslay_event_queue_msg_with_options",
+                           test_wslay_event_queue_msg_with_options ) ||
+            !CU_add_test ( pSuite, "wslay_event_cancel_msg",
+                           test_wslay_event_cancel_msg ) ||
+            !CU_add_test ( pSuite, "wslay_event_cancel_started_msg",
+                           test_wslay_event_cancel_started_msg ) ||
+            !CU_add_test ( pSuite, "wslay_deflate_parse_params",
+                           test_wslay_deflate_parse_params ) ||
+            !CU_add_test ( pSuite, "wslay_deflate_format_params",
+                           test_wslay_deflate_format_params ) ||
+            !CU_add_test ( pSuite, "wslay_deflate_message",
+                           test_wslay_deflate_message ) ||
+            !CU_add_test ( pSuite, "wslay_deflate_pool",
+                           test_wslay_deflate_pool ) ||
+            !CU_add_test ( pSuite, "wslay_event_send_deflate",
+                           test_wslay_event_send_deflate ) ||
+            !CU_add_test ( pSuite, "wslay_event_recv_deflate",
+                           test_wslay_event_recv_deflate ) ||
+            !CU_add_test ( pSuite, "wslay_event_recv_deflate_not_negotiated",
+                           test_wslay_event_recv_deflate_not_negotiated ) ||
+            !CU_add_test ( pSuite, "wslay_event_queue_broadcast",
+                           test_wslay_event_queue_broadcast ) ||
+            !CU_add_test ( pSuite, "wslay_event_extension_negotiation",
+                           test_wslay_event_extension_negotiation ) ||
+            !CU_add_test ( pSuite, "wslay_event_extension_pipeline",
+                           test_wslay_event_extension_pipeline ) ||
+            !CU_add_test ( pSuite, "wslay_event_text_validation",
+                           test_wslay_event_text_validation ) ||
+            !CU_add_test ( pSuite, "wslay_event_discard_msg",
+                           test_wslay_event_discard_msg ) ||
+            !CU_add_test ( pSuite, "wslay_event_msg_peek",
+                           test_wslay_event_msg_peek ) ||
+            !CU_add_test ( pSuite, "wslay_event_recv_prealloc",
+                           test_wslay_event_recv_prealloc ) ||
+            !CU_add_test ( pSuite, "wslay_event_recv_buffer_reuse",
+                           test_wslay_event_recv_buffer_reuse ) ||
+            !CU_add_test ( pSuite, "wslay_event_idle_footprint",
+                           test_wslay_event_idle_footprint ) ||
+            !CU_add_test ( pSuite, "wslay_event_recv_scratch_buffer",
+                           test_wslay_event_recv_scratch_buffer ) ||
+            !CU_add_test ( pSuite, "wslay_event_context_reset",
+                           test_wslay_event_context_reset ) ||
+            !CU_add_test ( pSuite, "wslay_event_allocator",
+                           test_wslay_event_allocator ) ||
+            !CU_add_test ( pSuite, "wslay_event_arena",
+                           test_wslay_event_arena ) ||
+            !CU_add_test ( pSuite, "wslay_event_hugepage_pool",
+                           test_wslay_event_hugepage_pool ) ||
+            !CU_add_test ( pSuite, "wslay_event_cancel_msg_after_ctrl",
+                           test_wslay_event_cancel_msg_after_ctrl ) ||
+            !CU_add_test ( pSuite, "wslay_event_extension_encode_only",
+                           test_wslay_event_extension_encode_only ) ||
+            !CU_add_test ( pSuite, "wslay_event_extension_deflate_confirm",
+                           test_wslay_event_extension_deflate_confirm ) ||
+            !CU_add_test ( pSuite, "wslay_queue", test_wslay_queue ) ||
+            !CU_add_test ( pSuite, "wslay_utf8_validate", test_wslay_utf8_validate ) ||
+            !CU_add_test ( pSuite, "wslay_utf8_validate_parts",
+                           test_wslay_utf8_validate_parts ) ||
+            !CU_add_test ( pSuite, "wslay_utf8_validate_copy",
+                           test_wslay_utf8_validate_copy ) ||
+            !CU_add_test ( pSuite, "wslay_utf8_validate_copy_odd_offset",
+                           test_wslay_utf8_validate_copy_odd_offset ) ||
+            !CU_add_test ( pSuite, "wslay_utf8_validate_masked",
+                           test_wslay_utf8_validate_masked ) ) {
         CU_cleanup_registry();
         return CU_get_error();
     }
+#ifdef WSLAY_ZSTD
+    if ( !CU_add_test ( pSuite, "wslay_zstd_negotiation",
+                        test_wslay_zstd_negotiation ) ||
+            !CU_add_test ( pSuite, "wslay_zstd_send_recv",
+                           test_wslay_zstd_send_recv ) ||
+            !CU_add_test ( pSuite, "wslay_zstd_window_limit",
+                           test_wslay_zstd_window_limit ) ) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+#endif
+#ifdef WSLAY_NUMA
+    if ( !CU_add_test ( pSuite, "wslay_numa_pool", test_wslay_numa_pool ) ) {
+        CU_cleanup_registry();
+        return CU_get_error();
+    }
+#endif
 
     /* Run all tests using the CUnit Basic interface */
     CU_basic_set_mode ( CU_BRM_VERBOSE );
@@ -0,0 +1,101 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <string.h>
+
+#include <CUnit/CUnit.h>
+#include <numa.h>
+#include <numaif.h>
+
+#include <wslay/event.h>
+#include <wslay/context.h>
+#include <wslay/numa_pool.h>
+#include "numa_pool.h"
+
+struct sink {
+    uint8_t buf[1024];
+    size_t length;
+};
+
+static ssize_t sink_send_callback ( wslay_event_context * ctx, const uint8_t * data, size_t len, int flags, void * user_data, bool user_data_sending )
+{
+    struct sink * sink = user_data;
+    memcpy ( sink->buf + sink->length, data, len );
+    sink->length += len;
+    return len;
+}
+
+void test_wslay_numa_pool ( void )
+{
+    wslay_numa_pools * pools = wslay_numa_pools_new ( NULL );
+    if ( numa_available() < 0 ) {
+        CU_ASSERT ( pools == NULL );
+        return;
+    }
+    CU_ASSERT_FATAL ( pools != NULL );
+    CU_ASSERT ( pools->node_count == numa_max_node() + 1 );
+
+    wslay_numa_pool * pool = wslay_numa_pools_get ( pools, -1 );
+    CU_ASSERT_FATAL ( pool != NULL );
+    CU_ASSERT ( pool == wslay_numa_pools_get ( pools, pool->node ) );
+    CU_ASSERT ( pool == wslay_numa_pools_get ( pools, pools->node_count ) || pools->pools[0] == NULL );
+
+    /* blocks are placed on the node of the pool and reused from free lists */
+    uint8_t * block = wslay_alloc ( &pool->slabs.allocator, 100 );
+    CU_ASSERT_FATAL ( block != NULL );
+    memset ( block, 0, 100 );
+    void * page = ( void * ) ( ( uintptr_t ) block & ~( ( uintptr_t ) numa_pagesize() - 1 ) );
+    int status = -1;
+    CU_ASSERT ( 0 == numa_move_pages ( 0, 1, &page, NULL, &status, 0 ) );
+    CU_ASSERT ( pool->node == status );
+    CU_ASSERT ( block == wslay_realloc ( &pool->slabs.allocator, block, 100, 120 ) );
+    wslay_free ( &pool->slabs.allocator, block, 120 );
+    CU_ASSERT ( block == wslay_alloc ( &pool->slabs.allocator, 128 ) );
+    wslay_free ( &pool->slabs.allocator, block, 128 );
+
+    /* allocations larger than size classes are requested from the node */
+    block = wslay_alloc ( &pool->slabs.allocator, 100000 );
+    CU_ASSERT_FATAL ( block != NULL );
+    memset ( block, 0, 100000 );
+    wslay_free ( &pool->slabs.allocator, block, 100000 );
+    CU_ASSERT ( 1 == pool->slabs.slab_count );
+
+    struct wslay_event_callbacks callbacks;
+    struct sink sink;
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    sink.length = 0;
+    callbacks.send_callback = sink_send_callback;
+    wslay_event_context * ctx = wslay_server_new ( NULL, &callbacks, &sink );
+    CU_ASSERT_FATAL ( ctx != NULL );
+    CU_ASSERT ( 0 == wslay_numa_pools_bind ( pools, ctx ) );
+    CU_ASSERT ( ctx->allocator == &pool->slabs.allocator );
+    wslay_event_msg arg = { WSLAY_TEXT_FRAME, ( const uint8_t * ) "Foo", 3 };
+    CU_ASSERT ( 0 == wslay_event_queue_msg ( ctx, &arg ) );
+    CU_ASSERT ( 0 == wslay_event_send ( ctx ) );
+    CU_ASSERT ( 5 == sink.length );
+    CU_ASSERT ( 0 == memcmp ( "Foo", sink.buf + 2, 3 ) );
+
+    talloc_free ( ctx );
+    talloc_free ( pools );
+}
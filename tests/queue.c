@@ -56,5 +56,22 @@ void test_wslay_queue ( void )
         CU_ASSERT ( wslay_queue_pop ( queue ) == 0 );
     }
     CU_ASSERT ( wslay_queue_is_empty ( queue ) );
+
+    for ( i = 0; i < 5; ++i ) {
+        CU_ASSERT ( wslay_queue_push ( queue, &ints[i] ) == 0 );
+    }
+    CU_ASSERT ( wslay_queue_remove ( queue, &ints[0] ) == 0 );
+    CU_ASSERT ( wslay_queue_remove ( queue, &ints[2] ) == 0 );
+    CU_ASSERT ( wslay_queue_remove ( queue, &ints[4] ) == 0 );
+    CU_ASSERT ( wslay_queue_remove ( queue, &ints[4] ) != 0 );
+    CU_ASSERT ( wslay_queue_push ( queue, &ints[0] ) == 0 );
+    CU_ASSERT_EQUAL ( ints[0], * ( int * ) ( wslay_queue_tail ( queue ) ) );
+    CU_ASSERT_EQUAL ( ints[1], * ( int * ) ( wslay_queue_top ( queue ) ) );
+    CU_ASSERT ( wslay_queue_pop ( queue ) == 0 );
+    CU_ASSERT_EQUAL ( ints[3], * ( int * ) ( wslay_queue_top ( queue ) ) );
+    CU_ASSERT ( wslay_queue_pop ( queue ) == 0 );
+    CU_ASSERT_EQUAL ( ints[0], * ( int * ) ( wslay_queue_top ( queue ) ) );
+    CU_ASSERT ( wslay_queue_pop ( queue ) == 0 );
+    CU_ASSERT ( wslay_queue_is_empty ( queue ) );
     talloc_free ( queue );
 }
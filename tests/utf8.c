@@ -0,0 +1,230 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <string.h>
+
+#include <CUnit/CUnit.h>
+
+#include <wslay/utf8.h>
+#include "utf8.h"
+
+// ASCII runs longer than vector blocks with 2, 3 and 4 byte characters between them.
+static const char text[] =
+    "The quick brown fox jumps over the lazy dog, and keeps running. "
+    "\xc2\xa9 \xc3\xa9t\xc3\xa9 \xce\xb1\xce\xb2\xce\xb3 \xe2\x82\xac\xe2\x82\xac "
+    "\xe6\x97\xa5\xe6\x9c\xac\xe8\xaa\x9e \xed\x9f\xbf \xee\x80\x80 \xef\xbf\xbd "
+    "\xf0\x9f\x98\x80\xf0\x90\x80\x80\xf4\x8f\xbf\xbf "
+    "then ASCII again for a while, long enough to fill another block of 32 bytes. "
+    "\xd0\x9f\xd1\x80\xd0\xb8\xd0\xb2\xd0\xb5\xd1\x82\xe4\xb8\x96\xe7\x95\x8c!";
+
+// Validates byte by byte with decode(), the reference of all implementations.
+static uint32_t reference ( const uint8_t * data, size_t length )
+{
+    uint32_t state = UTF8_ACCEPT, codep;
+    size_t i;
+    for ( i = 0; i < length && state != UTF8_REJECT; ++i ) {
+        decode ( &state, &codep, data[i] );
+    }
+    return state;
+}
+
+static void check_all ( const uint8_t * data, size_t length )
+{
+    wslay_utf8_validator validators[4];
+    size_t count = wslay_utf8_get_validators ( validators, 4 );
+    uint32_t expected = reference ( data, length );
+    uint32_t state = UTF8_ACCEPT;
+    size_t i;
+    CU_ASSERT ( expected == wslay_utf8_validate ( &state, data, length ) );
+    for ( i = 0; i < count; ++i ) {
+        state = UTF8_ACCEPT;
+        CU_ASSERT ( expected == validators[i] ( &state, NULL, data, length, NULL, 0 ) );
+        CU_ASSERT ( expected == state );
+    }
+}
+
+void test_wslay_utf8_validate ( void )
+{
+    static const uint8_t replacements[] = { 0x00, 0x41, 0x80, 0xbf, 0xc0, 0xc1, 0xc2, 0xdf, 0xe0, 0xed, 0xef, 0xf0, 0xf4, 0xf5, 0xff };
+    uint8_t data[sizeof ( text )];
+    size_t length = sizeof ( text ) - 1;
+    size_t i, j;
+    wslay_utf8_validator validators[4];
+    CU_ASSERT ( 0 < wslay_utf8_get_validators ( validators, 4 ) );
+
+    memcpy ( data, text, length );
+    CU_ASSERT ( UTF8_ACCEPT == reference ( data, length ) );
+    check_all ( data, length );
+    /* every prefix, so the text ends at each offset of vector blocks */
+    for ( i = 0; i < length; ++i ) {
+        check_all ( data, i );
+    }
+    /* every byte replaced by ASCII, continuation and lead bytes */
+    for ( i = 0; i < length; ++i ) {
+        for ( j = 0; j < sizeof ( replacements ); ++j ) {
+            data[i] = replacements[j];
+            check_all ( data, length );
+        }
+        data[i] = text[i];
+    }
+    /* overlong, surrogate and too large characters */
+    check_all ( ( const uint8_t * ) "0123456789abcdef0123456789abcdef\xc0\xaf", 34 );
+    check_all ( ( const uint8_t * ) "0123456789abcdef0123456789abcdef\xe0\x80\xaf", 35 );
+    check_all ( ( const uint8_t * ) "0123456789abcdef0123456789abcdef\xed\xa0\x80", 35 );
+    check_all ( ( const uint8_t * ) "0123456789abcdef0123456789abcdef\xf4\x90\x80\x80", 36 );
+    check_all ( ( const uint8_t * ) "0123456789abcdef0123456789abcde\xe2\x82\xac" "0123456789abcdef0123456789a", 62 );
+}
+
+void test_wslay_utf8_validate_parts ( void )
+{
+    wslay_utf8_validator validators[4];
+    size_t count = wslay_utf8_get_validators ( validators, 4 );
+    const uint8_t * data = ( const uint8_t * ) text;
+    size_t length = sizeof ( text ) - 1;
+    size_t i, j, k;
+    /* character split between parts, the state is carried to the next part */
+    for ( i = 0; i < count; ++i ) {
+        for ( j = 0; j <= length; ++j ) {
+            for ( k = j; k <= length; k += 7 ) {
+                uint32_t state = UTF8_ACCEPT;
+                validators[i] ( &state, NULL, data, j, NULL, 0 );
+                validators[i] ( &state, NULL, data + j, k - j, NULL, 0 );
+                CU_ASSERT ( UTF8_REJECT != state );
+                CU_ASSERT ( UTF8_ACCEPT == validators[i] ( &state, NULL, data + k, length - k, NULL, 0 ) );
+            }
+        }
+    }
+    /* truncated character is not accepted */
+    uint32_t state = UTF8_ACCEPT;
+    CU_ASSERT ( UTF8_ACCEPT != wslay_utf8_validate ( &state, ( const uint8_t * ) "\xf0\x9f\x98", 3 ) );
+    CU_ASSERT ( UTF8_REJECT != state );
+    CU_ASSERT ( UTF8_REJECT == wslay_utf8_validate ( &state, ( const uint8_t * ) "0123456789abcdef0123456789abcdef0", 33 ) );
+}
+
+void test_wslay_utf8_validate_copy ( void )
+{
+    static const uint8_t mask[4] = { 0x37, 0xfa, 0x21, 0x3d };
+    wslay_utf8_validator validators[4];
+    size_t count = wslay_utf8_get_validators ( validators, 4 );
+    size_t length = sizeof ( text ) - 1;
+    uint8_t masked[sizeof ( text )], dst[sizeof ( text )];
+    size_t i, j, k;
+    for ( i = 0; i < length; ++i ) {
+        masked[i] = text[i] ^ mask[i % 4];
+    }
+    for ( i = 0; i < count; ++i ) {
+        /* copied and unmasked in parts at every split, the mask offset follows the payload offset */
+        for ( j = 0; j <= length; ++j ) {
+            uint32_t state = UTF8_ACCEPT;
+            memset ( dst, 0, sizeof ( dst ) );
+            validators[i] ( &state, dst, masked, j, mask, 0 );
+            CU_ASSERT ( UTF8_ACCEPT == validators[i] ( &state, dst + j, masked + j, length - j, mask, j ) );
+            CU_ASSERT ( 0 == memcmp ( text, dst, length ) );
+        }
+        /* in place */
+        uint32_t state = UTF8_ACCEPT;
+        memcpy ( dst, masked, length );
+        CU_ASSERT ( UTF8_ACCEPT == validators[i] ( &state, dst, dst, length, mask, 0 ) );
+        CU_ASSERT ( 0 == memcmp ( text, dst, length ) );
+        /* copied without mask */
+        state = UTF8_ACCEPT;
+        CU_ASSERT ( UTF8_ACCEPT == validators[i] ( &state, dst, ( const uint8_t * ) text, length, NULL, 0 ) );
+        CU_ASSERT ( 0 == memcmp ( text, dst, length ) );
+        /* invalid byte is found after unmasking */
+        for ( k = 0; k < length; k += 5 ) {
+            uint8_t invalid[sizeof ( text )];
+            memcpy ( invalid, masked, length );
+            invalid[k] = 0xff ^ mask[k % 4];
+            state = UTF8_ACCEPT;
+            CU_ASSERT ( UTF8_REJECT == validators[i] ( &state, dst, invalid, length, mask, 0 ) );
+        }
+    }
+    uint32_t state = UTF8_ACCEPT;
+    CU_ASSERT ( UTF8_ACCEPT == wslay_utf8_validate_copy ( &state, dst, masked + 3, length - 3, mask, 3 ) );
+    CU_ASSERT ( 0 == memcmp ( text + 3, dst, length - 3 ) );
+}
+
+void test_wslay_utf8_validate_copy_odd_offset ( void )
+{
+    // ASCII runs start right after characters of 2, 3 and 1 bytes, at every offset of the key
+    static const uint8_t mask[4] = { 0x12, 0x9a, 0x33, 0xc7 };
+    static const char chunks[][48] = {
+        "\xc3\xa9" "abcdefghijklmnop",
+        "\xe2\x82\xac" "abcdefghijklmnopqrstuvwxyz0123456789ABCDEF",
+        "\xc3\xa9" "abcdefghijklmnopqrstuvwxyz0123456789ABCDEFG\xff",
+        "\xf0\x9f\x98\x80" "abcdefghijklmnopqrstu\xc3" "abcdefghijklmnop"
+    };
+    wslay_utf8_validator validators[4];
+    size_t count = wslay_utf8_get_validators ( validators, 4 );
+    uint8_t data[64], masked[64], dst[64];
+    size_t c, p, i, k;
+    for ( c = 0; c < sizeof ( chunks ) / sizeof ( chunks[0] ); ++c ) {
+        for ( p = 0; p < 8; ++p ) {
+            size_t length = p + strlen ( chunks[c] );
+            memset ( data, 'x', p );
+            memcpy ( data + p, chunks[c], length - p );
+            for ( k = 0; k < length; ++k ) {
+                masked[k] = data[k] ^ mask[k % 4];
+            }
+            uint32_t expected = reference ( data, length );
+            for ( i = 0; i < count; ++i ) {
+                uint32_t state = UTF8_ACCEPT;
+                memset ( dst, 0, sizeof ( dst ) );
+                CU_ASSERT ( expected == validators[i] ( &state, dst, masked, length, mask, 0 ) );
+                if ( expected != UTF8_REJECT ) {
+                    CU_ASSERT ( 0 == memcmp ( data, dst, length ) );
+                }
+            }
+            uint32_t state = UTF8_ACCEPT;
+            CU_ASSERT ( expected == wslay_utf8_validate_copy ( &state, dst, masked, length, mask, 0 ) );
+            if ( expected != UTF8_REJECT ) {
+                CU_ASSERT ( 0 == memcmp ( data, dst, length ) );
+            }
+        }
+    }
+}
+
+void test_wslay_utf8_validate_masked ( void )
+{
+    // validated without copy, the vector tail is checked from masked data
+    static const uint8_t mask[4] = { 0x5c, 0x81, 0xe7, 0x0d };
+    wslay_utf8_validator validators[4];
+    size_t count = wslay_utf8_get_validators ( validators, 4 );
+    size_t length = sizeof ( text ) - 1;
+    uint8_t masked[sizeof ( text ) + 3];
+    size_t i, j, o;
+    for ( o = 0; o < 4; ++o ) {
+        for ( j = 0; j < length; ++j ) {
+            masked[j] = text[j] ^ mask[( o + j ) % 4];
+        }
+        for ( i = 0; i < count; ++i ) {
+            for ( j = 0; j <= length; ++j ) {
+                uint32_t state = UTF8_ACCEPT;
+                uint32_t expected = reference ( ( const uint8_t * ) text, j );
+                CU_ASSERT ( expected == validators[i] ( &state, NULL, masked, j, mask, o ) );
+                CU_ASSERT ( expected == state );
+            }
+        }
+    }
+}
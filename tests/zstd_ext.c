@@ -0,0 +1,273 @@
+/*
+ * Wslay - The WebSocket Library
+ *
+ * Copyright (c) 2011, 2012 Tatsuhiro Tsujikawa
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining
+ * a copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sublicense, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+ * LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+ * OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+ * WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ */
+#include <string.h>
+#include <stdio.h>
+
+#include <CUnit/CUnit.h>
+#include <zdict.h>
+
+#include <wslay/event.h>
+#include <wslay/context.h>
+#include <wslay/zstd_ext.h>
+#include "zstd_ext.h"
+
+#define SAMPLE_COUNT 512
+
+static size_t json_sample ( char * buf, size_t length, unsigned int i )
+{
+    return snprintf ( buf, length, "{\"id\":%u,\"type\":\"%s\",\"user\":\"user%u\",\"price\":%u.%02u,\"active\":%s}",
+                      i, i % 3 ? "update" : "insert", i * 7 % 1000, i * 13 % 500, i % 100, i % 2 ? "true" : "false" );
+}
+
+// Trains dictionary on small JSON messages, returns its length.
+static size_t train_dictionary ( uint8_t * dictionary, size_t length )
+{
+    static char samples[SAMPLE_COUNT * 128];
+    size_t sizes[SAMPLE_COUNT];
+    size_t offset = 0;
+    unsigned int i;
+    for ( i = 0; i < SAMPLE_COUNT; ++i ) {
+        sizes[i] = json_sample ( samples + offset, sizeof ( samples ) - offset, i );
+        offset += sizes[i];
+    }
+    size_t r = ZDICT_trainFromBuffer ( dictionary, length, samples, sizes, SAMPLE_COUNT );
+    return ZDICT_isError ( r ) ? 0 : r;
+}
+
+void test_wslay_zstd_negotiation ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    uint8_t dictionary[2048];
+    char offer[64], response[64], ans[64];
+    size_t dictionary_length = train_dictionary ( dictionary, sizeof ( dictionary ) );
+    CU_ASSERT_FATAL ( dictionary_length != 0 );
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+
+    CU_ASSERT ( NULL == wslay_zstd_shared_new ( NULL, "raw", 3, 3 ) );
+    wslay_zstd_shared * shared = wslay_zstd_shared_new ( NULL, dictionary, dictionary_length, 3 );
+    wslay_zstd_shared * plain_shared = wslay_zstd_shared_new ( NULL, NULL, 0, 3 );
+    CU_ASSERT_FATAL ( shared != NULL && plain_shared != NULL );
+    snprintf ( ans, sizeof ( ans ), "x-wslay-zstd; dict=%u", ( unsigned int ) shared->dictionary_id );
+
+    wslay_event_context * client = wslay_client_new ( NULL, &callbacks, NULL );
+    wslay_event_context * server = wslay_server_new ( NULL, &callbacks, NULL );
+    CU_ASSERT_FATAL ( client != NULL && server != NULL );
+    CU_ASSERT ( 0 == wslay_event_config_add_extension ( client, &wslay_zstd_extension, shared ) );
+    CU_ASSERT ( 0 == wslay_event_config_add_extension ( client, &wslay_deflate_extension, NULL ) );
+    CU_ASSERT ( 0 < wslay_event_extensions_offer ( client, offer, sizeof ( offer ) ) );
+    CU_ASSERT ( 0 == strncmp ( ans, offer, strlen ( ans ) ) );
+
+    /* server prefers zstd, permessage-deflate is not enabled as RSV1 is taken */
+    CU_ASSERT ( 0 == wslay_event_config_add_extension ( server, &wslay_zstd_extension, shared ) );
+    CU_ASSERT ( 0 == wslay_event_config_add_extension ( server, &wslay_deflate_extension, NULL ) );
+    CU_ASSERT ( ( ssize_t ) strlen ( ans ) == wslay_event_extensions_accept ( server, offer, strlen ( offer ), response, sizeof ( response ) ) );
+    CU_ASSERT ( 0 == strcmp ( ans, response ) );
+    CU_ASSERT ( NULL == wslay_event_get_extension_data ( server, &wslay_deflate_extension ) );
+    wslay_zstd_context * zstd_ctx = wslay_event_get_extension_data ( server, &wslay_zstd_extension );
+    CU_ASSERT_FATAL ( zstd_ctx != NULL );
+    CU_ASSERT ( zstd_ctx->dictionary );
+
+    CU_ASSERT ( 0 == wslay_event_extensions_confirm ( client, response, strlen ( response ) ) );
+    zstd_ctx = wslay_event_get_extension_data ( client, &wslay_zstd_extension );
+    CU_ASSERT_FATAL ( zstd_ctx != NULL );
+    CU_ASSERT ( zstd_ctx->dictionary );
+    talloc_free ( server );
+
+    /* server without the dictionary compresses without it */
+    server = wslay_server_new ( NULL, &callbacks, NULL );
+    CU_ASSERT_FATAL ( server != NULL );
+    CU_ASSERT ( 0 == wslay_event_config_add_extension ( server, &wslay_zstd_extension, plain_shared ) );
+    CU_ASSERT ( 12 == wslay_event_extensions_accept ( server, offer, strlen ( offer ), response, sizeof ( response ) ) );
+    CU_ASSERT ( 0 == strcmp ( "x-wslay-zstd", response ) );
+    zstd_ctx = wslay_event_get_extension_data ( server, &wslay_zstd_extension );
+    CU_ASSERT_FATAL ( zstd_ctx != NULL );
+    CU_ASSERT ( !zstd_ctx->dictionary );
+
+    talloc_free ( server );
+    talloc_free ( client );
+    talloc_free ( shared );
+    talloc_free ( plain_shared );
+}
+
+struct zstd_user_data {
+    uint8_t buf[4096];
+    size_t length;
+    size_t offset;
+    size_t msg_count;
+};
+
+static ssize_t zstd_send_callback ( wslay_event_context * ctx, const uint8_t *buf, size_t len, int flags, void* user_data, bool user_data_sending )
+{
+    struct zstd_user_data * data = user_data;
+    memcpy ( data->buf + data->length, buf, len );
+    data->length += len;
+    return len;
+}
+
+static ssize_t zstd_recv_callback ( wslay_event_context * ctx, uint8_t* buf, size_t len, int flags, void *user_data )
+{
+    struct zstd_user_data * data = user_data;
+    /* small reads split the message into several parts */
+    size_t length = data->length - data->offset < 7 ? data->length - data->offset : 7;
+    if ( length == 0 ) {
+        wslay_event_set_error ( ctx, WSLAY_ERR_WOULDBLOCK );
+        return -1;
+    }
+    length = length < len ? length : len;
+    memcpy ( buf, data->buf + data->offset, length );
+    data->offset += length;
+    return length;
+}
+
+static void zstd_msg_recv_callback ( wslay_event_context * ctx, const struct wslay_event_on_msg_recv_arg *arg, void *user_data )
+{
+    struct zstd_user_data * data = user_data;
+    char sample[128];
+    size_t length = json_sample ( sample, sizeof ( sample ), data->msg_count );
+    CU_ASSERT ( WSLAY_ZSTD_RSV == arg->rsv );
+    CU_ASSERT ( length == arg->msg_length );
+    CU_ASSERT ( 0 == memcmp ( sample, arg->msg, length ) );
+    data->msg_count ++;
+}
+
+void test_wslay_zstd_send_recv ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct zstd_user_data data;
+    uint8_t dictionary[2048];
+    char sample[128];
+    wslay_event_msg arg;
+    size_t dictionary_length = train_dictionary ( dictionary, sizeof ( dictionary ) );
+    CU_ASSERT_FATAL ( dictionary_length != 0 );
+    wslay_zstd_shared * shared = wslay_zstd_shared_new ( NULL, dictionary, dictionary_length, 3 );
+    CU_ASSERT_FATAL ( shared != NULL );
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    callbacks.send_callback = zstd_send_callback;
+    callbacks.recv_callback = zstd_recv_callback;
+    callbacks.on_msg_recv_callback = zstd_msg_recv_callback;
+    memset ( &data, 0, sizeof ( data ) );
+
+    wslay_event_context * server = wslay_server_new ( NULL, &callbacks, &data );
+    wslay_event_context * client = wslay_client_new ( NULL, &callbacks, &data );
+    CU_ASSERT_FATAL ( client != NULL && server != NULL );
+    wslay_zstd_context * server_zstd = wslay_zstd_context_new ( server, shared, true );
+    wslay_zstd_context * client_zstd = wslay_zstd_context_new ( client, shared, true );
+    CU_ASSERT ( 0 == wslay_event_config_enable_extension ( server, &wslay_zstd_extension, server_zstd ) );
+    CU_ASSERT ( 0 == wslay_event_config_enable_extension ( client, &wslay_zstd_extension, client_zstd ) );
+
+    unsigned int i;
+    size_t length = 0;
+    for ( i = 0; i < 3; ++i ) {
+        arg.opcode = WSLAY_TEXT_FRAME;
+        arg.msg = ( const uint8_t * ) sample;
+        arg.msg_length = json_sample ( sample, sizeof ( sample ), i );
+        length += arg.msg_length;
+        CU_ASSERT ( 0 == wslay_event_queue_msg ( server, &arg ) );
+    }
+    CU_ASSERT ( 0 == wslay_event_send ( server ) );
+    /* dictionary compresses small messages to a fraction */
+    CU_ASSERT ( data.length < length / 2 );
+    CU_ASSERT ( 0xc1 == data.buf[0] );
+    /* each context compresses with its own state, only the dictionary is shared */
+    CU_ASSERT ( NULL != server_zstd->cctx );
+    CU_ASSERT ( NULL == client_zstd->cctx );
+
+    CU_ASSERT ( 0 == wslay_event_recv ( client ) );
+    CU_ASSERT ( 3 == data.msg_count );
+
+    talloc_free ( server );
+    talloc_free ( client );
+    talloc_free ( shared );
+}
+
+static int zstd_genmask_callback ( wslay_event_context * ctx, uint8_t *buf, size_t len, void *user_data )
+{
+    memset ( buf, 0, len );
+    return 0;
+}
+
+void test_wslay_zstd_window_limit ( void )
+{
+    struct wslay_event_callbacks callbacks;
+    struct zstd_user_data data;
+    static uint8_t msg[300000];
+    const uint8_t frame[] = {
+        0xc1, 0x0a, /* text frame with RSV1 */
+        0x28, 0xb5, 0x2f, 0xfd, /* zstd magic number */
+        0x00, /* frame header without content size */
+        0x88, /* window of 1 << 27 bytes */
+        0x09, 0x00, 0x00, 0x61 /* last raw block "a" */
+    };
+    wslay_zstd_shared * shared = wslay_zstd_shared_new ( NULL, NULL, 0, 3 );
+    CU_ASSERT_FATAL ( shared != NULL );
+    CU_ASSERT ( WSLAY_ZSTD_WINDOW_LOG == shared->window_log );
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_zstd_shared_set_window_log ( shared, 0 ) );
+    CU_ASSERT ( WSLAY_ERR_INVALID_ARGUMENT == wslay_zstd_shared_set_window_log ( shared, 100 ) );
+    CU_ASSERT ( WSLAY_ZSTD_WINDOW_LOG == shared->window_log );
+
+    /* message larger than the window is compressed within it, so the limited decoder accepts it */
+    wslay_zstd_context * zstd_ctx = wslay_zstd_context_new ( shared, shared, false );
+    CU_ASSERT_FATAL ( zstd_ctx != NULL );
+    size_t i;
+    for ( i = 0; i < sizeof ( msg ); ++i ) {
+        msg[i] = i * 7 % 251;
+    }
+    uint8_t * result;
+    size_t result_length;
+    CU_ASSERT_FATAL ( 0 == wslay_zstd_extension.encode ( zstd_ctx, WSLAY_BINARY_FRAME, msg, sizeof ( msg ), shared, &result, &result_length ) );
+    CU_ASSERT ( 0 == wslay_zstd_extension.decode_input ( zstd_ctx, result, result_length, true ) );
+    size_t decoded = 0;
+    ssize_t length;
+    uint8_t buf[4096];
+    while ( ( length = wslay_zstd_extension.decode_read ( zstd_ctx, buf, sizeof ( buf ) ) ) > 0 ) {
+        CU_ASSERT ( 0 == memcmp ( msg + decoded, buf, length ) );
+        decoded += length;
+    }
+    CU_ASSERT ( 0 == length );
+    CU_ASSERT ( sizeof ( msg ) == decoded );
+    wslay_zstd_extension.decode_end ( zstd_ctx );
+    talloc_free ( result );
+
+    /* frame declaring larger window closes the connection */
+    memset ( &callbacks, 0, sizeof ( callbacks ) );
+    callbacks.send_callback = zstd_send_callback;
+    callbacks.recv_callback = zstd_recv_callback;
+    callbacks.on_msg_recv_callback = zstd_msg_recv_callback;
+    callbacks.genmask_callback = zstd_genmask_callback;
+    memset ( &data, 0, sizeof ( data ) );
+    memcpy ( data.buf, frame, sizeof ( frame ) );
+    data.length = sizeof ( frame );
+    wslay_event_context * client = wslay_client_new ( NULL, &callbacks, &data );
+    CU_ASSERT_FATAL ( client != NULL );
+    CU_ASSERT ( 0 == wslay_event_config_enable_extension ( client, &wslay_zstd_extension, wslay_zstd_context_new ( client, shared, false ) ) );
+    CU_ASSERT ( 0 == wslay_event_recv ( client ) );
+    CU_ASSERT ( 0 == data.msg_count );
+    CU_ASSERT ( 0 == wslay_event_get_read_enabled ( client ) );
+    CU_ASSERT ( 0 == wslay_event_send ( client ) );
+    CU_ASSERT ( WSLAY_CODE_INVALID_FRAME_PAYLOAD_DATA == wslay_event_get_status_code_sent ( client ) );
+
+    talloc_free ( client );
+    talloc_free ( shared );
+}